@@ -5,7 +5,9 @@
 , egil
 , nix-filter
 , openldap
+, openssl
 , stdenv
+, zlib
 , doCheck ? true
 , isDebugBuild ? false
 }:
@@ -40,6 +42,8 @@ stdenv.mkDerivation {
     boost.dev
     curl.dev # libcurl
     openldap.dev # libldap
+    openssl.dev # for telling whether TLS sessions are resumed
+    zlib.dev # for compressing request bodies
   ];
 
   nativeBuildInputs = [
@@ -0,0 +1,297 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "change_plan.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <openssl/evp.h>
+
+using namespace std;
+
+namespace change_plan {
+
+namespace {
+
+const uint64_t MAGIC_NUMBER = 0xFFEEDDCCFEDC9A1E;
+const uint8_t CURRENT_VERSION = 2;
+
+// Marks that the whole plan has been applied (instead of an operation's index)
+const uint64_t FINISHED = numeric_limits<uint64_t>::max();
+
+// Thrown when the file ends in the middle of something
+class truncated : public runtime_error {
+public:
+    truncated() : runtime_error("the plan file is truncated") {}
+};
+
+class reader {
+public:
+    explicit reader(const string& path)
+        : ifs(path, ios::binary) {
+        if (!ifs.is_open()) {
+            throw runtime_error("failed to open " + path);
+        }
+        ifs.seekg(0, ios::end);
+        size = static_cast<uint64_t>(ifs.tellg());
+        remaining = size;
+        ifs.seekg(0, ios::beg);
+    }
+
+    bool at_end() const {
+        return remaining == 0;
+    }
+
+    /// How much we've read
+    uint64_t position() const {
+        return size - remaining;
+    }
+
+    template<typename T>
+    T read() {
+        if (remaining < sizeof(T)) {
+            throw truncated();
+        }
+        T value;
+        ifs.read(reinterpret_cast<char*>(&value), sizeof(T));
+        if (!ifs) {
+            throw runtime_error("failed to read the plan file");
+        }
+        remaining -= sizeof(T);
+        return value;
+    }
+
+    string read_string() {
+        auto len = read<uint64_t>();
+        if (len > remaining) {
+            throw truncated();
+        }
+        string value(len, '\0');
+        ifs.read(&value[0], len);
+        if (!ifs) {
+            throw runtime_error("failed to read the plan file");
+        }
+        remaining -= len;
+        return value;
+    }
+
+    shared_ptr<rendered_object> read_object(const operation& op) {
+        if (read<uint8_t>() == 0) {
+            return nullptr;
+        }
+        return make_shared<rendered_object>(op.id, op.type, read_string());
+    }
+
+private:
+    ifstream ifs;
+    uint64_t size = 0;
+    uint64_t remaining = 0;
+};
+
+template<typename T>
+void write(ofstream& ofs, const T& value) {
+    ofs.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void write_string(ofstream& ofs, const string& value) {
+    write<uint64_t>(ofs, value.size());
+    ofs.write(value.c_str(), value.size());
+}
+
+void write_object(ofstream& ofs, const shared_ptr<rendered_object>& object) {
+    write<uint8_t>(ofs, object != nullptr);
+    if (object != nullptr) {
+        write_string(ofs, object->get_json());
+    }
+}
+
+} // anonymous namespace
+
+cache_fingerprint fingerprint(const rendered_object_list& cache) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (ctx == nullptr || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+        throw runtime_error("failed to initialize SHA-256");
+    }
+
+    // The content hashes include the ids, so the ids don't need to be hashed separately
+    cache_fingerprint result;
+    for (const auto& p : cache) {
+        const auto& hash = p.second->get_hash();
+        EVP_DigestUpdate(ctx.get(), hash.data(), hash.size());
+        ++result.objects;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (EVP_DigestFinal_ex(ctx.get(), digest, &digest_length) != 1) {
+        throw runtime_error("failed to compute SHA-256");
+    }
+    copy(digest, digest + result.digest.size(), result.digest.begin());
+    return result;
+}
+
+void write(const string& path, const plan& p) {
+    // Write to a temporary file first, so a plan (which may be partly
+    // applied) isn't lost if we fail half way
+    auto tmp_path = path + ".tmp";
+    ofstream ofs(tmp_path, ios::binary | ios::trunc);
+    if (!ofs.is_open()) {
+        throw runtime_error("failed to create " + tmp_path);
+    }
+
+    write(ofs, MAGIC_NUMBER);
+    write(ofs, CURRENT_VERSION);
+
+    write(ofs, p.source.objects);
+    write(ofs, p.source.digest);
+
+    write<uint64_t>(ofs, p.copies.size());
+    for (const auto& id : p.copies) {
+        write_string(ofs, id);
+    }
+
+    write<uint64_t>(ofs, p.operations.size());
+    for (const auto& op : p.operations) {
+        write<uint8_t>(ofs, static_cast<uint8_t>(op.what));
+        write(ofs, op.step);
+        write_string(ofs, op.type);
+        write_string(ofs, op.id);
+        write_string(ofs, op.readable);
+        write_string(ofs, op.endpoint);
+        write_object(ofs, op.object);
+        write_object(ofs, op.previous);
+    }
+
+    ofs.close();
+    if (!ofs) {
+        throw runtime_error("failed to write " + tmp_path);
+    }
+
+    error_code ec;
+    filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        throw runtime_error("failed to rename " + tmp_path + " to " + path + ": " + ec.message());
+    }
+}
+
+plan read(const string& path) {
+    reader r(path);
+    plan p;
+
+    try {
+        if (r.read<uint64_t>() != MAGIC_NUMBER) {
+            throw runtime_error(path + " is not a plan file");
+        }
+        if (r.read<uint8_t>() != CURRENT_VERSION) {
+            throw runtime_error(path + " is a plan file of an unsupported version");
+        }
+
+        p.source.objects = r.read<uint64_t>();
+        p.source.digest = r.read<rendered_object::content_hash>();
+
+        auto n_copies = r.read<uint64_t>();
+        for (uint64_t i = 0; i < n_copies; ++i) {
+            p.copies.push_back(r.read_string());
+        }
+
+        auto n_operations = r.read<uint64_t>();
+        for (uint64_t i = 0; i < n_operations; ++i) {
+            operation op;
+            auto what = r.read<uint8_t>();
+            if (what > static_cast<uint8_t>(kind::remove_from_endpoint)) {
+                throw runtime_error("unknown operation in " + path);
+            }
+            op.what = static_cast<kind>(what);
+            op.step = r.read<uint64_t>();
+            op.type = r.read_string();
+            op.id = r.read_string();
+            op.readable = r.read_string();
+            op.endpoint = r.read_string();
+            op.object = r.read_object(op);
+            op.previous = r.read_object(op);
+            p.operations.push_back(op);
+        }
+    }
+    catch (const truncated&) {
+        throw runtime_error(path + " is truncated");
+    }
+    p.file_size = r.position();
+
+    // The outcomes, the last one may be incomplete if we were interrupted
+    try {
+        while (!r.at_end()) {
+            auto index = r.read<uint64_t>();
+            if (index == FINISHED) {
+                p.finished = true;
+                p.file_size = r.position();
+                continue;
+            }
+            if (index >= p.operations.size()) {
+                throw runtime_error("bad operation index in " + path);
+            }
+
+            result res;
+            auto what = r.read<uint8_t>();
+            if (what > static_cast<uint8_t>(outcome::other)) {
+                throw runtime_error("unknown outcome in " + path);
+            }
+            res.what = static_cast<outcome>(what);
+            if (res.what == outcome::other) {
+                const auto& op = p.operations[index];
+                res.other = make_shared<rendered_object>(op.id, op.type, r.read_string());
+            }
+            p.done[index] = res;
+            p.file_size = r.position();
+        }
+    }
+    catch (const truncated&) {
+    }
+
+    return p;
+}
+
+progress::progress(const string& path, const plan& p) {
+    std::error_code ec;
+    filesystem::resize_file(path, p.file_size, ec);
+    if (ec) {
+        throw runtime_error("failed to resize " + path + ": " + ec.message());
+    }
+    ofs.open(path, ios::binary | ios::app);
+    if (!ofs.is_open()) {
+        throw runtime_error("failed to open " + path);
+    }
+}
+
+void progress::done(uint64_t index, const result& r) {
+    write(ofs, index);
+    write<uint8_t>(ofs, static_cast<uint8_t>(r.what));
+    if (r.what == outcome::other) {
+        write_string(ofs, r.other->get_json());
+    }
+    ofs.flush();
+}
+
+void progress::finished() {
+    write(ofs, FINISHED);
+    ofs.flush();
+}
+
+} // namespace change_plan
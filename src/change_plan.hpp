@@ -0,0 +1,185 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_CHANGE_PLAN_HPP
+#define EGILSCIM_CHANGE_PLAN_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "model/rendered_object.hpp"
+#include "model/rendered_object_list.hpp"
+
+/**
+ * A change plan is what a run would do (the creates, updates and deletes
+ * to send to the SCIM server) written to a file instead of being done, so
+ * that it can be applied later (see --write-plan and --apply-plan).
+ *
+ * While the plan is applied, the outcome of each operation is appended to
+ * the plan file. If applying is interrupted, the next attempt continues
+ * with the operations that weren't done.
+ *
+ * The file format is binary (like the cache file):
+ *
+ *   magic number, version
+ *   the fingerprint of the cache file the plan was made from
+ *   the ids of the objects to copy from the cache
+ *   the operations
+ *   outcome records, appended while the plan is applied
+ *
+ * Strings are written as a 64 bit length followed by the characters.
+ */
+namespace change_plan {
+
+enum class kind : uint8_t {
+    create = 0,
+    update = 1,
+    remove = 2,
+
+    /// A delete when rebuilding the cache, we only know the id and endpoint
+    remove_from_endpoint = 3
+};
+
+struct operation {
+    kind what = kind::create;
+
+    /// All operations of a step must be done before the next step starts
+    uint64_t step = 0;
+
+    std::string type;
+    std::string id;
+
+    /// Human readable id, for error messages
+    std::string readable;
+
+    /// Only for remove_from_endpoint
+    std::string endpoint;
+
+    /// The object to send (for creates and updates)
+    std::shared_ptr<rendered_object> object;
+
+    /// The object in the cache (for updates and deletes)
+    std::shared_ptr<rendered_object> previous;
+};
+
+/// What an operation left in the new cache
+enum class outcome : uint8_t {
+    nothing = 0,
+    object = 1,
+    previous = 2,
+
+    /// Something else, such as a dummy object to make sure we update next run
+    other = 3
+};
+
+struct result {
+    outcome what = outcome::nothing;
+
+    /// Only for outcome::other
+    std::shared_ptr<rendered_object> other;
+};
+
+/**
+ * Identifies the contents of a cache file, so that we can tell whether
+ * it has changed since a plan was made from it.
+ */
+struct cache_fingerprint {
+    uint64_t objects = 0;
+
+    /// SHA-256 of the content hashes of all the objects, in id order
+    rendered_object::content_hash digest{};
+
+    bool operator==(const cache_fingerprint& other) const {
+        return objects == other.objects && digest == other.digest;
+    }
+
+    bool operator!=(const cache_fingerprint& other) const {
+        return !(*this == other);
+    }
+};
+
+/** Computes the fingerprint of the objects in a cache file. */
+cache_fingerprint fingerprint(const rendered_object_list& cache);
+
+struct plan {
+    /// The cache file the plan was made from
+    cache_fingerprint source;
+
+    /// Objects which haven't changed, they are copied from the cache
+    std::vector<std::string> copies;
+
+    std::vector<operation> operations;
+
+    /// The operations done so far (by index in operations)
+    std::map<uint64_t, result> done;
+
+    /// Whether the whole plan has been applied
+    bool finished = false;
+
+    /// The size of the file when read, without any incomplete outcome at the end
+    uint64_t file_size = 0;
+};
+
+/**
+ * Writes a plan to a file (without any outcomes). The file is only
+ * replaced once the new plan has been completely written.
+ *
+ * On error, an std::runtime_error is thrown.
+ */
+void write(const std::string& path, const plan& p);
+
+/**
+ * Reads a plan, including the outcomes of the operations done so far.
+ * An outcome which was only partially written (if we were interrupted
+ * while writing it) is ignored.
+ *
+ * On error, an std::runtime_error is thrown.
+ */
+plan read(const std::string& path);
+
+/**
+ * Appends outcomes to a plan file. Each outcome is flushed to the file
+ * as soon as it's written, so it isn't lost if we're interrupted.
+ */
+class progress {
+public:
+    /**
+     * 'p' is the plan as read from the file, anything after its
+     * last complete outcome is removed.
+     *
+     * Throws std::runtime_error if the file can't be opened.
+     */
+    progress(const std::string& path, const plan& p);
+
+    /** Records that operation 'index' is done, and what it left in the new cache. */
+    void done(uint64_t index, const result& r);
+
+    /** Records that the whole plan has been applied. */
+    void finished();
+
+private:
+    std::ofstream ofs;
+};
+
+} // namespace change_plan
+
+#endif // EGILSCIM_CHANGE_PLAN_HPP
@@ -0,0 +1,74 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "circuit_breaker.hpp"
+
+circuit_breaker::circuit_breaker(int max, clock::duration c)
+    : max_failures(max), cooldown(c) {
+}
+
+bool circuit_breaker::allow(clock::time_point now) {
+    switch (current) {
+    case state::closed:
+        return true;
+    case state::open:
+    case state::half_open:
+        // Only one probe at a time until we know whether the endpoint
+        // works again (another one if we never heard from the last)
+        if (now - opened_at >= cooldown) {
+            current = state::half_open;
+            opened_at = now;
+            return true;
+        }
+        break;
+    }
+    ++skipped;
+    return false;
+}
+
+void circuit_breaker::success() {
+    // While open, requests which were started before the
+    // breaker opened don't tell us anything new
+    if (current != state::open) {
+        current = state::closed;
+        failures = 0;
+    }
+}
+
+void circuit_breaker::failure(clock::time_point now) {
+    switch (current) {
+    case state::closed:
+        if (++failures > max_failures) {
+            open(now);
+        }
+        break;
+    case state::half_open:
+        open(now);
+        break;
+    case state::open:
+        break;
+    }
+}
+
+void circuit_breaker::open(clock::time_point now) {
+    current = state::open;
+    opened_at = now;
+    failures = 0;
+    ++times_opened;
+}
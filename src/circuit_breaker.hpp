@@ -0,0 +1,96 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_CIRCUIT_BREAKER_HPP
+#define EGILSCIM_CIRCUIT_BREAKER_HPP
+
+#include <chrono>
+
+/**
+ * Decides whether we should send requests to an endpoint which has
+ * been failing, so that a broken endpoint doesn't slow down the run
+ * while the other endpoints still get their requests.
+ *
+ * The breaker is closed (requests are sent) until there have been more
+ * than a given number of failures (timeouts or server errors) in a row.
+ * Then it opens, and requests are skipped (they fail immediately) for
+ * a while. After that one request is let through as a probe (half-open).
+ * If it succeeds the breaker closes again, otherwise it stays open for
+ * another while.
+ */
+class circuit_breaker {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    enum class state {
+        closed,
+        open,
+        half_open
+    };
+
+    /**
+     * 'max_failures' is how many failures in a row we accept, 'cooldown'
+     * is how long the breaker stays open before we try again.
+     */
+    circuit_breaker(int max_failures, clock::duration cooldown);
+
+    /**
+     * Returns whether a request may be sent now. If the breaker isn't
+     * closed and this returns true, the request is a probe and its
+     * outcome should be reported with success() or failure().
+     */
+    bool allow(clock::time_point now);
+
+    /** Called when a request got a response which means the endpoint works. */
+    void success();
+
+    /** Called when a request timed out or the endpoint responded with a server error. */
+    void failure(clock::time_point now);
+
+    state get_state() const {
+        return current;
+    }
+
+    /** Number of times the breaker has opened */
+    int get_times_opened() const {
+        return times_opened;
+    }
+
+    /** Number of requests we didn't send because the breaker was open */
+    int get_skipped() const {
+        return skipped;
+    }
+
+private:
+    void open(clock::time_point now);
+
+    int max_failures;
+    clock::duration cooldown;
+    state current = state::closed;
+
+    /// Failures in a row while closed
+    int failures = 0;
+
+    /// When the breaker opened, or when the last probe was let through
+    clock::time_point opened_at;
+    int times_opened = 0;
+    int skipped = 0;
+};
+
+#endif // EGILSCIM_CIRCUIT_BREAKER_HPP
@@ -20,6 +20,9 @@
 #include "config.hpp"
 #include "config_file.hpp"
 
+#include <algorithm>
+#include <thread>
+
 namespace config {
 
 char csv_separator() {
@@ -67,8 +70,110 @@ int http_max_acceptable_timeouts() {
     return config_file::instance().get_int("http-max-acceptable-timeouts", 3);
 }
 
+int http_circuit_breaker_cooldown() {
+    return config_file::instance().get_int("http-circuit-breaker-cooldown", 30);
+}
+
+int http_max_concurrent_requests() {
+    return std::max(config_file::instance().get_int("http-max-concurrent-requests", 1), 1);
+}
+
+int http_max_concurrent_requests(const std::string& type) {
+    auto global = http_max_concurrent_requests();
+    return std::min(config_file::instance().get_int(type + "-http-max-concurrent-requests", global), global);
+}
+
+bool http_adaptive_concurrency() {
+    return config_file::instance().get_bool("http-adaptive-concurrency");
+}
+
+int http_max_retry_after() {
+    return config_file::instance().get_int("http-max-retry-after", 60);
+}
+
+int http_retries() {
+    return config_file::instance().get_int("http-retries", 3);
+}
+
+bool http2_multiplexing() {
+    return config_file::instance().get_bool("http2-multiplexing");
+}
+
+bool http_compress_requests() {
+    return config_file::instance().get_bool("http-compress-requests");
+}
+
+int scim_query_page_size() {
+    return config_file::instance().get_int("scim-query-page-size", 1000);
+}
+
+bool scim_bulk() {
+    return config_file::instance().get_bool("scim-bulk");
+}
+
+bool scim_patch() {
+    return config_file::instance().get_bool("scim-patch");
+}
+
+std::string tls_session_cache_file() {
+    auto& config = config_file::instance();
+    if (!config.get_bool("tls-session-cache")) {
+        return "";
+    }
+    auto cache_file = config.get_path("cache-file", true);
+    return cache_file.empty() ? "" : cache_file + ".tls";
+}
+
+int status_file_slowest_requests() {
+    return config_file::instance().get_int("status-file-slowest-requests", 10);
+}
+
 bool escape_expansions_by_default() {
     return config_file::instance().get_bool("escape-expansions-by-default");
 }
 
+int render_threads() {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(config_file::instance().get_int("render-threads", std::max(cores, 1)), 1);
+}
+
+bool scim_type_barrier() {
+    return config_file::instance().get_bool("scim-type-barrier");
+}
+
+std::string ldap_incremental_file() {
+    auto& config = config_file::instance();
+    if (!config.get_bool("ldap-incremental")) {
+        return "";
+    }
+    auto cache_file = config.get_path("cache-file", true);
+    return cache_file.empty() ? "" : cache_file + ".ldap";
+}
+
+std::string ldap_incremental_attribute() {
+    auto attribute = config_file::instance().get("ldap-incremental-attribute", true);
+    return attribute.empty() ? "modifyTimestamp" : attribute;
+}
+
+int ldap_full_load_interval() {
+    return std::max(config_file::instance().get_int("ldap-full-load-interval", 24), 0);
+}
+
+int daemon_interval() {
+    return std::max(config_file::instance().get_int("daemon-interval", 600), 1);
+}
+
+bool ldap_watch_changes() {
+    return config_file::instance().get_bool("ldap-watch-changes");
+}
+
+int ldap_change_delay() {
+    return std::max(config_file::instance().get_int("ldap-change-delay", 5), 0);
+}
+
+shard sync_shard() {
+    auto setting = config_file::instance().get("shard", true);
+    return setting.empty() ? shard() : shard::parse(setting);
+}
+
 } // namespace config
@@ -20,6 +20,9 @@
 #ifndef EGILSCIM_CONFIG_HPP
 #define EGILSCIM_CONFIG_HPP
 
+#include <string>
+#include "shard.hpp"
+
 namespace config {
 
 char csv_separator();
@@ -40,11 +43,73 @@ int http_connection_timeout();
 /** Timeout setting (seconds) for the whole HTTP request (including connection) */
 int http_request_timeout();
 
-/** The maximum number of timeouts we accept before we stop making
-  *  more requests.
+/** The maximum number of failures (timeouts or server errors) in a row
+  *  we accept for an endpoint before we stop making requests to it for
+  *  a while (see circuit_breaker).
   */
 int http_max_acceptable_timeouts();
 
+/** How long (seconds) we stop making requests to an endpoint which has
+ *  been failing, before we try again.
+ */
+int http_circuit_breaker_cooldown();
+
+/** The maximum number of HTTP requests we'll have in flight at the same
+ *  time, in total (defaults to 1, i.e. one request at a time).
+ */
+int http_max_concurrent_requests();
+
+/** The maximum number of HTTP requests we'll have in flight at the same
+ *  time while sending objects of the given type. If there's no setting
+ *  for the type the global setting is used. A setting for the type can
+ *  only lower the limit, not raise it above the global setting.
+ */
+int http_max_concurrent_requests(const std::string& type);
+
+/** Should the number of concurrent requests adapt to how the server
+ *  responds (with http_max_concurrent_requests as the upper bound)?
+ */
+bool http_adaptive_concurrency();
+
+/** The longest time (in seconds) we'll pause if the server asks
+ *  us to wait with a Retry-After header.
+ */
+int http_max_retry_after();
+
+/** How many times a create, update or delete which failed in a way that
+ *  is likely to be temporary (e.g. a timeout or 503) is retried before
+ *  the end of the run. Zero means failed requests aren't retried.
+ */
+int http_retries();
+
+/** Should we ask for HTTP/2 and multiplex all concurrent requests
+ *  over a single connection to the SCIM server?
+ */
+bool http2_multiplexing();
+
+/** Should request bodies be compressed with gzip? */
+bool http_compress_requests();
+
+/** How many resources we ask for per page when we fetch the ids of
+ *  all resources from the SCIM server (for --rebuild-cache).
+ */
+int scim_query_page_size();
+
+/** Should we use SCIM Bulk requests if the server supports them? */
+bool scim_bulk();
+
+/** Should we update with PATCH (instead of PUT) if the server supports it? */
+bool scim_patch();
+
+/** The file where TLS sessions are saved between runs, so the next run can
+ *  resume them instead of doing full handshakes. Empty if TLS sessions
+ *  shouldn't be saved.
+ */
+std::string tls_session_cache_file();
+
+/** How many of the slowest HTTP requests are listed in the status file. */
+int status_file_slowest_requests();
+
 /** Should variable expansions be escaped for JSON by default?
  *  If true, a variable expansion like ${foo} will escape foo's value,
  *  in that case ${|foo} can be used to disable escaping for a specific variable.
@@ -52,6 +117,55 @@ int http_max_acceptable_timeouts();
  */
 bool escape_expansions_by_default();
 
+/** The number of threads rendering objects to JSON. Defaults to
+ *  the number of cores, 1 renders the objects one at a time.
+ */
+int render_threads();
+
+/** Should all objects of a type be sent before we start with the next
+ *  type in scim-type-send-order? If not, an object only waits for the
+ *  objects it refers to.
+ */
+bool scim_type_barrier();
+
+/** The file where the entries loaded from LDAP are saved between runs,
+ *  so the next run only needs to ask for the entries which have changed.
+ *  Empty if LDAP shouldn't be loaded incrementally.
+ */
+std::string ldap_incremental_file();
+
+/** The attribute which tells us which LDAP entries have changed since
+ *  the last run, e.g. modifyTimestamp or uSNChanged.
+ */
+std::string ldap_incremental_attribute();
+
+/** How often (in hours) we do a full load from LDAP even though we're
+ *  loading incrementally, so we notice entries which have been deleted.
+ */
+int ldap_full_load_interval();
+
+/** How often (in seconds) the client syncs when running as a daemon
+ *  (counted from the start of one sync to the start of the next).
+ */
+int daemon_interval();
+
+/** Should a daemon watch the LDAP server for changes, and sync
+ *  when something has changed instead of waiting for daemon_interval?
+ */
+bool ldap_watch_changes();
+
+/** How long (in seconds) a daemon waits after the LDAP server has
+ *  notified it about a change before it syncs, so changes made
+ *  together are sent together.
+ */
+int ldap_change_delay();
+
+/** Which shard of the objects this process syncs (all objects
+ *  unless "shard" is set, see --shard). Throws std::runtime_error
+ *  if the setting isn't valid.
+ */
+shard sync_shard();
+
 } // namespace config
 
 #endif // EGILSCIM_CONFIG_HPP
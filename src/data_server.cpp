@@ -99,6 +99,16 @@ bool data_server::load(std::shared_ptr<sql::plugin> sql_plugin) {
         }
 
         ext_proc->cleanup_sessions();
+
+        if (snapshot) {
+            try {
+                snapshot->write(config::ldap_incremental_file());
+            }
+            catch (const std::runtime_error& e) {
+                // Not fatal, the next run will ask for more changes (or do a full load)
+                std::cerr << "Failed to save the entries loaded from LDAP: " << e.what() << std::endl;
+            }
+        }
     } catch (std::string msg) {
         return false;
     }
@@ -109,6 +119,20 @@ bool data_server::load(std::shared_ptr<sql::plugin> sql_plugin) {
     return true;
 }
 
+ldap_snapshot& data_server::get_ldap_snapshot() {
+    if (!snapshot) {
+        try {
+            snapshot = std::make_unique<ldap_snapshot>(ldap_snapshot::read(config::ldap_incremental_file()));
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Failed to read the entries loaded from LDAP in the last run, "
+                      << "doing a full load: " << e.what() << std::endl;
+            snapshot = std::make_unique<ldap_snapshot>();
+        }
+    }
+    return *snapshot;
+}
+
 /**
  * An object is considered an orphan if it's missing all the
  * attributes given. For instance, a Student might be considered
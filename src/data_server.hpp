@@ -26,6 +26,7 @@
 #include "model/object_list.hpp"
 #include "utility/indented_logger.hpp"
 #include "ldap_wrapper.hpp"
+#include "ldap_snapshot.hpp"
 #include "csv_store.hpp"
 #include "sql.hpp"
 #include "external_process.hpp"
@@ -35,6 +36,7 @@ class data_server {
     std::map<std::string, std::shared_ptr<object_list>> data;
 
     std::unique_ptr<ldap_wrapper> ldap;
+    std::unique_ptr<ldap_snapshot> snapshot;
     std::unique_ptr<csv_store> csv;
     stderr_sink ext_proc_errors;
     std::unique_ptr<external_process_manager> ext_proc;
@@ -52,10 +54,21 @@ public:
     void clear() {
         data.clear();
         ldap.reset();
+        snapshot.reset();
         csv.reset();
         ext_proc.reset();
     }
 
+    /**
+     * Forgets the loaded data before loading again, but keeps the
+     * connection to the LDAP server (and what was loaded from it
+     * when loading incrementally).
+     */
+    void clear_data() {
+        data.clear();
+        csv.reset();
+    }
+
     bool empty() {
         return data.empty();
     }
@@ -93,6 +106,13 @@ public:
         return ldap.get();
     }
 
+    /**
+     * The entries loaded from LDAP in the last run, when loading
+     * incrementally. Read from file the first time it's needed,
+     * and saved when everything has been loaded.
+     */
+    ldap_snapshot& get_ldap_snapshot();
+
     csv_store* get_csv_store() {
         if (csv.get() == nullptr) {
             csv.reset(new csv_store());
@@ -0,0 +1,109 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "dependency_scheduler.hpp"
+
+#include <cctype>
+
+void dependency_scheduler::add(const std::string& id,
+                               const std::vector<std::string>& after,
+                               std::function<void()> start) {
+    std::unordered_set<std::string> waiting_for;
+    for (const auto& other : after) {
+        if (other != id && pending.count(other)) {
+            waiting_for.insert(other);
+        }
+    }
+
+    if (!id.empty()) {
+        pending.insert(id);
+    }
+
+    if (waiting_for.empty()) {
+        start();
+        return;
+    }
+
+    size_t operation = next_operation++;
+    waiting_operations[operation] = waiting_operation{ start, waiting_for.size() };
+    for (const auto& other : waiting_for) {
+        dependents[other].push_back(operation);
+    }
+    ++waited;
+}
+
+void dependency_scheduler::done(const std::string& id) {
+    if (pending.erase(id) == 0) {
+        return;
+    }
+
+    auto itr = dependents.find(id);
+    if (itr == dependents.end()) {
+        return;
+    }
+
+    for (auto operation : itr->second) {
+        auto waiting = waiting_operations.find(operation);
+        if (--waiting->second.remaining == 0) {
+            ready.push_back(std::move(waiting->second.start));
+            waiting_operations.erase(waiting);
+        }
+    }
+    dependents.erase(itr);
+}
+
+bool dependency_scheduler::start_ready() {
+    bool started = false;
+    // Starting an operation may make more operations ready
+    while (!ready.empty()) {
+        auto start = std::move(ready.front());
+        ready.pop_front();
+        start();
+        started = true;
+    }
+    return started;
+}
+
+std::vector<std::string> dependency_scheduler::string_values(const std::string& json) {
+    std::vector<std::string> values;
+
+    size_t i = 0;
+    while ((i = json.find('"', i)) != std::string::npos) {
+        std::string value;
+        for (++i; i < json.size() && json[i] != '"'; ++i) {
+            // Escaped characters are taken as they are, which is right
+            // for \" and \\ and good enough for comparing with ids
+            if (json[i] == '\\' && i + 1 < json.size()) {
+                ++i;
+            }
+            value += json[i];
+        }
+        ++i;
+
+        size_t next = i;
+        while (next < json.size() && isspace(static_cast<unsigned char>(json[next]))) {
+            ++next;
+        }
+        if (next >= json.size() || json[next] != ':') {
+            values.push_back(value);
+        }
+    }
+
+    return values;
+}
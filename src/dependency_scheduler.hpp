@@ -0,0 +1,104 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_DEPENDENCY_SCHEDULER_HPP
+#define EGILSCIM_DEPENDENCY_SCHEDULER_HPP
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Starts operations as soon as the operations they depend on are done,
+ * instead of waiting for everything that was started before them.
+ *
+ * For instance a StudentGroup which refers to some Students only needs
+ * to wait for those Students to be created (if they are new), not for
+ * all other Students.
+ *
+ * An operation can only depend on operations added before it, so there
+ * can't be any cycles.
+ *
+ * Operations which become ready when something is done aren't started
+ * by done() (which is typically called from a callback when a request
+ * has completed), but by start_ready(), which should be called when it's
+ * safe to start new requests.
+ */
+class dependency_scheduler {
+public:
+    /**
+     * Adds an operation. 'id' is what later operations use to refer to
+     * this one (empty if nothing can depend on it). 'after' are the ids
+     * of the operations it depends on, ids of operations which aren't
+     * pending (not added, or already done) are ignored.
+     *
+     * If the operation doesn't need to wait, it is started right away.
+     */
+    void add(const std::string& id,
+             const std::vector<std::string>& after,
+             std::function<void()> start);
+
+    /** The operation with the given id is done */
+    void done(const std::string& id);
+
+    /**
+     * Starts the operations which no longer have to wait.
+     * Returns whether anything was started.
+     */
+    bool start_ready();
+
+    /** Number of operations waiting for other operations */
+    size_t waiting() const {
+        return waiting_operations.size() + ready.size();
+    }
+
+    /** Number of operations which had to wait for other operations */
+    size_t get_waited() const {
+        return waited;
+    }
+
+    /**
+     * Returns the string values in a JSON text (but not the member names),
+     * which is where an object refers to other objects by their ids.
+     */
+    static std::vector<std::string> string_values(const std::string& json);
+
+private:
+    struct waiting_operation {
+        std::function<void()> start;
+        size_t remaining;
+    };
+
+    /// Ids of operations which have been added but aren't done
+    std::unordered_set<std::string> pending;
+
+    /// For each pending id, the operations waiting for it
+    std::unordered_map<std::string, std::vector<size_t>> dependents;
+
+    std::unordered_map<size_t, waiting_operation> waiting_operations;
+    size_t next_operation = 0;
+
+    std::deque<std::function<void()>> ready;
+    size_t waited = 0;
+};
+
+#endif // EGILSCIM_DEPENDENCY_SCHEDULER_HPP
@@ -0,0 +1,75 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "http_retry.hpp"
+
+#include <algorithm>
+
+namespace http_retry {
+
+namespace {
+
+const std::chrono::milliseconds FIRST_DELAY(1000);
+const std::chrono::milliseconds MAX_DELAY(30000);
+
+} // anonymous namespace
+
+bool transient_response(long response_code) {
+    switch (response_code) {
+    case 408: // Request Timeout
+    case 429: // Too Many Requests
+    case 500: // Internal Server Error
+    case 502: // Bad Gateway
+    case 503: // Service Unavailable
+    case 504: // Gateway Timeout
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool transient_error(CURLcode error) {
+    switch (error) {
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::chrono::milliseconds backoff(int attempt, double random) {
+    auto delay = FIRST_DELAY;
+    for (int i = 1; i < attempt && delay < MAX_DELAY; ++i) {
+        delay *= 2;
+    }
+    delay = std::min(delay, MAX_DELAY);
+
+    random = std::clamp(random, 0.0, 1.0);
+    return delay / 2 + std::chrono::milliseconds(static_cast<long long>(delay.count() / 2 * random));
+}
+
+} // namespace http_retry
@@ -0,0 +1,62 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_HTTP_RETRY_HPP
+#define EGILSCIM_HTTP_RETRY_HPP
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#endif
+#include <curl/curl.h>
+#include <chrono>
+
+/**
+ * Decides which failed requests are worth trying again later in the
+ * same run, and how long to wait before doing so.
+ */
+namespace http_retry {
+
+/**
+ * Returns whether an HTTP response code means the server had a temporary
+ * problem (such as 503 Service Unavailable) so the request may succeed
+ * if we try again.
+ */
+bool transient_response(long response_code);
+
+/**
+ * Returns whether a curl error is likely to be temporary, such as a
+ * timeout or a connection which was reset.
+ */
+bool transient_error(CURLcode error);
+
+/**
+ * How long to wait before the given attempt (1 for the first retry).
+ *
+ * The delay doubles for each attempt, starting at one second and never
+ * longer than 30 seconds. Half of the delay is random so that requests
+ * which failed at the same time don't all come back at the same time.
+ * 'random' should be uniformly distributed in [0, 1).
+ */
+std::chrono::milliseconds backoff(int attempt, double random);
+
+} // namespace http_retry
+
+#endif // EGILSCIM_HTTP_RETRY_HPP
@@ -0,0 +1,224 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ldap_snapshot.hpp"
+#include "utility/temporary_umask.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const uint64_t MAGIC_NUMBER = 0xFFEEDDCCFEDC1DAF;
+const uint8_t CURRENT_VERSION = 1;
+
+template<typename T>
+T read(std::ifstream& ifs) {
+    T buff;
+    ifs.read(reinterpret_cast<char*>(&buff), sizeof(T));
+
+    if (!ifs || (size_t)ifs.gcount() < sizeof(T)) {
+        throw std::runtime_error("failed to read LDAP snapshot file");
+    }
+    return buff;
+}
+
+template<>
+std::string read(std::ifstream& ifs) {
+    auto len = read<uint64_t>(ifs);
+    std::string value(len, '\0');
+    ifs.read(&value[0], len);
+
+    if (!ifs || ifs.gcount() < 0 || (uint64_t)ifs.gcount() < len) {
+        throw std::runtime_error("failed to read LDAP snapshot file");
+    }
+    return value;
+}
+
+template<typename T>
+void write(std::ofstream& ofs, const T& value) {
+    ofs.write((const char*)&value, sizeof(T));
+
+    if (!ofs) {
+        throw std::runtime_error("failed to write LDAP snapshot file");
+    }
+}
+
+template<>
+void write(std::ofstream& ofs, const std::string& value) {
+    write<uint64_t>(ofs, value.size());
+    ofs.write(value.c_str(), value.size());
+
+    if (!ofs) {
+        throw std::runtime_error("failed to write LDAP snapshot file");
+    }
+}
+
+std::shared_ptr<base_object> read_entry(std::ifstream& ifs) {
+    attrib_map attributes;
+    auto n_attributes = read<uint64_t>(ifs);
+    for (uint64_t i = 0; i < n_attributes; ++i) {
+        auto name = read<std::string>(ifs);
+        string_vector values(read<uint64_t>(ifs));
+        for (auto& value : values) {
+            value = read<std::string>(ifs);
+        }
+        attributes.emplace(name, std::move(values));
+    }
+    return std::make_shared<base_object>(std::move(attributes));
+}
+
+void write_entry(std::ofstream& ofs, const base_object& entry) {
+    write<uint64_t>(ofs, std::distance(entry.begin(), entry.end()));
+    for (const auto& attribute : entry) {
+        write(ofs, attribute.first);
+        write<uint64_t>(ofs, attribute.second.size());
+        for (const auto& value : attribute.second) {
+            write(ofs, value);
+        }
+    }
+}
+
+bool is_number(const std::string& s) {
+    return !s.empty() &&
+        std::all_of(s.begin(), s.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+/** Escapes a value for use in an LDAP filter (RFC 4515) */
+std::string escape_filter_value(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '*' || c == '(' || c == ')' || c == '\\' || c == '\0') {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "\\%02x", static_cast<unsigned char>(c));
+            escaped += hex;
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+} // namespace
+
+ldap_snapshot ldap_snapshot::read(const std::string& path) {
+    ldap_snapshot snapshot;
+
+    if (!std::filesystem::exists(path)) {
+        return snapshot;
+    }
+
+    std::ifstream ifs(path, std::ios_base::in | std::ios_base::binary);
+    if (!ifs) {
+        throw std::runtime_error("failed to open file: " + path);
+    }
+
+    if (::read<uint64_t>(ifs) != MAGIC_NUMBER) {
+        throw std::runtime_error("unrecognized file format: " + path);
+    }
+
+    if (::read<uint8_t>(ifs) > CURRENT_VERSION) {
+        throw std::runtime_error("version number of LDAP snapshot file is too high");
+    }
+
+    auto n_types = ::read<uint64_t>(ifs);
+    for (uint64_t i = 0; i < n_types; ++i) {
+        auto& type = snapshot.types[::read<std::string>(ifs)];
+        type.search = ::read<std::string>(ifs);
+        type.watermark = ::read<std::string>(ifs);
+        type.last_full_load = ::read<int64_t>(ifs);
+
+        auto n_entries = ::read<uint64_t>(ifs);
+        for (uint64_t j = 0; j < n_entries; ++j) {
+            auto uid = ::read<std::string>(ifs);
+            type.entries[uid] = read_entry(ifs);
+        }
+    }
+
+    return snapshot;
+}
+
+void ldap_snapshot::write(const std::string& path) const {
+    auto tmp_path = path + ".tmp";
+    {
+        // The entries may contain personal data
+        temporary_umask mask(0077);
+        std::ofstream ofs(tmp_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!ofs) {
+            throw std::runtime_error("failed to open file: " + tmp_path);
+        }
+
+        ::write(ofs, MAGIC_NUMBER);
+        ::write(ofs, CURRENT_VERSION);
+        ::write<uint64_t>(ofs, types.size());
+        for (const auto& type : types) {
+            ::write(ofs, type.first);
+            ::write(ofs, type.second.search);
+            ::write(ofs, type.second.watermark);
+            ::write(ofs, type.second.last_full_load);
+            ::write<uint64_t>(ofs, type.second.entries.size());
+            for (const auto& entry : type.second.entries) {
+                ::write(ofs, entry.first);
+                write_entry(ofs, *entry.second);
+            }
+        }
+
+        ofs.close();
+        if (!ofs) {
+            throw std::runtime_error("failed to write file: " + tmp_path);
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        throw std::runtime_error("failed to rename " + tmp_path + " to " + path + ": " + ec.message());
+    }
+}
+
+std::string ldap_snapshot::changed_since(const std::string& attribute,
+                                         const std::string& watermark) {
+    return "(" + attribute + ">=" + escape_filter_value(watermark) + ")";
+}
+
+std::string ldap_snapshot::highest(const std::string& a, const std::string& b) {
+    if (a.empty() || b.empty()) {
+        return a.empty() ? b : a;
+    }
+
+    if (is_number(a) && is_number(b)) {
+        auto strip = [](const std::string& s) {
+            auto first = s.find_first_not_of('0');
+            return first == std::string::npos ? std::string("0") : s.substr(first);
+        };
+        auto x = strip(a), y = strip(b);
+        if (x.size() != y.size()) {
+            return x.size() > y.size() ? a : b;
+        }
+        return x >= y ? a : b;
+    }
+
+    return a >= b ? a : b;
+}
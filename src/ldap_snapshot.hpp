@@ -0,0 +1,93 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_LDAP_SNAPSHOT_HPP
+#define EGILSCIM_LDAP_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include "model/base_object.hpp"
+
+/**
+ * The entries loaded from LDAP in the last run, saved between runs so
+ * the next run only needs to ask the LDAP server for the entries which
+ * have changed since then (see config::ldap_incremental_file).
+ *
+ * The entries are kept as they came from the LDAP server, before any
+ * transforms, so the merged entries can be loaded just as if the LDAP
+ * server had returned all of them.
+ */
+class ldap_snapshot {
+public:
+    struct type_snapshot {
+        /** Describes how the entries were searched for, if that has
+         *  changed the entries can't be used.
+         */
+        std::string search;
+
+        /** The highest value of the watermark attribute we've seen */
+        std::string watermark;
+
+        /** When we last did a full load (seconds since the epoch) */
+        int64_t last_full_load = 0;
+
+        /** The entries, by uid */
+        std::map<std::string, std::shared_ptr<base_object>> entries;
+    };
+
+    /**
+     * Reads a snapshot from file. If the file doesn't exist the snapshot
+     * is empty. On error, an std::runtime_error is thrown.
+     */
+    static ldap_snapshot read(const std::string& path);
+
+    /**
+     * Writes the snapshot to file (via a temporary file, so a failed
+     * write leaves the old file as it was).
+     * On error, an std::runtime_error is thrown.
+     */
+    void write(const std::string& path) const;
+
+    /** The snapshot for a type (empty if we have nothing for it) */
+    type_snapshot& get(const std::string& type) {
+        return types[type];
+    }
+
+    /**
+     * The LDAP filter for entries which have changed since 'watermark',
+     * i.e. with a value for 'attribute' which isn't lower.
+     */
+    static std::string changed_since(const std::string& attribute,
+                                     const std::string& watermark);
+
+    /**
+     * Returns the highest of two watermarks. Watermarks which are
+     * numbers (like uSNChanged) are compared as numbers, others (like
+     * modifyTimestamp) as strings. An empty watermark is lower than
+     * all others.
+     */
+    static std::string highest(const std::string& a, const std::string& b);
+
+private:
+    std::map<std::string, type_snapshot> types;
+};
+
+#endif // EGILSCIM_LDAP_SNAPSHOT_HPP
@@ -18,8 +18,11 @@
  */
 
 #include "ldap_wrapper.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <set>
 #include <string>
+#include <thread>
 #ifdef _WIN32
 #ifndef NOMINMAX
 #define NOMINMAX
@@ -33,6 +36,7 @@
 #endif
 #include "json_data_file.hpp"
 #include "config_file.hpp"
+#include "config.hpp"
 #include "utility/simplescim_error_string.hpp"
 #include "simplescim_ldap_attrs_parser.hpp"
 
@@ -227,6 +231,17 @@ struct ldap_wrapper::Impl {
 
     connection conn;
 
+    /**
+     * The search started by watch_changes()
+     */
+    struct watch_state {
+        int msgid = -1;
+
+        /// With content synchronization, the server first sends all entries
+        /// (which aren't changes), then a Sync Info message
+        bool refreshing = false;
+    } ws;
+
     Impl() {
         ldap_get_variables();
 
@@ -240,6 +255,11 @@ struct ldap_wrapper::Impl {
                 unique_strings.emplace(a);
         }
 
+        // Needed to know which entries have changed when loading incrementally
+        if (!config::ldap_incremental_file().empty()) {
+            unique_strings.emplace(config::ldap_incremental_attribute());
+        }
+
         for (auto &&a: unique_strings) {
             ldap_attrs += a + ",";
         }
@@ -378,7 +398,9 @@ struct ldap_wrapper::Impl {
 
     bool search(const std::string &intype,
                 indented_logger& load_logger,
-                const std::pair<std::string, std::string> &filters) {
+                const std::pair<std::string, std::string> &filters,
+                const std::string &condition = "",
+                bool matching_type_filter = true) {
         if (!conn.initialised)
             return false;
 
@@ -435,6 +457,17 @@ struct ldap_wrapper::Impl {
         ss.base = filter_val.first;
         ss.filter = filter_val.second;
 
+        if (!condition.empty()) {
+            auto in_parens = [](const std::string& f) {
+                return !f.empty() && f[0] == '(' ? f : "(" + f + ")";
+            };
+            std::string type_filter = ss.filter.empty() ? "(objectClass=*)" : in_parens(ss.filter);
+            if (!matching_type_filter) {
+                type_filter = "(!" + type_filter + ")";
+            }
+            ss.filter = "(&" + type_filter + in_parens(condition) + ")";
+        }
+
         /** Parse attrs */
         int err = simplescim_ldap_attrs_parser(ldap_attrs.c_str(), &ss.attrs_val);
 
@@ -566,6 +599,165 @@ struct ldap_wrapper::Impl {
         return entry_to_base_object(ss.current_entry);
     }
 
+#ifndef _WIN32
+    /**
+     * Returns the server's supportedControl (from the root DSE).
+     */
+    std::vector<std::string> supported_controls() {
+        std::vector<std::string> controls;
+        char attr[] = "supportedControl";
+        char *attrs[] = { attr, nullptr };
+        LDAPMessage *msg = nullptr;
+
+        int err = ldap_search_ext_s_utf8(conn.simplescim_ldap_ld, "", LDAP_SCOPE_BASE, "(objectClass=*)",
+                                         attrs, 0, nullptr, nullptr, LDAP_NO_LIMIT, &msg);
+        if (err == LDAP_SUCCESS) {
+            LDAPMessage *entry = ldap_first_entry(conn.simplescim_ldap_ld, msg);
+            berval **vals = entry ? ldap_get_values_len(conn.simplescim_ldap_ld, entry, attr) : nullptr;
+            if (vals != nullptr) {
+                for (size_t i = 0; vals[i] != nullptr; ++i) {
+                    controls.emplace_back(vals[i]->bv_val, vals[i]->bv_len);
+                }
+                ldap_value_free_len(vals);
+            }
+        }
+        if (msg != nullptr) {
+            ldap_msgfree(msg);
+        }
+        return controls;
+    }
+
+    bool watch_changes() {
+        const char *SYNC_OID = "1.3.6.1.4.1.4203.1.9.1.1";            // RFC 4533
+        const char *PERSISTENT_SEARCH_OID = "2.16.840.1.113730.3.4.3";
+        const char *AD_NOTIFICATION_OID = "1.2.840.113556.1.4.528";
+
+        if (!conn.initialised) {
+            return false;
+        }
+
+        auto controls = supported_controls();
+        auto supported = [&](const char *oid) {
+            return std::find(controls.begin(), controls.end(), oid) != controls.end();
+        };
+
+        LDAPControl control{};
+        control.ldctl_iscritical = 1;
+        BerElement *ber = nullptr;
+        std::string method;
+
+        if (supported(SYNC_OID)) {
+            // refreshAndPersist, without a cookie since we only want to know that something changed
+            ber = ber_alloc_t(LBER_USE_DER);
+            ber_printf(ber, "{e}", 3);
+            control.ldctl_oid = const_cast<char*>(SYNC_OID);
+            method = "content synchronization";
+        }
+        else if (supported(PERSISTENT_SEARCH_OID)) {
+            // All change types, only changes, no entry change controls
+            ber = ber_alloc_t(LBER_USE_DER);
+            ber_printf(ber, "{ibb}", 15, 1, 0);
+            control.ldctl_oid = const_cast<char*>(PERSISTENT_SEARCH_OID);
+            method = "persistent search";
+        }
+        else if (supported(AD_NOTIFICATION_OID)) {
+            control.ldctl_oid = const_cast<char*>(AD_NOTIFICATION_OID);
+            method = "change notifications";
+        }
+        else {
+            std::cerr << "The LDAP server can't notify us about changes "
+                      << "(it supports neither content synchronization, persistent search "
+                      << "nor Active Directory's change notifications)" << std::endl;
+            return false;
+        }
+
+        if (ber != nullptr && ber_flatten2(ber, &control.ldctl_value, 0) == -1) {
+            std::cerr << "Failed to encode LDAP control for " << method << std::endl;
+            ber_free(ber, 1);
+            return false;
+        }
+
+        LDAPControl *serverctrls[] = { &control, nullptr };
+        char no_attributes[] = "1.1";
+        char *attrs[] = { no_attributes, nullptr };
+        std::vector<char> base(ldap_base.begin(), ldap_base.end());
+        base.push_back(0);
+        char filter[] = "(objectClass=*)";
+
+        int err = ldap_search_ext(conn.simplescim_ldap_ld, &base[0], LDAP_SCOPE_SUBTREE, filter, attrs, 0,
+                                  serverctrls, nullptr, nullptr, LDAP_NO_LIMIT, &ws.msgid);
+        if (ber != nullptr) {
+            ber_free(ber, 1);
+        }
+
+        if (err != LDAP_SUCCESS) {
+            std::cerr << "Failed to start watching LDAP for changes (" << method << "): "
+                      << ldap_err2string(err) << std::endl;
+            ws.msgid = -1;
+            return false;
+        }
+
+        ws.refreshing = method == "content synchronization";
+        std::cout << "Watching LDAP for changes (" << method << ")" << std::endl;
+        return true;
+    }
+
+    bool wait_for_change(std::chrono::milliseconds timeout) {
+        if (ws.msgid == -1) {
+            std::this_thread::sleep_for(timeout);
+            return false;
+        }
+
+        bool changed = false;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+        struct timeval tv;
+        tv.tv_sec = static_cast<long>(us / 1000000);
+        tv.tv_usec = static_cast<long>(us % 1000000);
+
+        LDAPMessage *msg = nullptr;
+        int type;
+        while ((type = ldap_result(conn.simplescim_ldap_ld, ws.msgid, LDAP_MSG_ONE, &tv, &msg)) > 0) {
+            switch (type) {
+            case LDAP_RES_SEARCH_ENTRY:
+                changed = changed || !ws.refreshing;
+                break;
+            case LDAP_RES_INTERMEDIATE:
+                // Sync Info messages, the first one ends the refresh
+                changed = changed || !ws.refreshing;
+                ws.refreshing = false;
+                break;
+            case LDAP_RES_SEARCH_RESULT: {
+                int result = LDAP_SUCCESS;
+                ldap_parse_result(conn.simplescim_ldap_ld, msg, &result, nullptr, nullptr, nullptr, nullptr, 0);
+                std::cerr << "The LDAP server stopped notifying us about changes: "
+                          << ldap_err2string(result) << std::endl;
+                ws.msgid = -1;
+                break;
+            }
+            default:
+                break;
+            }
+            ldap_msgfree(msg);
+            msg = nullptr;
+
+            if (ws.msgid == -1) {
+                return changed;
+            }
+
+            // Take what has already arrived, without waiting more
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+        }
+
+        // Unless interrupted by a signal (like SIGUSR1), the connection is gone
+        if (type == -1 && errno != EINTR) {
+            std::cerr << "Lost the connection while watching LDAP for changes" << std::endl;
+            ws.msgid = -1;
+        }
+        return changed;
+    }
+#endif
+
     void cleanup_search_state() {
         if (ss.result != nullptr) {
             ldap_msgfree(ss.result);
@@ -604,6 +796,35 @@ bool ldap_wrapper::search(const std::string &intype,
     return impl->search(intype, load_logger, filters);
 }
 
+bool ldap_wrapper::search_with_condition(const std::string &type,
+                                         indented_logger& load_logger,
+                                         const std::string &condition,
+                                         bool matching_type_filter) {
+    return impl->search(type, load_logger, {"", ""}, condition, matching_type_filter);
+}
+
+bool ldap_wrapper::watch_changes() {
+#ifndef _WIN32
+    return impl->watch_changes();
+#else
+    std::cerr << "Watching LDAP for changes isn't supported on Windows" << std::endl;
+    return false;
+#endif
+}
+
+bool ldap_wrapper::watching() {
+    return impl->ws.msgid != -1;
+}
+
+bool ldap_wrapper::wait_for_change(std::chrono::milliseconds timeout) {
+#ifndef _WIN32
+    return impl->wait_for_change(timeout);
+#else
+    std::this_thread::sleep_for(timeout);
+    return false;
+#endif
+}
+
 std::shared_ptr<base_object> ldap_wrapper::first_object() {
     return impl->first_object();
 }
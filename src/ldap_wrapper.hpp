@@ -20,6 +20,7 @@
 #ifndef EGILSCIMCLIENT_LDAP_WRAPPER_HPP
 #define EGILSCIMCLIENT_LDAP_WRAPPER_HPP
 
+#include <chrono>
 #include "model/object_list.hpp"
 #include "utility/indented_logger.hpp"
 
@@ -44,6 +45,38 @@ public:
               indented_logger& load_logger,
               const std::pair<std::string, std::string> &filters = {"", ""});
 
+  /**
+   * Like search, but the entries must also match 'condition' (an LDAP
+   * filter), for instance to only find entries which have changed.
+   * If 'matching_type_filter' is false, the entries must instead
+   * not match the type's filter (but still be found under its base).
+   */
+  bool search_with_condition(const std::string &type,
+                             indented_logger& load_logger,
+                             const std::string &condition,
+                             bool matching_type_filter = true);
+
+  /**
+   * Starts watching for changes to the entries under ldap-base, with
+   * one of the ways LDAP servers can notify clients about changes:
+   * content synchronization (RFC 4533), persistent search or Active
+   * Directory's change notifications. Returns false if the server
+   * supports none of them (or on Windows, where this isn't supported).
+   */
+  bool watch_changes();
+
+  /**
+   * Are we watching for changes? Watching stops if the server ends
+   * the search or the connection is lost.
+   */
+  bool watching();
+
+  /**
+   * Waits at most 'timeout' for the server to notify us about changes.
+   * Returns true if something has changed.
+   */
+  bool wait_for_change(std::chrono::milliseconds timeout);
+
   /**
    * Begins iteration over LDAP results from a search.
    * Returns the first result as a base_object, or nullptr if
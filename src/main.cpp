@@ -19,7 +19,11 @@
 
 #include <iostream>
 #include <boost/program_options.hpp>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
+#include <optional>
+#include <thread>
 #include <vector>
 #include <string>
 #include <time.h>
@@ -28,10 +32,12 @@
 #include "utility/simplescim_error_string.hpp"
 #include "model/object_list.hpp"
 #include "config_file.hpp"
+#include "config.hpp"
 #include "simplescim_ldap.hpp"
 #include "cache_file.hpp"
 #include "rendered_cache_file.hpp"
 #include "scim.hpp"
+#include "simplescim_scim_send.hpp"
 #include "json_data_file.hpp"
 #include "utility/utils.hpp"
 #include "data_server.hpp"
@@ -61,6 +67,11 @@ namespace options {
     const char* PRINT_CACHE_BY_ENDPOINT = "print-cache-by-endpoint";
     const char* PRINT_CACHE_TYPE = "print-cache-type";
     const char* PRINT_CACHE_WHERE = "print-cache-where";
+
+    const char* WRITE_PLAN = "write-plan";
+    const char* APPLY_PLAN = "apply-plan";
+
+    const char* DAEMON = "daemon";
 }
 
 void print_usage(const std::string& program_name,
@@ -92,8 +103,8 @@ struct config_file_option {
 // exit main().
 class status_writer {
 public:
-    status_writer(const std::string& path, time_t start)
-    : file(path), start_time(start) {}
+    status_writer(const std::string& path, time_t start, const shard& part)
+    : file(path), start_time(start), part(part) {}
 
     ~status_writer();
 
@@ -102,8 +113,14 @@ public:
     }
 
 private:
+    template<typename T>
+    static void write_counts(std::ostream& of,
+                             const std::string& name,
+                             const std::map<std::string, T>& counts);
+
     std::string file;
     time_t start_time;
+    shard part;
     std::shared_ptr<rendered_object_list> synced_objects; // can be nullptr
 };
 
@@ -114,10 +131,8 @@ status_writer::~status_writer() {
     std::map<std::string, int> resourceCounts;
 
     if (synced_objects) {
-        for (const auto &iter : *synced_objects) {
-            auto object = iter.second;
-
-            resourceCounts[object->get_type()]++;
+        for (const auto &type : synced_objects->types()) {
+            resourceCounts[type] = static_cast<int>(synced_objects->count(type));
         }
     }
 
@@ -127,10 +142,59 @@ status_writer::~status_writer() {
     of << "{" << std::endl;
     of << "  \"startTime\": " << start_time << "," << std::endl;
     of << "  \"duration\": " << duration << "," << std::endl;
-    of << "  \"resourceCounts\": {" << std::endl;
+    write_counts(of, "resourceCounts", resourceCounts);
+
+    if (!part.all()) {
+        // So the status files of all shards can be put together
+        of << "," << std::endl;
+        write_counts(of, "shard", std::map<std::string, int>{
+                { "index", part.get_index() },
+                { "count", part.get_count() } });
+    }
+
+    const auto& http_versions = scim_sender::instance().get_http_versions();
+    if (!http_versions.empty()) {
+        of << "," << std::endl;
+        write_counts(of, "httpVersions", http_versions);
+    }
+
+    const auto& tls_handshakes = scim_sender::instance().get_tls_handshakes();
+    if (!tls_handshakes.empty()) {
+        of << "," << std::endl;
+        write_counts(of, "tlsSessions", tls_handshakes);
+    }
+
+    const auto& sender = scim_sender::instance();
+    if (sender.get_uncompressed_request_bytes() > 0) {
+        of << "," << std::endl;
+        write_counts(of, "requestCompression", std::map<std::string, unsigned long long>{
+                { "uncompressed", sender.get_uncompressed_request_bytes() },
+                { "compressed", sender.get_compressed_request_bytes() } });
+    }
+
+    const auto& timings = sender.get_request_timings();
+    if (!timings.empty()) {
+        of << "," << std::endl;
+        of << "  \"requestTimings\": ";
+        timings.write_histograms(of, "  ");
+        of << "," << std::endl;
+        of << "  \"slowestRequests\": ";
+        timings.write_slowest(of, "  ");
+    }
+
+    of << std::endl;
+    of << "}" << std::endl;
+}
+
+// Writes a JSON object with a count for each key (without a trailing newline)
+template<typename T>
+void status_writer::write_counts(std::ostream& of,
+                                 const std::string& name,
+                                 const std::map<std::string, T>& counts) {
+    of << "  \"" << name << "\": {" << std::endl;
 
     bool first = true;
-    for (const auto &iter : resourceCounts) {
+    for (const auto &iter : counts) {
         if (!first) {
             of << "," << std::endl;
         }
@@ -138,8 +202,7 @@ status_writer::~status_writer() {
         of << "    \"" << iter.first << "\":" << iter.second;
     }
 
-    of << "  }" << std::endl;
-    of << "}" << std::endl;
+    of << "  }";
 }
 
 /**
@@ -209,6 +272,320 @@ std::shared_ptr<rendered_object_list> read_cache(const post_processing::plugins&
     return rendered_cache;
 }
 
+/**
+ * Loads from the data source, compares with the cache and sends the
+ * changes to the SCIM server (or writes or applies a plan file).
+ *
+ * 'cache' is what was sent in the previous sync, or nullptr if it should
+ * be read from the cache file. After a successful sync it's the new cache.
+ *
+ * If 'reconnect' is set, the connections to the data source are from an
+ * earlier sync (when running as a daemon) and may have been closed by the
+ * server, so if loading fails we try once more with new connections.
+ */
+static int run_sync(const po::variables_map& vm,
+                    const std::string& config_file_name,
+                    const post_processing::plugins& ppp,
+                    std::shared_ptr<sql::plugin> sqlp,
+                    const SCIMServerInfo& server_info,
+                    std::shared_ptr<rendered_object_list>& cache,
+                    status_writer* status,
+                    bool reconnect) {
+    /** Get objects from data source */
+    data_server &server = data_server::instance();
+    bool skip_load = vm.count("skip-load") || vm.count(options::APPLY_PLAN);
+    try {
+        bool loaded = skip_load || server.load(sqlp);
+        if (!loaded && reconnect) {
+            print_error();
+            std::cout << "Failed to load from data source, trying again with new connections" << std::endl;
+            server.clear();
+            loaded = server.load(sqlp);
+        }
+        if (!loaded) {
+            print_error();
+            std::cerr << "Failed to load from data source" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Failed to load from data source: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ScimActions scim_actions{server_info};
+
+    /** Get objects from cache file (unless we still have it from the last sync) */
+    auto cache_file_existed = true;
+    if (cache == nullptr) {
+        cache = read_cache(ppp, &cache_file_existed);
+    }
+
+    // Until we have managed to create a new cache, use the historical information for the
+    // status file (in case e.g. we fail to create a new cache, or an unexpected exception
+    // makes us exit early).
+    if (status) {
+        status->set_synced_objects(cache);
+    }
+
+    if (cache == nullptr) {
+        print_error();
+        return EXIT_FAILURE;
+    }
+
+    // Possibly apply thresholds
+    bool skip_thresholds = vm.count("skip-thresholds");
+    if (cache_file_existed && !skip_load && !skip_thresholds) {
+        try { 
+            verify_thresholds(cache, server, config::sync_shard());
+        }
+        catch (const threshold_error& e) {
+            // One of the thresholds were violated
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch (const std::runtime_error& e) {
+            // Probably unparsable threshold
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<ScimActions::scim_object_ref> all_scim_objects;
+    if (vm.count("rebuild-cache")) {
+        try {
+            all_scim_objects = scim_actions.get_all_objects_from_scim_server();
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Failed to get objects from SCIM server (" << e.what() << ")" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // A plan can only be applied to the cache file it was made from
+    change_plan::cache_fingerprint cache_source;
+    if (vm.count(options::WRITE_PLAN)) {
+        cache_source = change_plan::fingerprint(*cache);
+    }
+
+    if (vm.count("force-update")) {
+        auto uuids = vm["force-update"].as<std::vector<std::string>>();
+        make_dirty(cache, uuids);
+    }
+
+    if (vm.count("force-create")) {
+        auto uuids = vm["force-create"].as<std::vector<std::string>>();
+        for (auto uuid : uuids) {
+            if (server.has_object(uuid)) {
+                cache->remove_object(uuid);
+            }
+            else {
+                std::cerr << "Can't force create " << uuid
+                          << " which isn't in data source" << std::endl;
+            }
+        }
+    }
+
+    /** Perform SCIM operations */
+    int err = 0;
+    try {
+        if (vm.count(options::APPLY_PLAN)) {
+            auto plan_path = filesystem::absolute(vm[options::APPLY_PLAN].as<std::string>()).u8string();
+            err = scim_actions.apply_plan(plan_path, *cache);
+        }
+        else if (vm.count(options::WRITE_PLAN)) {
+            auto plan_path = filesystem::absolute(vm[options::WRITE_PLAN].as<std::string>()).u8string();
+            err = scim_actions.write_plan(server, *cache, ppp, vm.count("rebuild-cache"), all_scim_objects, cache_source, plan_path);
+        }
+        else {
+            err = scim_actions.perform(server, *cache, ppp, vm.count("rebuild-cache"), all_scim_objects);
+        }
+    } catch (const std::string& err_msg) {
+        std::cerr << err_msg << std::endl;
+    }
+
+    if (err == -1) {
+        print_error();
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count(options::WRITE_PLAN)) {
+        // Nothing was sent, the cache (and the status file) are as before
+        print_error();
+        return EXIT_SUCCESS;
+    }
+
+    cache = scim_actions.get_new_cache();
+    if (status) {
+        status->set_synced_objects(cache);
+    }
+
+    print_status(config_file_name.c_str());
+    print_error();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * When a file was last modified, or nothing if we can't tell
+ * (e.g. if it doesn't exist).
+ */
+static std::optional<filesystem::file_time_type> last_write_time(const std::string& path) {
+    if (path.empty()) {
+        return std::nullopt;
+    }
+    std::error_code ec;
+    auto time = filesystem::last_write_time(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    return time;
+}
+
+static volatile std::sig_atomic_t sync_requested = 0;
+static volatile std::sig_atomic_t stop_requested = 0;
+
+extern "C" void request_sync(int) {
+    sync_requested = 1;
+}
+
+extern "C" void request_stop(int) {
+    stop_requested = 1;
+}
+
+/**
+ * Runs as a daemon, which syncs every daemon-interval seconds (or when
+ * it gets SIGUSR1, or soon after a change in LDAP if ldap-watch-changes
+ * is set) until it gets SIGTERM or SIGINT.
+ *
+ * What doesn't change between syncs is kept in memory instead of being
+ * set up again for each sync: the configuration, the SCIM server info,
+ * plugins, the connection to the LDAP server and the cache (which is
+ * still written to the cache file after each sync).
+ *
+ * The metadata file is refreshed by others (servers and their keys are
+ * rotated), so the SCIM server info is made again when the file has
+ * changed, or after a failed sync.
+ */
+static int run_daemon(const po::variables_map& vm,
+                      const std::string& config_file_name,
+                      const post_processing::plugins& ppp,
+                      std::shared_ptr<sql::plugin> sqlp) {
+    config_file &config = config_file::instance();
+    data_server &server = data_server::instance();
+    auto server_info = std::make_unique<SCIMServerInfo>(config);
+    const auto metadata_path = config.has("metadata-path") ? config.get_path("metadata-path") : std::string();
+    auto metadata_time = last_write_time(metadata_path);
+    bool reload_server_info = false;
+
+    std::shared_ptr<rendered_object_list> cache;
+    bool connected = false;
+
+    std::signal(SIGTERM, request_stop);
+    std::signal(SIGINT, request_stop);
+#ifndef _WIN32
+    std::signal(SIGUSR1, request_sync);
+#endif
+
+    const auto interval = std::chrono::seconds(config::daemon_interval());
+    std::cout << "Running as a daemon, syncing every " << interval.count() << " seconds" << std::endl;
+
+    // A connection of its own, which waits for the LDAP server to tell us about changes
+    std::unique_ptr<ldap_wrapper> watcher;
+    const bool watch_changes = config::ldap_watch_changes() && config.has("ldap-uri");
+    const auto change_delay = std::chrono::seconds(config::ldap_change_delay());
+
+    while (!stop_requested) {
+        auto started = std::chrono::steady_clock::now();
+        sync_requested = 0;
+
+        // (Re)start watching before the sync, so we don't miss changes made during it
+        if (watch_changes && !(watcher && watcher->watching())) {
+            watcher = std::make_unique<ldap_wrapper>();
+            if (!watcher->valid() || !watcher->watch_changes()) {
+                print_error();
+                std::cerr << "Not watching LDAP for changes until the next sync" << std::endl;
+            }
+        }
+
+        if (!metadata_path.empty()) {
+            auto modified = last_write_time(metadata_path);
+            if (reload_server_info || modified != metadata_time) {
+                try {
+                    server_info = std::make_unique<SCIMServerInfo>(config);
+                    metadata_time = modified;
+                    reload_server_info = false;
+                }
+                catch (const std::runtime_error& e) {
+                    std::cerr << e.what() << std::endl;
+                    std::cerr << "Using the metadata loaded before" << std::endl;
+                }
+            }
+        }
+
+        {
+            std::unique_ptr<status_writer> status;
+            if (config.has("status-file")) {
+                status = std::make_unique<status_writer>(config.get("status-file"), time(nullptr), config::sync_shard());
+            }
+
+            server.clear_data();
+            simplescim_error_string_set(nullptr, nullptr);
+
+            int result = EXIT_FAILURE;
+            try {
+                result = run_sync(vm, config_file_name, ppp, sqlp, *server_info, cache, status.get(), connected);
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+
+            if (result == EXIT_SUCCESS) {
+                connected = true;
+
+                // Objects copied from the old cache still point into the old cache
+                // file, which would stay mapped (and take up disk space) after it's
+                // been replaced. Read the cache back from the new file instead.
+                auto cache_path = config.get_path(options::CACHE_FILE, true);
+                if (!cache_path.empty()) {
+                    try {
+                        cache = rendered_cache_file::get_contents(cache_path);
+                    }
+                    catch (const std::runtime_error& e) {
+                        std::cerr << "Failed to read back the new cache file, keeping the cache in memory: "
+                                  << e.what() << std::endl;
+                    }
+                }
+            }
+            else {
+                // Start over from the cache file, with new connections
+                std::cerr << "Sync failed, trying again in " << interval.count() << " seconds" << std::endl;
+                cache.reset();
+                server.clear();
+                connected = false;
+                reload_server_info = true;
+            }
+        }
+
+        // Wait for the next sync, or for changes in LDAP (and then a little longer
+        // since changes often come together)
+        std::optional<std::chrono::steady_clock::time_point> changed;
+        while (!stop_requested && !sync_requested &&
+               std::chrono::steady_clock::now() - started < interval &&
+               !(changed && std::chrono::steady_clock::now() - *changed >= change_delay)) {
+            if (watcher && watcher->watching()) {
+                if (watcher->wait_for_change(std::chrono::milliseconds(200)) && !changed) {
+                    changed = std::chrono::steady_clock::now();
+                }
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+        }
+    }
+
+    std::cout << "Daemon stopped" << std::endl;
+    return EXIT_SUCCESS;
+}
+
 static int run_main(int argc, char *argv[]) {
     try {
         po::options_description cmdline_options("All options");
@@ -240,6 +617,9 @@ static int run_main(int argc, char *argv[]) {
               { "scim-type-send-order",
                 "which SS12000 types to include "\
                 "and in which order to send them",                      false },
+              { "shard",
+                "only sync the objects in shard i of N (e.g. 2/4), "\
+                "so N processes can sync in parallel",                  false },
             };
 
         for (const auto& var : common_vars) {
@@ -263,6 +643,13 @@ static int run_main(int argc, char *argv[]) {
             (options::PRINT_CACHE_TYPE, po::value<std::vector<std::string>>(), "only print given type(s)")
             (options::PRINT_CACHE_WHERE, po::value<std::vector<std::string>>(), "only print objects where attributes match given values");
 
+        generic.add_options()
+            (options::DAEMON, "keep running and sync every daemon-interval seconds (or on SIGUSR1)");
+
+        generic.add_options()
+            (options::WRITE_PLAN, po::value<std::string>(), "write what would be sent to the SCIM server to a plan file instead of sending it")
+            (options::APPLY_PLAN, po::value<std::string>(), "send what's in a plan file (written with --write-plan), or continue sending it");
+
         hidden.add_options()
             ("config-file", po::value<std::vector<std::string>>(), "config file");
 
@@ -296,6 +683,26 @@ static int run_main(int argc, char *argv[]) {
             return EXIT_FAILURE;
         }
 
+        if (vm.count(options::APPLY_PLAN)) {
+            // The plan was made with the data source and the cache when it was written
+            for (auto option : { options::WRITE_PLAN, "rebuild-cache", "skip-load", "force-update", "force-create" }) {
+                if (vm.count(option)) {
+                    std::cerr << "--" << options::APPLY_PLAN << " can't be combined with --" << option << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+
+        if (vm.count(options::DAEMON)) {
+            // Those only make sense for a single run
+            for (auto option : { options::WRITE_PLAN, options::APPLY_PLAN, "rebuild-cache", "skip-load", "force-update", "force-create" }) {
+                if (vm.count(option)) {
+                    std::cerr << "--" << options::DAEMON << " can't be combined with --" << option << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+
         config_file &config = config_file::instance();
 
         std::string config_file;
@@ -346,6 +753,24 @@ static int run_main(int argc, char *argv[]) {
 
         setup_default_organisation_config_variables();
 
+        // Each shard has its own cache file (and status file), with only its objects
+        shard part;
+        try {
+            part = config::sync_shard();
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!part.all()) {
+            for (auto variable : { options::CACHE_FILE, "status-file" }) {
+                if (config.has(variable)) {
+                    config.replace_variable(variable, config.get(variable) + part.file_suffix());
+                }
+            }
+            std::cout << "Syncing shard " << part.get_index() << " of " << part.get_count() << std::endl;
+        }
+
         if (vm.count(options::PRINT_CACHE)) {
             bool by_endpoint = vm.count(options::PRINT_CACHE_BY_ENDPOINT);
             auto cache_path = config_file::instance().get_path(options::CACHE_FILE);
@@ -375,8 +800,8 @@ static int run_main(int argc, char *argv[]) {
         }
 
         std::unique_ptr<status_writer> status;
-        if (config.has("status-file")) {
-            status = std::make_unique<status_writer>(config.get("status-file"), start_time);
+        if (config.has("status-file") && !vm.count(options::DAEMON)) {
+            status = std::make_unique<status_writer>(config.get("status-file"), start_time, part);
         }
 
         add_scim_vars_for_virtual_groups();
@@ -419,112 +844,21 @@ static int run_main(int argc, char *argv[]) {
         }
         
 
-        /** Get objects from data source */
-        data_server &server = data_server::instance();
-        bool skip_load = vm.count("skip-load");
-        try {
-            if (!skip_load && !server.load(sqlp)) {
-                print_error();
-                std::cerr << "Failed to load from data source" << std::endl;
-                return EXIT_FAILURE;
-            }
-        }
-        catch (const std::exception &e) {
-            std::cerr << "Failed to load from data source: " << e.what() << std::endl;
-            return EXIT_FAILURE;
-        }
-
-        SCIMServerInfo server_info{config};
-        ScimActions scim_actions{server_info};
-
-        /** Get objects from cache file */
-        auto cache_file_existed = false;
-        std::shared_ptr<rendered_object_list> cache = read_cache(ppp, &cache_file_existed);
-
-        // Until we have managed to create a new cache, use the historical information for the
-        // status file (in case e.g. we fail to create a new cache, or an unexpected exception
-        // makes us exit early).
-        if (status) {
-            status->set_synced_objects(cache);
-        }
-
-        if (cache == nullptr) {
-            print_error();
-            server.clear();
-            config.clear();
-            return EXIT_FAILURE;
-        }
-
-        // Possibly apply thresholds
-        bool skip_thresholds = vm.count("skip-thresholds");
-        if (cache_file_existed && !skip_load && !skip_thresholds) {
-            try { 
-                verify_thresholds(cache, server);
-            }
-            catch (const threshold_error& e) {
-                // One of the thresholds were violated
-                std::cerr << e.what() << std::endl;
-                return EXIT_FAILURE;
-            }
-            catch (const std::runtime_error& e) {
-                // Probably unparsable threshold
-                std::cerr << e.what() << std::endl;
-                return EXIT_FAILURE;
-            }
-        }
-
-        std::vector<ScimActions::scim_object_ref> all_scim_objects;
-        if (vm.count("rebuild-cache")) {
-            try {
-                all_scim_objects = scim_actions.get_all_objects_from_scim_server();
-            } catch (const std::runtime_error& e) {
-                std::cerr << "Failed to get objects from SCIM server (" << e.what() << ")" << std::endl;
-                return EXIT_FAILURE;
-            }
-        }
-
-        if (vm.count("force-update")) {
-            auto uuids = vm["force-update"].as<std::vector<std::string>>();
-            make_dirty(cache, uuids);
-        }
-
-        if (vm.count("force-create")) {
-            auto uuids = vm["force-create"].as<std::vector<std::string>>();
-            for (auto uuid : uuids) {
-                if (server.has_object(uuid)) {
-                    cache->remove_object(uuid);
-                }
-                else {
-                    std::cerr << "Can't force create " << uuid
-                              << " which isn't in data source" << std::endl;
-                }
-            }
-        }
-
-        /** Perform SCIM operations */
-        try {
-            err = scim_actions.perform(server, *cache, ppp, vm.count("rebuild-cache"), all_scim_objects);
-        } catch (const std::string& err_msg) {
-            std::cerr << err_msg << std::endl;
-        }
-
-        if (err == -1) {
-            server.clear();
-            print_error();
+        if (vm.count(options::DAEMON)) {
+            int result = run_daemon(vm, config_file, ppp, sqlp);
             config.clear();
-            return EXIT_FAILURE;
-        }
-
-        if (status) {
-            status->set_synced_objects(scim_actions.get_new_cache());
+            data_server::instance().clear();
+            return result;
         }
 
-        print_status(config_file.c_str());
-        print_error();
+        SCIMServerInfo server_info{config};
+        std::shared_ptr<rendered_object_list> cache;
+        int result = run_sync(vm, config_file, ppp, sqlp, server_info, cache, status.get(), false);
 
         /* Clean up */
         config.clear();
-        server.clear();
+        data_server::instance().clear();
+        return result;
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
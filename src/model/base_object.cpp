@@ -29,21 +29,13 @@ std::string base_object::get_uid(bool search) const {
 	if (identity.empty() && search) {
 
 		/** Get LDAP attribute that is unique identifier */
-		config_file &conf = config_file::instance();
-		std::string uid_attr;
 		std::string type = getSS12000type();
-		uid_attr = conf.require(type + "-unique-identifier");
-		auto pos = uid_attr.find(',');
-		if (pos != std::string::npos)
-			uid_attr.erase(pos);
+		std::string uid_attr = uid_attribute(type);
 		ss12000type = type;
 
 		if (uid_attr.empty()) {
 			return "";
 		}
-		std::string::size_type dotPos = uid_attr.find('.');
-		if (dotPos != std::string::npos)
-			uid_attr = uid_attr.substr(dotPos + 1);
 		/* Get unique identifier value */
 		string_vector values = get_values(uid_attr);
 		if (values.empty()) {
@@ -75,6 +67,18 @@ std::string base_object::get_uid(bool search) const {
 	return identity;
 }
 
+std::string base_object::uid_attribute(const std::string &type) {
+	std::string uid_attr = config_file::instance().require(type + "-unique-identifier");
+	auto pos = uid_attr.find(',');
+	if (pos != std::string::npos)
+		uid_attr.erase(pos);
+
+	std::string::size_type dotPos = uid_attr.find('.');
+	if (dotPos != std::string::npos)
+		uid_attr = uid_attr.substr(dotPos + 1);
+	return uid_attr;
+}
+
 bool base_object::has_attribute_or_relation(const std::string& attr) {
 	const auto relationPrefix = attr + ".";
 	for (auto &iter : attributes) {
@@ -115,6 +115,9 @@ public:
 
 	std::string get_uid(bool search = true) const;
 
+	/** The attribute get_uid() takes the uid from for objects of a type */
+	static std::string uid_attribute(const std::string &type);
+
 	std::string getSS12000type() const {
 		const string_vector list = get_values("ss12000type");
 		if (!list.empty()) {
@@ -19,10 +19,31 @@
 
 #include "rendered_object.hpp"
 
+#include <openssl/evp.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
 rendered_object::rendered_object(const std::string &id,
                                  const std::string &type,
                                  const std::string &json) 
-                                 : id(id), type(type), json(json) {
+                                 : id(id), type(type), json(json), hash(compute_hash(id, type, json)) {
+}
+
+rendered_object::rendered_object(const std::string &id,
+                                 const std::string &type,
+                                 const std::string &json,
+                                 const content_hash &hash)
+                                 : id(id), type(type), json(json), hash(hash) {
+}
+
+rendered_object::rendered_object(const std::string &id,
+                                 const std::string &type,
+                                 std::string_view json,
+                                 std::shared_ptr<const void> json_owner,
+                                 const content_hash &hash)
+                                 : id(id), type(type), hash(hash),
+                                   external_json(json), json_owner(std::move(json_owner)) {
 }
 
 std::string rendered_object::get_id() const {
@@ -34,11 +55,44 @@ std::string rendered_object::get_type() const {
 }
 
 std::string rendered_object::get_json() const {
-    return json;
+    return std::string(get_json_view());
+}
+
+std::string_view rendered_object::get_json_view() const {
+    return json_owner ? external_json : std::string_view(json);
 }
 
 bool rendered_object::operator==(const rendered_object& other) const {
-    return id == other.id &&
-           type == other.type &&
-           json == other.json;
+    return hash == other.hash;
+}
+
+/*
+ * A cryptographic hash, so a change in the data can't be
+ * made to look like no change (and then not be sent).
+ */
+rendered_object::content_hash rendered_object::compute_hash(const std::string &id,
+                                                            const std::string &type,
+                                                            const std::string &json) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (ctx == nullptr || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("failed to initialize SHA-256");
+    }
+
+    // The lengths are included so that moving a character from
+    // one string to the next gives a different hash
+    for (const auto* str : { &id, &type, &json }) {
+        uint64_t length = str->size();
+        EVP_DigestUpdate(ctx.get(), &length, sizeof(length));
+        EVP_DigestUpdate(ctx.get(), str->data(), str->size());
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (EVP_DigestFinal_ex(ctx.get(), digest, &digest_length) != 1) {
+        throw std::runtime_error("failed to compute SHA-256");
+    }
+
+    content_hash result;
+    std::copy(digest, digest + result.size(), result.begin());
+    return result;
 }
\ No newline at end of file
@@ -20,30 +20,82 @@
 #ifndef EGILSCIM_RENDERED_OBJECT_HPP
 #define EGILSCIM_RENDERED_OBJECT_HPP
 
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 /**
  * An object after it has been transformed to JSON form.
  * 
  * We keep type and id as separate members for easy access
  * after the object has been rendered.
+ *
+ * Each object also has a hash of its contents (id, type and JSON),
+ * computed when it's rendered and kept in the cache file, so objects
+ * can be compared without comparing their JSON.
+ *
+ * The JSON of objects read from the cache file stays in the (memory
+ * mapped) file, and is only copied out when it's needed, e.g. when the
+ * object is sent or printed.
  */
 class rendered_object {
 public:
+    /// 128 bits of the SHA-256 digest of the contents
+    typedef std::array<uint8_t, 16> content_hash;
+
     rendered_object(const std::string &id,
                     const std::string &type,
                     const std::string &json);
 
+    /** For objects read from the cache file, where the hash is already known. */
+    rendered_object(const std::string &id,
+                    const std::string &type,
+                    const std::string &json,
+                    const content_hash &hash);
+
+    /**
+     * For objects read from the cache file, where the JSON is kept in
+     * memory owned by 'json_owner' (which is kept alive by the object).
+     */
+    rendered_object(const std::string &id,
+                    const std::string &type,
+                    std::string_view json,
+                    std::shared_ptr<const void> json_owner,
+                    const content_hash &hash);
+
     std::string get_id() const;
     std::string get_type() const;
     std::string get_json() const;
 
+    /** The JSON without copying it, valid as long as the object is */
+    std::string_view get_json_view() const;
+
+    size_t get_json_size() const {
+        return get_json_view().size();
+    }
+
+    const content_hash& get_hash() const {
+        return hash;
+    }
+
+    /** Objects are equal if their contents are, which we tell by the hash. */
     bool operator==(const rendered_object& other) const;
 
+    static content_hash compute_hash(const std::string &id,
+                                     const std::string &type,
+                                     const std::string &json);
+
 private:
     std::string id;
     std::string type;
     std::string json;
+    content_hash hash;
+
+    /// Set instead of 'json' when the JSON is kept elsewhere
+    std::string_view external_json;
+    std::shared_ptr<const void> json_owner;
 };
 
 #endif // EGILSCIM_RENDERED_OBJECT_HPP
\ No newline at end of file
@@ -20,7 +20,16 @@
 #include "rendered_object_list.hpp"
 
 void rendered_object_list::add_object(std::shared_ptr<rendered_object> obj) {
-    objects[obj->get_id()] = obj;
+    auto id = obj->get_id();
+    auto& record = objects[id];
+    if (record != nullptr) {
+        remove_object(id);
+        objects[id] = obj;
+    }
+    else {
+        record = obj;
+    }
+    objects_by_type[obj->get_type()][id] = obj;
 }
 
 std::shared_ptr<rendered_object> rendered_object_list::get_object(const std::string &id) const {
@@ -32,5 +41,37 @@ std::shared_ptr<rendered_object> rendered_object_list::get_object(const std::str
 }
 
 void rendered_object_list::remove_object(const std::string &id) {
-    objects.erase(id);
+    auto record = objects.find(id);
+    if (record == objects.end()) {
+        return;
+    }
+
+    auto type = objects_by_type.find(record->second->get_type());
+    type->second.erase(id);
+    if (type->second.empty()) {
+        objects_by_type.erase(type);
+    }
+    objects.erase(record);
+}
+
+const rendered_object_list::object_map_t& rendered_object_list::of_type(const std::string& type) const {
+    static const object_map_t none;
+
+    auto itr = objects_by_type.find(type);
+    if (itr != objects_by_type.end()) {
+        return itr->second;
+    }
+    return none;
+}
+
+size_t rendered_object_list::count(const std::string& type) const {
+    return of_type(type).size();
+}
+
+std::vector<std::string> rendered_object_list::types() const {
+    std::vector<std::string> result;
+    for (const auto& itr : objects_by_type) {
+        result.push_back(itr.first);
+    }
+    return result;
 }
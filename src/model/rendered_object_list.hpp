@@ -23,9 +23,13 @@
 #include "rendered_object.hpp"
 #include <map>
 #include <memory>
+#include <vector>
 
 /**
  * A list of rendered objects.
+ *
+ * The objects are also kept per type, so the objects of a type can be
+ * counted and iterated without going through all objects.
  */
 class rendered_object_list {
 public:
@@ -46,8 +50,18 @@ public:
 
     size_t size() const { return objects.size(); }
 
+    /** The objects of a type (empty if there are none) */
+    const object_map_t& of_type(const std::string& type) const;
+
+    /** The number of objects of a type */
+    size_t count(const std::string& type) const;
+
+    /** The types which have at least one object, in sorted order */
+    std::vector<std::string> types() const;
+
 private:
     object_map_t objects;
+    std::map<std::string, object_map_t> objects_by_type;
 };
 
 #endif // EGILSCIM_RENDERED_OBJECT_LIST_HPP
@@ -21,6 +21,7 @@
 #include "config_file.hpp"
 #include <algorithm>
 #include <iostream>
+#include <set>
 
 #include <boost/property_tree/json_parser.hpp>
 
@@ -76,9 +77,7 @@ void print_cache(std::shared_ptr<rendered_object_list> cache,
     config_file &conf = config_file::instance();
     std::map<std::string, std::vector<std::string>> to_print_per_type;
 
-    for (auto &itr : *cache) {
-        auto obj = itr.second;
-
+    auto add = [&](std::shared_ptr<rendered_object> obj) {
         auto obj_type = obj->get_type();
 
         if (by_endpoint) {
@@ -94,6 +93,20 @@ void print_cache(std::shared_ptr<rendered_object_list> cache,
                 to_print_per_type[obj_type].push_back(json);
             }
         }
+    };
+
+    if (!by_endpoint && types.size() != 0) {
+        // Only go through the objects of the types we want
+        for (const auto &type : std::set<std::string>(types.begin(), types.end())) {
+            for (auto &itr : cache->of_type(type)) {
+                add(itr.second);
+            }
+        }
+    }
+    else {
+        for (auto &itr : *cache) {
+            add(itr.second);
+        }
     }
 
     std::cout << "{\n";
@@ -0,0 +1,137 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "rate_controller.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// How much weight a new latency sample gets in the smoothed latency
+const double LATENCY_SMOOTHING = 0.2;
+
+// How much slower than the baseline the server may get before we
+// consider it to be under stress
+const double LATENCY_TOLERANCE = 2.0;
+
+double seconds(rate_controller::clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+} // anonymous namespace
+
+rate_controller::rate_controller(int max)
+    : max_limit(std::max(max, 1)) {
+}
+
+void rate_controller::set_max_limit(int max) {
+    max_limit = std::max(max, 1);
+    limit = std::min(limit, max_limit);
+}
+
+void rate_controller::request_started(clock::time_point now) {
+    ++in_flight;
+    if (!first_start) {
+        first_start = now;
+    }
+}
+
+void rate_controller::completed(clock::time_point now) {
+    in_flight = std::max(in_flight - 1, 0);
+    ++requests;
+    last_completed = now;
+}
+
+bool rate_controller::response(long response_code,
+                               clock::duration latency,
+                               std::optional<clock::duration> retry_after,
+                               clock::time_point now) {
+    completed(now);
+
+    if (response_code == 429 || response_code == 503) {
+        if (retry_after) {
+            paused_until = std::max(paused_until, now + *retry_after);
+        }
+        return back_off(now);
+    }
+
+    auto sample = seconds(latency);
+    if (!smoothed_latency) {
+        smoothed_latency = sample;
+        baseline_latency = sample;
+    }
+    else {
+        smoothed_latency = *smoothed_latency * (1 - LATENCY_SMOOTHING) + sample * LATENCY_SMOOTHING;
+        baseline_latency = std::min(baseline_latency, *smoothed_latency);
+    }
+
+    if (*smoothed_latency > baseline_latency * LATENCY_TOLERANCE) {
+        // The server is getting slower, ease off a little (once per round trip)
+        slow_start = false;
+        successes = 0;
+        if (limit > 1 && seconds(now - last_decrease) >= *smoothed_latency) {
+            --limit;
+            last_decrease = now;
+            return true;
+        }
+        return false;
+    }
+
+    if (limit < max_limit) {
+        if (slow_start || ++successes >= limit) {
+            ++limit;
+            successes = 0;
+            highest_limit = std::max(highest_limit, limit);
+        }
+    }
+    return false;
+}
+
+bool rate_controller::timeout(clock::time_point now) {
+    completed(now);
+    return back_off(now);
+}
+
+void rate_controller::failure(clock::time_point now) {
+    completed(now);
+}
+
+bool rate_controller::back_off(clock::time_point now) {
+    ++throttled;
+    slow_start = false;
+    successes = 0;
+
+    // All the requests in flight when the server got overloaded will probably
+    // fail the same way, so we only halve the limit once per round trip
+    double round_trip = smoothed_latency ? *smoothed_latency : 1.0;
+    if (limit > 1 && seconds(now - last_decrease) >= round_trip) {
+        limit = std::max(limit / 2, 1);
+        last_decrease = now;
+        return true;
+    }
+    return false;
+}
+
+double rate_controller::get_rate() const {
+    if (!first_start || requests == 0) {
+        return 0;
+    }
+    auto elapsed = seconds(last_completed - *first_start);
+    return elapsed > 0 ? requests / elapsed : 0;
+}
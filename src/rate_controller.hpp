@@ -0,0 +1,135 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_RATE_CONTROLLER_HPP
+#define EGILSCIM_RATE_CONTROLLER_HPP
+
+#include <chrono>
+#include <optional>
+
+/**
+ * Decides how many concurrent requests we should have in flight to
+ * an endpoint, based on how the server responds.
+ *
+ * We start with one request and ramp up (doubling per round trip) until the
+ * server shows signs of stress. After that we increase by one request per
+ * round trip while the server is healthy. If the server is overloaded
+ * (429 Too Many Requests, 503 Service Unavailable or a timeout) we halve
+ * the number of requests, and if the server tells us to wait
+ * (with Retry-After) we don't start new requests until then. If the
+ * latency grows a lot compared to what we've seen before, we decrease
+ * by one request.
+ *
+ * The number of requests never goes above the configured maximum.
+ */
+class rate_controller {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /** 'max_limit' is the upper bound for the number of concurrent requests. */
+    explicit rate_controller(int max_limit);
+
+    /** Changes the upper bound (it's configurable per type). */
+    void set_max_limit(int max_limit);
+
+    /** How many requests may be in flight at the moment. */
+    int get_limit() const {
+        return limit;
+    }
+
+    /** How many requests are in flight. */
+    int get_in_flight() const {
+        return in_flight;
+    }
+
+    /** If the server has asked us to wait, we shouldn't start requests until this time. */
+    clock::time_point get_paused_until() const {
+        return paused_until;
+    }
+
+    /** Returns whether we may start another request right now. */
+    bool may_start(clock::time_point now) const {
+        return in_flight < limit && now >= paused_until;
+    }
+
+    /** Called when a request is started. */
+    void request_started(clock::time_point now);
+
+    /**
+     * Called when a request got a response from the server.
+     * 'retry_after' is the time the server asked us to wait (if any).
+     *
+     * Returns true if this made us decrease the limit.
+     */
+    bool response(long response_code,
+                  clock::duration latency,
+                  std::optional<clock::duration> retry_after,
+                  clock::time_point now);
+
+    /** Called when a request timed out. Returns true if this made us decrease the limit. */
+    bool timeout(clock::time_point now);
+
+    /** Called when a request failed in some other way (we don't know anything about the server). */
+    void failure(clock::time_point now);
+
+    /** Number of completed requests */
+    int get_requests() const {
+        return requests;
+    }
+
+    /** Number of times the server was overloaded (429, 503 or timeout) */
+    int get_throttled() const {
+        return throttled;
+    }
+
+    /** The highest limit we've used */
+    int get_highest_limit() const {
+        return highest_limit;
+    }
+
+    /** Completed requests per second, from the first request started until the last completed. */
+    double get_rate() const;
+
+private:
+    bool back_off(clock::time_point now);
+    void completed(clock::time_point now);
+
+    int max_limit;
+    int limit = 1;
+    int highest_limit = 1;
+    int in_flight = 0;
+    bool slow_start = true;
+
+    /// Successful responses since we last increased the limit
+    int successes = 0;
+
+    /// Smoothed latency and the lowest smoothed latency we've seen (seconds)
+    std::optional<double> smoothed_latency;
+    double baseline_latency = 0;
+
+    clock::time_point last_decrease;
+    clock::time_point paused_until;
+
+    int requests = 0;
+    int throttled = 0;
+    std::optional<clock::time_point> first_start;
+    clock::time_point last_completed;
+};
+
+#endif // EGILSCIM_RATE_CONTROLLER_HPP
@@ -21,6 +21,7 @@
 #include "readable_id.hpp"
 #include "config_file.hpp"
 #include <map>
+#include <mutex>
 
 using namespace std;
 
@@ -31,14 +32,18 @@ string readable_id(const base_object* obj, const string t) {
     }
 
     static map<string, string> attributes_to_use;
+    static mutex attributes_mutex;
 
-    auto itr = attributes_to_use.find(type);
+    string attribute;
+    {
+        lock_guard<mutex> lock(attributes_mutex);
+        auto itr = attributes_to_use.find(type);
 
-    if (itr == attributes_to_use.end()) {
-        attributes_to_use[type] = config_file::instance().get(type + "-readable-id", true);
+        if (itr == attributes_to_use.end()) {
+            itr = attributes_to_use.emplace(type, config_file::instance().get(type + "-readable-id", true)).first;
+        }
+        attribute = itr->second;
     }
-
-    auto attribute = attributes_to_use[type];
     string value = "";
 
     if (attribute != "") {
@@ -0,0 +1,88 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "render_pipeline.hpp"
+#include "utility/simplescim_error_string.hpp"
+
+#include <algorithm>
+
+render_pipeline::render_pipeline(size_t c, render_function r, size_t n_threads, size_t w)
+    : count(c), render(r), window(std::max<size_t>(w, 1)),
+      results(window), ready(window, false) {
+    n_threads = std::max<size_t>(std::min(n_threads, count), 1);
+    for (size_t i = 0; i < n_threads; ++i) {
+        threads.emplace_back(&render_pipeline::work, this);
+    }
+}
+
+render_pipeline::~render_pipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    may_render.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+render_pipeline::result render_pipeline::next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t slot = next_to_take % window;
+    rendered.wait(lock, [&]() { return ready[slot]; });
+
+    result r = std::move(results[slot]);
+    results[slot] = result();
+    ready[slot] = false;
+    ++next_to_take;
+    lock.unlock();
+
+    may_render.notify_all();
+    return r;
+}
+
+void render_pipeline::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        may_render.wait(lock, [&]() {
+            return stopping || next_to_render >= count || next_to_render < next_to_take + window;
+        });
+        if (stopping || next_to_render >= count) {
+            return;
+        }
+        size_t i = next_to_render++;
+        lock.unlock();
+
+        result r;
+        try {
+            r.object = render(i);
+        }
+        catch (...) {
+            r.failure = std::current_exception();
+        }
+        if (has_errors_to_print()) {
+            r.error = simplescim_error_string_get();
+        }
+
+        lock.lock();
+        results[i % window] = std::move(r);
+        ready[i % window] = true;
+        rendered.notify_all();
+    }
+}
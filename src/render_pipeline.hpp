@@ -0,0 +1,101 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_RENDER_PIPELINE_HPP
+#define EGILSCIM_RENDER_PIPELINE_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model/rendered_object.hpp"
+
+/**
+ * Renders objects in a number of threads a bit ahead of where the
+ * caller is, so the objects can be compared and sent while the rest
+ * are rendered.
+ *
+ * The objects are numbered 0 to count-1, and the caller takes the
+ * results in that order with next(). At most 'window' objects are
+ * rendered but not yet taken, so if the caller is slow (for instance
+ * waiting for the SCIM server) the rendering waits too, and we don't
+ * keep more rendered objects in memory than needed.
+ */
+class render_pipeline {
+public:
+    /** Renders object number i, may throw */
+    typedef std::function<std::shared_ptr<rendered_object>(size_t i)> render_function;
+
+    struct result {
+        /// The rendered object, nullptr if rendering failed
+        std::shared_ptr<rendered_object> object;
+
+        /// What rendering threw, if it failed
+        std::exception_ptr failure;
+
+        /**
+         * The error string (see simplescim_error_string.hpp) as rendering
+         * left it, since it is per thread and the caller may want to
+         * see it as if it had rendered the object itself.
+         */
+        std::optional<std::string> error;
+    };
+
+    render_pipeline(size_t count, render_function render, size_t threads, size_t window);
+
+    /** Stops the threads, even if not all objects have been taken */
+    ~render_pipeline();
+
+    render_pipeline(const render_pipeline&) = delete;
+    render_pipeline& operator=(const render_pipeline&) = delete;
+
+    /**
+     * Returns the next object, waiting for it to be rendered if needed.
+     * Must not be called more than 'count' times.
+     */
+    result next();
+
+private:
+    void work();
+
+    size_t count;
+    render_function render;
+    size_t window;
+
+    std::mutex mutex;
+    std::condition_variable may_render, rendered;
+
+    /// Ring buffer of 'window' results, object i goes in i % window
+    std::vector<result> results;
+    std::vector<bool> ready;
+
+    size_t next_to_render = 0;
+    size_t next_to_take = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> threads;
+};
+
+#endif // EGILSCIM_RENDER_PIPELINE_HPP
@@ -24,55 +24,123 @@
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <string_view>
 #include <thread>
 #include <vector>
+#ifndef _WIN32
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#endif
 
 using namespace std;
 
 namespace rendered_cache_file {
 
 const uint64_t MAGIC_NUMBER = 0xFFEEDDCCFEDCFEDC;
-const uint8_t CURRENT_VERSION = 1;
+const uint8_t CURRENT_VERSION = 2;
+
+// The first version with the objects' content hashes
+const uint8_t HASH_VERSION = 2;
 const size_t HEADER_SIZE = sizeof(MAGIC_NUMBER) + sizeof(CURRENT_VERSION);
 
 const int FILE_LOCK_TIMEOUT = 30; // seconds
 
-template<typename T>
-T read(ifstream& ifs) {
-    T buff;
-    ifs.read(reinterpret_cast<char*>(&buff), sizeof(T));
+/**
+ * The contents of a cache file, kept in memory for as long as any object
+ * read from it refers to its JSON.
+ *
+ * The file is mapped into memory, so we don't need to read (or keep in
+ * memory) the JSON of objects we never look at. On Windows it's read into
+ * memory instead, since a file which is mapped can't be replaced with the
+ * new cache file. This is fine elsewhere since the old file stays as it
+ * was until the last object from it is gone.
+ */
+class file_contents {
+public:
+    explicit file_contents(const string& path);
 
-    auto nread = ifs.gcount();
+    const char* data() const {
+        return begin;
+    }
 
-    if (!ifs) {
-        throw runtime_error("bad stream after read");
+    size_t size() const {
+        return length;
     }
 
-    if ((size_t)nread < sizeof(T)) {
-        throw runtime_error("read too few bytes");
+private:
+    const char* begin = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    vector<char> buffer;
+#else
+    boost::interprocess::mapped_region region;
+#endif
+};
+
+file_contents::file_contents(const string& path) {
+    auto size = std::filesystem::file_size(path);
+    if (size == 0) {
+        // Can't be mapped, and isn't a cache file anyway
+        return;
     }
 
-    return buff;
+#ifdef _WIN32
+    ifstream ifs(path, ios_base::in | ios_base::binary);
+    buffer.resize(size);
+    if (!ifs || !ifs.read(buffer.data(), size)) {
+        throw runtime_error(string("failed to read file: ") + path);
+    }
+    begin = buffer.data();
+#else
+    try {
+        // The region stays mapped when the file is closed
+        using namespace boost::interprocess;
+        file_mapping mapping(path.c_str(), read_only);
+        region = mapped_region(mapping, read_only);
+    }
+    catch (const std::exception& e) {
+        throw runtime_error(string("failed to open file: ") + path + " (" + e.what() + ")");
+    }
+    begin = static_cast<const char*>(region.get_address());
+#endif
+    length = size;
 }
 
-template<>
-string read(ifstream& ifs) {
-    auto len = read<uint64_t>(ifs);
-    vector<char> buff(len);
-    ifs.read(&buff[0], len);
-
-    auto nread = ifs.gcount();
+/** Reads the values written by write() from a file's contents */
+class reader {
+public:
+    reader(const file_contents& contents)
+            : pos(contents.data()), end(contents.data() + contents.size()) {}
+
+    template<typename T>
+    T read() {
+        need(sizeof(T));
+        T value;
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
 
-    if (!ifs) {
-        throw runtime_error("bad stream after read");
+    /** A string, without copying it from the contents */
+    std::string_view read_string() {
+        auto len = read<uint64_t>();
+        need(len);
+        std::string_view value(pos, len);
+        pos += len;
+        return value;
     }
 
-    if (nread < 0 || (uint64_t)nread < len) {
-        throw runtime_error("read too few bytes");
+private:
+    void need(uint64_t n) const {
+        if (n > static_cast<uint64_t>(end - pos)) {
+            throw runtime_error("read too few bytes");
+        }
     }
 
-    return string(buff.begin(), buff.end());
-}
+    const char* pos;
+    const char* end;
+};
 
 template<typename T>
 void write(ofstream& ofs, const T& value) {
@@ -83,33 +151,43 @@ void write(ofstream& ofs, const T& value) {
     }
 }
 
-template<>
-void write(ofstream& ofs, const string& value) {
+void write_string(ofstream& ofs, std::string_view value) {
     write<uint64_t>(ofs, value.size());
-    ofs.write(value.c_str(), value.size());
+    ofs.write(value.data(), value.size());
     if (!ofs) {
         throw runtime_error("failed to write to file");
     }
 }
 
-size_t string_size(const string& value) {
-    return sizeof(uint64_t) + value.size();
+template<>
+void write(ofstream& ofs, const string& value) {
+    write_string(ofs, value);
 }
 
-shared_ptr<rendered_object> read_object(ifstream& ifs) {
-    auto id = read<string>(ifs);
-    auto type = read<string>(ifs);
-    auto json = read<string>(ifs);
-    return make_shared<rendered_object>(id, type, json);
+size_t string_size(size_t length) {
+    return sizeof(uint64_t) + length;
+}
+
+shared_ptr<rendered_object> read_object(reader& r, uint8_t version, shared_ptr<const file_contents> contents) {
+    string id(r.read_string());
+    string type(r.read_string());
+    if (version < HASH_VERSION) {
+        // The hash is computed from the JSON, so we might as well keep it
+        string json(r.read_string());
+        return make_shared<rendered_object>(id, type, json);
+    }
+    auto hash = r.read<rendered_object::content_hash>();
+    auto json = r.read_string();
+    return make_shared<rendered_object>(id, type, json, contents, hash);
 }
 
-shared_ptr<rendered_object_list> read_objects(ifstream& ifs) {
-    auto n_objects = read<uint64_t>(ifs);
+shared_ptr<rendered_object_list> read_objects(reader& r, uint8_t version, shared_ptr<const file_contents> contents) {
+    auto n_objects = r.read<uint64_t>();
 
     auto objects = make_shared<rendered_object_list>();
 
     for (uint64_t i = 0; i < n_objects; ++i) {
-        shared_ptr<rendered_object> object = read_object(ifs);
+        shared_ptr<rendered_object> object = read_object(r, version, contents);
         objects->add_object(object);
     }
 
@@ -124,38 +202,37 @@ shared_ptr<rendered_object_list> get_contents(const string& path) {
         return make_shared<rendered_object_list>();
     }
 
-    ifstream ifs(path, ios_base::in | ios_base::binary);
-
-    if (!ifs) {
-        throw runtime_error(string("failed to open file: ") + path);
-    }
+    auto contents = make_shared<const file_contents>(path);
+    reader r(*contents);
 
-    uint64_t magic = read<uint64_t>(ifs);
+    uint64_t magic = r.read<uint64_t>();
 
     if (magic != MAGIC_NUMBER) {
         throw bad_format();
     }
 
-    uint8_t version = read<uint8_t>(ifs);
+    uint8_t version = r.read<uint8_t>();
 
     if (version > CURRENT_VERSION) {
         throw std::runtime_error("version number of cache file is too high");
     }
 
-    return read_objects(ifs);
+    return read_objects(r, version, contents);
 }
 
 void write_object(ofstream& ofs, std::shared_ptr<rendered_object> object) {
     write<string>(ofs, object->get_id());
     write<string>(ofs, object->get_type());
-    write<string>(ofs, object->get_json());
+    write(ofs, object->get_hash());
+    write_string(ofs, object->get_json_view());
 }
 
 size_t object_size(std::shared_ptr<rendered_object> object) {
     return 
-        string_size(object->get_id()) + 
-        string_size(object->get_type()) + 
-        string_size(object->get_json());
+        string_size(object->get_id().size()) +
+        string_size(object->get_type().size()) +
+        sizeof(rendered_object::content_hash) +
+        string_size(object->get_json_size());
 }
 
 void write_objects(ofstream& ofs, std::shared_ptr<rendered_object_list> objects) {
@@ -212,6 +289,10 @@ void begin_rendered_cache_file(const string& path, size_t size_to_pre_allocate,
         throw runtime_error("failed to open cache file for writing");
     }
 
+    pre_allocate(ofs, size_to_pre_allocate);
+}
+
+void pre_allocate(std::ofstream& ofs, size_t size) {
     // Pre-allocate disk space by simply writing data to the file.
     // There are more efficient ways of doing this, but this needs to work
     // both in a platform independent way and also for filesystems that
@@ -221,15 +302,23 @@ void begin_rendered_cache_file(const string& path, size_t size_to_pre_allocate,
     char block[BLOCK_SIZE];
     std::fill_n(block, BLOCK_SIZE, 0xff);
 
-    std::streampos pos = 0;
-    ofs.seekp(pos);
-    while (pos < streampos(size_to_pre_allocate)) {
+    ofs.seekp(0, std::ios_base::end);
+    std::streampos pos = ofs.tellp();
+    if (pos == -1 || !ofs) {
+        throw std::runtime_error("failed to get file position while pre-allocating cache file size");
+    }
+    while (pos < streampos(size)) {
         ofs.write(block, BLOCK_SIZE);
         if (!ofs) {
+            // Leave the stream usable, so we can still write what fits
+            ofs.clear();
+            ofs.seekp(0);
             throw std::runtime_error("failed to pre-allocate cache file (not enough disk space?)");
         }
         pos = ofs.tellp();
         if (pos == -1 || !ofs) {
+            ofs.clear();
+            ofs.seekp(0);
             throw std::runtime_error("failed to get file position while pre-allocating cache file size");
         }
     }
@@ -290,4 +379,19 @@ size_t size_estimate(const rendered_object_list& current_objects, const rendered
     return total;
 }
 
+size_t size_estimate(const rendered_object_list& cached) {
+    size_t total = HEADER_SIZE + sizeof(uint64_t);
+    for (const auto& obj : cached) {
+        total += object_size(obj.second);
+    }
+    return total;
+}
+
+size_t size_increase(std::shared_ptr<rendered_object> current, std::shared_ptr<rendered_object> cached) {
+    // Like in estimate_objects, we keep room for the bigger of the two
+    size_t size = object_size(current);
+    size_t cached_size = cached ? object_size(cached) : 0;
+    return size > cached_size ? size - cached_size : 0;
+}
+
 }
@@ -51,6 +51,18 @@ std::shared_ptr<rendered_object_list> get_contents(const std::string& path);
   */
 void begin_rendered_cache_file(const std::string& path, size_t size_to_pre_allocate, std::ofstream& ofs);
 
+/**
+ * Grows the space pre-allocated with begin_rendered_cache_file so that
+ * at least 'size' bytes are allocated. This way the space can be allocated
+ * as we go, instead of before we know how big the objects will be.
+ *
+ * ofs will point to the start of the temporary file after this call.
+ *
+ * On error, an std::runtime_error is thrown. What was allocated before
+ * the call is still allocated.
+ */
+void pre_allocate(std::ofstream& ofs, size_t size);
+
 /**
  * Writes the contents for a new cache file based on an object list.
  * ofs should point to the start of a file to write to. After successful
@@ -85,6 +97,22 @@ void finalize_rendered_cache_file(std::ofstream& ofs, const std::string& path);
  */
 size_t size_estimate(const rendered_object_list& current_objects, const rendered_object_list& cached);
 
+/**
+ * Estimate needed size of the new cache file if we only know the cached objects,
+ * this is the size needed if we keep all of them.
+ *
+ * As we go through the current objects, the estimate grows with size_increase()
+ * for each object. When all current objects have been added the result is the
+ * same as from the size_estimate above.
+ */
+size_t size_estimate(const rendered_object_list& cached);
+
+/**
+ * How much the estimate grows because of a current object, 'cached' is the
+ * cached version of the object (or nullptr if there isn't one).
+ */
+size_t size_increase(std::shared_ptr<rendered_object> current, std::shared_ptr<rendered_object> cached);
+
 }
 
 #endif // EGILSCIM_RENDERED_CACHE_FILE_HPP
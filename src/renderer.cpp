@@ -65,23 +65,30 @@ std::shared_ptr<rendered_object> renderer::render(const post_processing::plugins
     std::string type = obj.getSS12000type();
     std::string standard_type = actualSS12000type(type);
 
+    // Only errors from rendering this object should be reported for it
+    simplescim_error_string_set(nullptr, nullptr);
+
     std::string template_json = config_file::instance().get(type + "-scim-json-template");
     std::string parsed_json = scim_json_parse(template_json, obj, config::escape_expansions_by_default());
     
-    std::string extra_errors;
-    if (has_errors_to_print()) {
-        extra_errors = std::string(" (") + simplescim_error_string_get() + ")";
-    }
+    auto template_error = [&type]() {
+        std::string extra_errors;
+        if (has_errors_to_print()) {
+            extra_errors = std::string(" (") + simplescim_error_string_get() + ")";
+        }
+        return std::runtime_error("failed to parse JSON template for " + type + extra_errors);
+    };
 
     if (parsed_json == "") {
-        throw std::runtime_error("failed to parse JSON template for " + type + extra_errors);
+        throw template_error();
     }
 
     if (!verify_json(parsed_json, type)) {
-        throw std::runtime_error("failed to parse JSON template for " + type + extra_errors);
+        throw template_error();
     }
 
     try {
+        std::lock_guard<std::mutex> lock(plugins_mutex);
         parsed_json = post_processing::process(ppp, standard_type, parsed_json);
     } catch (const std::runtime_error& e) {
         throw std::runtime_error("post processing error when creating object " + readable_id(&obj, type) + ": " + e.what());
@@ -93,8 +100,12 @@ bool renderer::verify_json(const std::string & json, const std::string &type) {
     if (json.empty()) {
         return false;
     }
-    else if (std::find(verified_types.begin(), verified_types.end(), type) != verified_types.end()) {
-        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(verified_types_mutex);
+        if (std::find(verified_types.begin(), verified_types.end(), type) != verified_types.end()) {
+            return true;
+        }
     }
 
     namespace pt = boost::property_tree;
@@ -104,11 +115,16 @@ bool renderer::verify_json(const std::string & json, const std::string &type) {
     os << json;
     try {
         pt::read_json(os, root);
-        verified_types.emplace_back(type);
     } catch (const pt::ptree_error& e) {
-        std::cerr << "Failed to parse JSON for " << type << std::endl;
+        // The error is reported by the caller (for the object, in the thread
+        // that rendered it) rather than printed here
         simplescim_error_string_set_message(e.what());
         return false;
     }
+
+    std::lock_guard<std::mutex> lock(verified_types_mutex);
+    if (std::find(verified_types.begin(), verified_types.end(), type) == verified_types.end()) {
+        verified_types.emplace_back(type);
+    }
     return true;
 }
@@ -20,6 +20,7 @@
 #ifndef EGILSCIM_RENDERER_HPP
 #define EGILSCIM_RENDERER_HPP
 
+#include <mutex>
 #include "model/base_object.hpp"
 #include "model/rendered_object.hpp"
 #include "post_processing.hpp"
@@ -30,6 +31,10 @@
  * 
  * The validity of the JSON generated from templates is only checked
  * once per type.
+ *
+ * Objects may be rendered from several threads at the same time.
+ * The post processing plugins are still called one at a time, since
+ * they aren't required to be thread safe.
  */
 class renderer {
 public:
@@ -44,6 +49,8 @@ public:
 private:
     bool verify_json(const std::string & json, const std::string &type);
     string_vector verified_types;
+    std::mutex verified_types_mutex;
+    std::mutex plugins_mutex;
 };
 
 #endif // EGILSCIM_RENDERER_HPP
@@ -0,0 +1,200 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "request_timings.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+// Defined in scim_json_parse.cpp
+std::string json_string_escape(const std::string& str);
+
+namespace {
+
+int highest_bit(uint64_t value) {
+    int bit = -1;
+    while (value != 0) {
+        value >>= 1;
+        ++bit;
+    }
+    return bit;
+}
+
+// The slowest request first
+bool slower(const request_timings::sample& a, const request_timings::sample& b) {
+    return a.total > b.total;
+}
+
+// Durations are written in milliseconds
+std::string milliseconds(uint64_t microseconds) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1) << microseconds / 1000.0;
+    return os.str();
+}
+
+void write_histogram(std::ostream& os, const std::string& name, const latency_histogram& h) {
+    os << "\"" << name << "\": {"
+       << "\"p50\": " << milliseconds(h.percentile(0.5)) << ", "
+       << "\"p90\": " << milliseconds(h.percentile(0.9)) << ", "
+       << "\"p99\": " << milliseconds(h.percentile(0.99)) << ", "
+       << "\"max\": " << milliseconds(h.max()) << "}";
+}
+
+} // anonymous namespace
+
+int latency_histogram::bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<int>(value);
+    }
+    // The four bits after the highest tell which sub bucket
+    int shift = highest_bit(value) - 4;
+    int bucket = SUB_BUCKETS * (shift + 1) + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+    return std::min(bucket, BUCKETS - 1);
+}
+
+uint64_t latency_histogram::upper_bound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void latency_histogram::add(uint64_t microseconds) {
+    ++counts[bucket_of(microseconds)];
+    ++total_count;
+    max_value = std::max(max_value, microseconds);
+}
+
+uint64_t latency_histogram::percentile(double p) const {
+    if (total_count == 0) {
+        return 0;
+    }
+
+    auto rank = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * total_count));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            return std::min(upper_bound(bucket), max_value);
+        }
+    }
+    return max_value;
+}
+
+request_timings::request_timings(size_t slowest)
+    : slowest_to_keep(slowest) {
+}
+
+void request_timings::add(const sample& s) {
+    auto& stats = per_endpoint[std::make_pair(s.endpoint, s.method)];
+    stats.name_lookup.add(s.name_lookup);
+    stats.connect.add(s.connect);
+    stats.tls_handshake.add(s.tls_handshake);
+    stats.first_byte.add(s.first_byte);
+    stats.total.add(s.total);
+    stats.request_bytes += s.request_bytes;
+    stats.response_bytes += s.response_bytes;
+
+    if (slowest_to_keep == 0) {
+        return;
+    }
+    if (slowest.size() < slowest_to_keep) {
+        slowest.push_back(s);
+        std::push_heap(slowest.begin(), slowest.end(), slower);
+    }
+    else if (s.total > slowest.front().total) {
+        std::pop_heap(slowest.begin(), slowest.end(), slower);
+        slowest.back() = s;
+        std::push_heap(slowest.begin(), slowest.end(), slower);
+    }
+}
+
+void request_timings::write_histograms(std::ostream& os, const std::string& indent) const {
+    os << "{";
+    std::string current_endpoint;
+    bool first_endpoint = true;
+    for (const auto& itr : per_endpoint) {
+        const auto& endpoint = itr.first.first;
+        const auto& method = itr.first.second;
+        const auto& stats = itr.second;
+
+        if (first_endpoint || endpoint != current_endpoint) {
+            if (!first_endpoint) {
+                os << "\n" << indent << "  },";
+            }
+            os << "\n" << indent << "  \"" << json_string_escape(endpoint) << "\": {";
+            current_endpoint = endpoint;
+            first_endpoint = false;
+        }
+        else {
+            os << ",";
+        }
+
+        auto inner = indent + "      ";
+        os << "\n" << indent << "    \"" << json_string_escape(method) << "\": {\n";
+        os << inner << "\"requests\": " << stats.total.count() << ",\n";
+        os << inner << "\"requestBytes\": " << stats.request_bytes << ",\n";
+        os << inner << "\"responseBytes\": " << stats.response_bytes << ",\n";
+        os << inner;
+        write_histogram(os, "nameLookup", stats.name_lookup);
+        os << ",\n" << inner;
+        write_histogram(os, "connect", stats.connect);
+        os << ",\n" << inner;
+        write_histogram(os, "tlsHandshake", stats.tls_handshake);
+        os << ",\n" << inner;
+        write_histogram(os, "firstByte", stats.first_byte);
+        os << ",\n" << inner;
+        write_histogram(os, "total", stats.total);
+        os << "\n" << indent << "    }";
+    }
+    if (!first_endpoint) {
+        os << "\n" << indent << "  }\n" << indent;
+    }
+    os << "}";
+}
+
+void request_timings::write_slowest(std::ostream& os, const std::string& indent) const {
+    auto sorted = slowest;
+    std::sort(sorted.begin(), sorted.end(), slower);
+
+    os << "[";
+    bool first = true;
+    for (const auto& s : sorted) {
+        os << (first ? "\n" : ",\n") << indent << "  {"
+           << "\"method\": \"" << json_string_escape(s.method) << "\", "
+           << "\"url\": \"" << json_string_escape(s.url) << "\", ";
+        if (!s.resource_id.empty()) {
+            os << "\"id\": \"" << json_string_escape(s.resource_id) << "\", ";
+        }
+        os << "\"responseCode\": " << s.response_code << ", "
+           << "\"firstByte\": " << milliseconds(s.first_byte) << ", "
+           << "\"total\": " << milliseconds(s.total) << "}";
+        first = false;
+    }
+    if (!first) {
+        os << "\n" << indent;
+    }
+    os << "]";
+}
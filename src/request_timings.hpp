@@ -0,0 +1,136 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_REQUEST_TIMINGS_HPP
+#define EGILSCIM_REQUEST_TIMINGS_HPP
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A histogram of durations (in microseconds) which can tell percentiles.
+ *
+ * The values are counted in buckets which are about 6% wide (16 buckets per
+ * power of two), so the memory used doesn't depend on the number of values
+ * and the percentiles are accurate to within a bucket.
+ */
+class latency_histogram {
+public:
+    void add(uint64_t microseconds);
+
+    uint64_t count() const {
+        return total_count;
+    }
+
+    uint64_t max() const {
+        return max_value;
+    }
+
+    /**
+     * The value below which the fraction 'p' (e.g. 0.99) of the values are.
+     * Returns the upper bound of the bucket, but never more than max().
+     */
+    uint64_t percentile(double p) const;
+
+private:
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = SUB_BUCKETS + 60 * SUB_BUCKETS;
+
+    static int bucket_of(uint64_t value);
+    static uint64_t upper_bound(int bucket);
+
+    std::array<uint32_t, BUCKETS> counts{};
+    uint64_t total_count = 0;
+    uint64_t max_value = 0;
+};
+
+/**
+ * Collects how long the HTTP requests took, per endpoint and method,
+ * so that we can tell where the time goes in a slow run (name lookup,
+ * connecting, TLS handshake, waiting for the server or the transfer).
+ *
+ * The times are from curl (CURLINFO_*_TIME_T) and, like in curl, each
+ * phase is counted from the start of the request.
+ */
+class request_timings {
+public:
+    /// The timing of one request, times in microseconds
+    struct sample {
+        std::string endpoint;
+        std::string method;
+        std::string url;
+
+        /// The resource the request was for, if it was for a single resource
+        std::string resource_id;
+
+        long response_code = 0;
+        uint64_t name_lookup = 0;
+        uint64_t connect = 0;
+        uint64_t tls_handshake = 0;
+        uint64_t first_byte = 0;
+        uint64_t total = 0;
+        uint64_t request_bytes = 0;
+        uint64_t response_bytes = 0;
+    };
+
+    /** 'slowest' is how many of the slowest requests we remember */
+    explicit request_timings(size_t slowest = 10);
+
+    void add(const sample& s);
+
+    bool empty() const {
+        return per_endpoint.empty();
+    }
+
+    /**
+     * Writes the histograms as a JSON object, with an object per endpoint
+     * and an object per method within it. Each line is indented with
+     * 'indent' and the object ends without a newline.
+     */
+    void write_histograms(std::ostream& os, const std::string& indent) const;
+
+    /** Writes the slowest requests as a JSON array, slowest first. */
+    void write_slowest(std::ostream& os, const std::string& indent) const;
+
+private:
+    struct endpoint_method {
+        latency_histogram name_lookup;
+        latency_histogram connect;
+        latency_histogram tls_handshake;
+        latency_histogram first_byte;
+        latency_histogram total;
+        uint64_t request_bytes = 0;
+        uint64_t response_bytes = 0;
+    };
+
+    size_t slowest_to_keep;
+
+    /// Per endpoint and method
+    std::map<std::pair<std::string, std::string>, endpoint_method> per_endpoint;
+
+    /// The slowest requests (a heap with the fastest of them first)
+    std::vector<sample> slowest;
+};
+
+#endif // EGILSCIM_REQUEST_TIMINGS_HPP
@@ -18,6 +18,9 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <exception>
+#include <optional>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <assert.h>
@@ -28,11 +31,20 @@
 #include "model/base_object.hpp"
 #include "model/object_list.hpp"
 #include "config_file.hpp"
+#include "config.hpp"
 #include "cache_file.hpp"
 #include "rendered_cache_file.hpp"
 #include "simplescim_scim_send.hpp"
 #include "readable_id.hpp"
 #include "audit.hpp"
+#include "scim_bulk.hpp"
+#include "scim_patch.hpp"
+
+// How many objects we render ahead of what we're sending
+const size_t RENDER_AHEAD = 1024;
+
+// How much extra space we allocate when the new cache file needs to grow
+const size_t CACHE_FILE_GROWTH = 1024 * 1024;
 
 // Concatenates a base URL with a path, for instance "https://foo.com" and "Users"
 // into "https://foo.com/Users"
@@ -81,12 +93,21 @@ int ScimActions::simplescim_scim_init() const {
     err = scim_sender::instance().send_init(cert,
                                            key,
                                            scim_server_info.get_pinned_public_keys(),
-                                           scim_server_info.get_ca_bundle_path());
+                                           scim_server_info.get_ca_bundle_path(),
+                                           scim_server_info.get_url());
 
     if (err == -1) {
         return -1;
     }
 
+    auto servers = scim_server_info.get_servers();
+    if (!servers.empty()) {
+        scim_sender::instance().use_servers(servers);
+    }
+
+    // We only care about whether creates and updates succeed, not what the server responds
+    scim_sender::instance().set_discard_response_bodies(true);
+
     return 0;
 }
 
@@ -103,20 +124,23 @@ void ScimActions::simplescim_scim_clear() const {
  * 'current' and 'cache' if the object has been updated.
  */
 void ScimActions::process_changes(const object_list& current,
-                                  const rendered_object_list& pre_rendered,
+                                  render_pipeline& rendered,
                                   const rendered_object_list &cache,
                                   const post_processing::plugins& ppp,
                                   statistics& stats,
                                   bool rebuild_cache,
                                   const std::set<std::string>& all_scim_uuids) {
-    int err;
-
     for (const auto &iter : current) {
 
         const std::string &uid = iter.first;
+        if (!part.contains(uid)) {
+            // Another shard's, and not rendered (see start_rendering)
+            continue;
+        }
         const std::string readable = readable_id(iter.second.get());
+        const std::string type = iter.second->getSS12000type();
 
-        std::shared_ptr<rendered_object> object = pre_rendered.get_object(uid);
+        std::shared_ptr<rendered_object> object = take_rendered(rendered, readable);
         // Note: object can be a nullptr here if it failed to render.
         std::shared_ptr<rendered_object> cached_object;
         bool create = false;
@@ -129,34 +153,44 @@ void ScimActions::process_changes(const object_list& current,
             create = (cached_object == nullptr);
         }
 
-        if (create) {
-            ++stats.n_create;
-            bool conflict = false;
-            if (object != nullptr) {
-                auto create_functor = ScimActions::create_func(*object);
-                err = create_functor(*this, conflict);
-            } else {
-                err = -1;
-            }
+        change_plan::operation op;
+        op.type = type;
+        op.id = uid;
+        op.readable = readable;
+        op.object = object;
 
-            if (err == -1) {
+        bool copy = false;
+        if (!create && !rebuild_cache) {
+            copy = (object == nullptr || (*object == *cached_object));
+        }
+
+        if (!copy && object != nullptr && !reserve_cache_space(object, cached_object)) {
+            // No room for it in the new cache file, so we can't send it.
+            // It's a failed create or update, just like if the server had refused it.
+            if (create) {
+                ++stats.n_create;
                 ++stats.n_create_fail;
-                std::cerr << "Failed to create object " << readable << " of type " << iter.second->getSS12000type() << std::endl;
-                if (object != nullptr) {
+                std::cerr << "Failed to create object " << readable << " of type " << type << std::endl;
+                audit::log_scim_operation(audit_log, false, SCIM_OTHER_FAILURE, SCIM_CREATE, type, uid, nullptr, object);
+            }
+            else {
+                ++stats.n_update;
+                ++stats.n_update_fail;
+                std::cerr << "Failed to update object " << readable << " of type " << type << std::endl;
+                audit::log_scim_operation(audit_log, false, SCIM_OTHER_FAILURE, SCIM_UPDATE, type, uid, cached_object, object);
+
+                // Keep what the server has (as far as we know) in the cache
+                if (cached_object != nullptr && ScimActions::copy_func(*cached_object)(*this) == -1) {
                     std::cerr << simplescim_error_string_get() << std::endl;
                 }
             }
-            audit::log_scim_operation(audit_log, err == 0, conflict ? SCIM_CONFLICT_FAILURE : SCIM_OTHER_FAILURE, SCIM_CREATE, iter.second->getSS12000type(), uid, nullptr, object);
-        } else {
-            bool copy = false;
+            continue;
+        }
 
-            if (rebuild_cache) {
-                copy = false;
-            }
-            else {
-                copy = (object == nullptr || (*object == *cached_object));
-            }
-            
+        if (create) {
+            op.what = change_plan::kind::create;
+            schedule(op, stats);
+        } else {
             if (copy) {
                 // Object is the same, copy it
                 ++stats.n_copy;
@@ -166,24 +200,9 @@ void ScimActions::process_changes(const object_list& current,
                     std::cerr << simplescim_error_string_get() << std::endl;
                 }
             } else {
-                ++stats.n_update;
-                bool non_existent = false;
-                if (object != nullptr) {
-                    ScimActions::update_func update_f(*object);
-                    err = update_f(*this, non_existent);
-                }
-                else {
-                    err = -1;
-                }
-                
-                if (err == -1) {
-                    ++stats.n_update_fail;
-                    std::cerr << "Failed to update object " << readable << " of type " << iter.second->getSS12000type() << std::endl;
-                    if (object != nullptr) {
-                        std::cerr << simplescim_error_string_get() << std::endl;
-                    }
-                }
-                audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_UPDATE, iter.second->getSS12000type(), uid, cached_object, object);
+                op.what = change_plan::kind::update;
+                op.previous = cached_object;
+                schedule(op, stats);
             }
         }
     }
@@ -199,25 +218,19 @@ void ScimActions::process_deletes(const object_list& current,
                                   statistics& stats) {
 
     /** For every object in 'cache' of the given type */
-    for (const auto &item : cache) {
+    for (const auto &item : cache.of_type(type)) {
         std::shared_ptr<rendered_object> object = item.second;
-        if (object->get_type() == type) {
-            const std::string &uid = item.first;
-            auto tmp = current.get_object(uid);
-
-            if (tmp == nullptr) {
-                // Object doesn't exist in 'current', delete it
-                ++stats.n_delete;
-                bool non_existent = false;
-                auto delete_f = ScimActions::delete_func(*object);
-                int err = delete_f(*this, non_existent);
-
-                if (err == -1) {
-                    ++stats.n_delete_fail;
-                    fprintf(stderr, "%s\n", simplescim_error_string_get());
-                }
-                audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_DELETE, type, uid, object, nullptr);
-            }
+        const std::string &uid = item.first;
+        auto tmp = current.get_object(uid);
+
+        if (tmp == nullptr) {
+            // Object doesn't exist in 'current', delete it
+            change_plan::operation op;
+            op.what = change_plan::kind::remove;
+            op.type = type;
+            op.id = uid;
+            op.previous = object;
+            schedule(op, stats);
         }
     }
 }
@@ -226,20 +239,186 @@ void ScimActions::process_deletes_per_endpoint(const std::vector<std::string>& t
                                                const std::string& endpoint,
                                                statistics& stats,
                                                const std::string& type) {
-    auto prefix = concat_url(scim_server_info.get_url(), endpoint) + '/';
-
     for (const auto& uuid : to_delete) {
+        change_plan::operation op;
+        op.what = change_plan::kind::remove_from_endpoint;
+        op.type = type;
+        op.id = uuid;
+        op.endpoint = endpoint;
+        execute(op, stats);
+    }
+}
+
+/**
+ * Starts a create, update or delete. 'completed' (if set) is called
+ * when the operation is done, after the statistics and the new
+ * cache have been updated, with whether the operation failed.
+ *
+ * If we're writing a plan, the operation is added to the plan instead.
+ */
+void ScimActions::execute(const change_plan::operation& op,
+                          statistics& stats,
+                          std::function<void(bool failed)> completed) {
+    auto object = op.object;
+    auto cached_object = op.previous;
+    auto uid = op.id;
+    auto readable = op.readable;
+    auto type = op.type;
+
+    bool can_send = op.what == change_plan::kind::remove_from_endpoint ||
+        (op.what == change_plan::kind::remove ? cached_object != nullptr : object != nullptr);
+
+    if (plan_being_written != nullptr && can_send) {
+        plan_being_written->operations.push_back(op);
+        plan_being_written->operations.back().step = plan_step;
+        return;
+    }
+
+    switch (op.what) {
+    case change_plan::kind::create: {
+        ++stats.n_create;
+        auto create_done = [this, &stats, object, uid, readable, type, completed](int err, bool conflict) {
+            if (err == -1) {
+                ++stats.n_create_fail;
+                std::cerr << "Failed to create object " << readable << " of type " << type << std::endl;
+                if (object != nullptr) {
+                    std::cerr << simplescim_error_string_get() << std::endl;
+                }
+            }
+            audit::log_scim_operation(audit_log, err == 0, conflict ? SCIM_CONFLICT_FAILURE : SCIM_OTHER_FAILURE, SCIM_CREATE, type, uid, nullptr, object);
+            if (completed) {
+                completed(err == -1);
+            }
+        };
+
+        if (object != nullptr) {
+            auto create_functor = ScimActions::create_func(object);
+            create_functor(*this, create_done);
+        } else {
+            create_done(-1, false);
+        }
+        break;
+    }
+    case change_plan::kind::update: {
+        ++stats.n_update;
+        auto update_done = [this, &stats, object, cached_object, uid, readable, type, completed](int err, bool non_existent) {
+            if (err == -1) {
+                ++stats.n_update_fail;
+                std::cerr << "Failed to update object " << readable << " of type " << type << std::endl;
+                if (object != nullptr) {
+                    std::cerr << simplescim_error_string_get() << std::endl;
+                }
+            }
+            audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_UPDATE, type, uid, cached_object, object);
+            if (completed) {
+                completed(err == -1);
+            }
+        };
+
+        if (object != nullptr) {
+            ScimActions::update_func update_f(object, cached_object);
+            update_f(*this, update_done);
+        }
+        else {
+            update_done(-1, false);
+        }
+        break;
+    }
+    case change_plan::kind::remove: {
         ++stats.n_delete;
+        auto delete_f = ScimActions::delete_func(cached_object);
+        delete_f(*this, [this, &stats, cached_object, uid, type, completed](int err, bool non_existent) {
+            if (err == -1) {
+                ++stats.n_delete_fail;
+                fprintf(stderr, "%s\n", simplescim_error_string_get());
+            }
+            audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_DELETE, type, uid, cached_object, nullptr);
+            if (completed) {
+                completed(err != 0 && !non_existent);
+            }
+        });
+        break;
+    }
+    case change_plan::kind::remove_from_endpoint: {
+        ++stats.n_delete;
+        auto url = concat_url(scim_server_info.get_url(), op.endpoint) + '/' + unifyurl(uid);
+        scim_sender::instance().send_delete(url, [this, &stats, type, uid, completed](long err) {
+            if (err != 0) {
+                ++stats.n_delete_fail;
+                fprintf(stderr, "%s\n", simplescim_error_string_get());
+            }
+            bool non_existent = err == 404; // shouldn't really happen since we're only here when using rebuild cache
+            audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_DELETE, type, uid, nullptr, nullptr);
+            if (completed) {
+                completed(err != 0 && !non_existent);
+            }
+        });
+        break;
+    }
+    }
+}
 
-        const auto urlified = unifyurl(uuid);
-        int err = scim_sender::instance().send_delete(prefix + urlified);
-    
-        if (err != 0) {
-            ++stats.n_delete_fail;
-            fprintf(stderr, "%s\n", simplescim_error_string_get());
+/**
+ * Starts a create, update or delete when the operations it depends on
+ * are done, instead of waiting for the end of the step.
+ *
+ * A create or update waits for the creates of the objects it refers to
+ * (by id in its JSON). A delete is done before the deletes of the objects
+ * it refers to, so nothing refers to an object when it's deleted.
+ */
+void ScimActions::schedule(const change_plan::operation& op, statistics& stats) {
+    if (!send_by_dependencies) {
+        execute(op, stats);
+        return;
+    }
+
+    // Start what's become ready since last time
+    scheduler.start_ready();
+
+    std::string id;
+    std::vector<std::string> after;
+    switch (op.what) {
+    case change_plan::kind::create:
+        id = op.id;
+        [[fallthrough]];
+    case change_plan::kind::update:
+        if (op.object != nullptr) {
+            after = dependency_scheduler::string_values(op.object->get_json());
         }
-        bool non_existent = err == 404; // shouldn't really happen since we're only here when using rebuild cache
-        audit::log_scim_operation(audit_log, err == 0, non_existent ? SCIM_NOT_FOUND_FAILURE : SCIM_OTHER_FAILURE, SCIM_DELETE, type, uuid, nullptr, nullptr);
+        break;
+    case change_plan::kind::remove:
+        id = op.id;
+        after = std::move(referenced_by[op.id]);
+        referenced_by.erase(op.id);
+        if (op.previous != nullptr) {
+            for (const auto& value : dependency_scheduler::string_values(op.previous->get_json())) {
+                referenced_by[value].push_back(op.id);
+            }
+        }
+        break;
+    case change_plan::kind::remove_from_endpoint:
+        break;
+    }
+
+    scheduler.add(id, after, [this, op, &stats, id]() {
+        execute(op, stats, [this, id](bool) {
+            if (!id.empty()) {
+                scheduler.done(id);
+            }
+        });
+    });
+}
+
+/**
+ * Everything in a step (for instance all creates and updates of a type)
+ * must be done before the next step starts.
+ */
+void ScimActions::end_step() {
+    if (plan_being_written != nullptr) {
+        ++plan_step;
+    }
+    else {
+        scim_sender::instance().wait_for_all([this]() { scheduler.start_ready(); });
     }
 }
 
@@ -252,6 +431,18 @@ void ScimActions::print_statistics(const std::string& type,
     printf("Delete: %9zu %9zu %9zu\n", stats.n_delete - stats.n_delete_fail, stats.n_delete_fail, stats.n_delete);
 }
 
+void ScimActions::print_request_rates() {
+    for (const auto& p : scim_sender::instance().get_rate_controllers()) {
+        const auto& controller = p.second;
+        printf("Requests to %s: %d, %.1f per second, up to %d concurrent, server overloaded %d times\n",
+               p.first.c_str(),
+               controller.get_requests(),
+               controller.get_rate(),
+               controller.get_highest_limit(),
+               controller.get_throttled());
+    }
+}
+
 /** This function will convert from SCIM endpoint (e.g. "SchoolUnits")
   * to SS12000 type (e.g. "SchoolUnit") if there is an unambiguous 
   * mapping between the two.
@@ -293,47 +484,173 @@ std::string endpoint_to_SS12000_type(const std::string& endpoint,
     }
 }
 
-int ScimActions::perform(const data_server &current,
-                         const rendered_object_list &cached,
-                         const post_processing::plugins& ppp,
-                         bool rebuild_cache,
-                         const std::vector<ScimActions::scim_object_ref>& all_scim_objects) {
-    std::string types_string = config_file::instance().get("scim-type-send-order");
-    string_vector types = post_processing::filter_types(string_to_vector(types_string), ppp);
+/**
+ * Sets the limits for concurrent requests (see http_max_concurrent_requests)
+ * in total and per endpoint, since requests for different types can be in
+ * flight at the same time. If types share an endpoint the lowest of their
+ * limits is used.
+ */
+void ScimActions::use_concurrency_limits(const string_vector& types) const {
+    std::map<std::string, int> per_endpoint;
 
-    // Pre-render all objects (of types in send order) in current so we can estimate an upper limit for the new cache file
-    rendered_object_list pre_rendered;
+    for (const auto& type : types) {
+        int limit = config::http_max_concurrent_requests(type);
+
+        auto url_param = type + "-scim-url-endpoint";
+        if (conf.has(url_param)) {
+            auto endpoint = concat_url(scim_server_info.get_url(), conf.get(url_param));
+            auto itr = per_endpoint.find(endpoint);
+            per_endpoint[endpoint] = itr == per_endpoint.end() ? limit : std::min(itr->second, limit);
+        }
+    }
+
+    scim_sender::instance().set_max_concurrent_requests(config::http_max_concurrent_requests(), per_endpoint);
+}
+
+/**
+ * Finds out whether the SCIM server supports bulk requests and PATCH,
+ * and starts using them (if configured to). If we can't tell we'll
+ * do without them.
+ */
+void ScimActions::use_server_features() {
+    scim_sender& sender = scim_sender::instance();
+    std::string service_provider_config;
+
+    try {
+        service_provider_config = sender.get_service_provider_config(scim_server_info.get_url());
+
+        if (config::scim_bulk()) {
+            auto bulk_settings = scim_bulk::parse_service_provider_config(service_provider_config);
+            if (bulk_settings.supported) {
+                sender.enable_bulk(scim_server_info.get_url(), bulk_settings);
+            }
+            else {
+                std::cout << "The SCIM server doesn't support bulk requests, "
+                    "sending one request per operation" << std::endl;
+            }
+        }
+
+        if (config::scim_patch()) {
+            use_patch = scim_patch::supported(service_provider_config);
+            if (!use_patch) {
+                std::cout << "The SCIM server doesn't support PATCH, "
+                    "updating with PUT" << std::endl;
+            }
+        }
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to get the SCIM server's ServiceProviderConfig, "
+            "continuing without bulk requests and PATCH: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * Starts rendering all objects (of types in send order, and in our shard) in current.
+ *
+ * The objects are rendered in several threads (see config::render_threads()),
+ * a bit ahead of process_changes() which takes them in the same order as it
+ * goes through the objects (with take_rendered()). This way we can start
+ * sending before everything is rendered, and we don't keep all the rendered
+ * objects in memory at once.
+ */
+std::unique_ptr<render_pipeline> ScimActions::start_rendering(const data_server &current,
+                                                              const string_vector& types,
+                                                              const post_processing::plugins& ppp) const {
+    std::vector<const base_object*> objects;
     for (const auto& type : types) {
         std::shared_ptr<object_list> allOfType = current.get_by_type(type);
         if (allOfType) {
             for (const auto& iter : *allOfType) {
-                const std::string readable = readable_id(iter.second.get());
-
-                std::shared_ptr<rendered_object> object;
-                try {
-                    object = rend.render(ppp, *iter.second);
-                    pre_rendered.add_object(object);
-                }
-                catch (const std::runtime_error& e) {
-                    std::cerr << "Failed to render object (" << readable << ") to JSON : " << e.what() << std::endl;
+                if (!part.contains(iter.first)) {
+                    continue;
                 }
+                // The object keeps its uid once it has been looked up,
+                // so the rendering threads only read it
+                iter.second->get_uid();
+                objects.push_back(iter.second.get());
             }
         }
     }
 
-    size_t cache_size_upper_limit = rendered_cache_file::size_estimate(pre_rendered, cached);
+    auto count = objects.size();
+    auto render = [this, &ppp, objects = std::move(objects)](size_t i) {
+        return rend.render(ppp, *objects[i]);
+    };
+    return std::make_unique<render_pipeline>(count, render, config::render_threads(), RENDER_AHEAD);
+}
 
-    /* Open new cache file */
-    std::ofstream cache_stream;
-    try {
-        rendered_cache_file::begin_rendered_cache_file(config_file::instance().get_path("cache-file"), cache_size_upper_limit, cache_stream);
+/**
+ * Takes the next rendered object (or nullptr if it failed to render,
+ * in which case the error is printed).
+ */
+std::shared_ptr<rendered_object> ScimActions::take_rendered(render_pipeline& rendered,
+                                                            const std::string& readable) {
+    auto result = rendered.next();
+
+    // As if we had rendered the object in this thread
+    simplescim_error_string_set(nullptr, result.error ? result.error->c_str() : nullptr);
+
+    if (result.failure) {
+        try {
+            std::rethrow_exception(result.failure);
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Failed to render object (" << readable << ") to JSON : " << e.what() << std::endl;
+        }
     }
-    catch (const std::runtime_error& e) {
-        std::cerr << std::string("Failed to prepare new cache file: ") + e.what() << std::endl;
-        return -1;
+    return result.object;
+}
+
+/**
+ * Makes sure there's room in the new cache file for an object we're about
+ * to create or update. The space is allocated before anything is sent,
+ * so that we know we can save the new cache file afterwards.
+ *
+ * Returns false if there isn't room, the object should then be left as
+ * it is in the cache and not be sent.
+ */
+bool ScimActions::reserve_cache_space(std::shared_ptr<rendered_object> object,
+                                      std::shared_ptr<rendered_object> cached_object) {
+    if (new_cache_stream == nullptr) {
+        return true;
+    }
+    if (out_of_cache_space) {
+        return false;
     }
 
-    std::map<std::string, statistics> stats;
+    cache_size_upper_limit += rendered_cache_file::size_increase(object, cached_object);
+    if (cache_size_upper_limit > cache_size_allocated) {
+        // Allocate a bit more than needed so we don't grow the file for every object
+        size_t size = cache_size_upper_limit + CACHE_FILE_GROWTH;
+        try {
+            rendered_cache_file::pre_allocate(*new_cache_stream, size);
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Failed to grow the new cache file, no more objects will be created or updated: "
+                      << e.what() << std::endl;
+            out_of_cache_space = true;
+            return false;
+        }
+        cache_size_allocated = size;
+    }
+    return true;
+}
+
+/**
+ * Goes through all types, first creating and updating and then
+ * deleting (in reverse order). See perform().
+ */
+void ScimActions::process_all(const data_server &current,
+                              render_pipeline& rendered,
+                              const rendered_object_list &cached,
+                              const post_processing::plugins& ppp,
+                              bool rebuild_cache,
+                              const std::vector<scim_object_ref>& all_scim_objects,
+                              const string_vector& types,
+                              std::map<std::string, statistics>& stats) {
+    // A plan is applied step by step, so it keeps the types in separate steps
+    send_by_dependencies = plan_being_written == nullptr && !config::scim_type_barrier();
+    use_concurrency_limits(types);
 
     std::set<std::string> all_scim_uuids;
     if (rebuild_cache) {
@@ -348,7 +665,16 @@ int ScimActions::perform(const data_server &current,
             allOfType = std::make_shared<object_list>();
         }
 
-        process_changes(*allOfType, pre_rendered, cached, ppp, stats[type], rebuild_cache, all_scim_uuids);
+        process_changes(*allOfType, rendered, cached, ppp, stats[type], rebuild_cache, all_scim_uuids);
+
+        // Everything of this type must be done before we start with the next type,
+        // unless the objects only wait for what they refer to (see schedule())
+        if (!send_by_dependencies) {
+            end_step();
+        }
+    }
+    if (send_by_dependencies) {
+        end_step();
     }
 
     auto types_reversed(types);
@@ -372,6 +698,7 @@ int ScimActions::perform(const data_server &current,
 
             for (const auto& obj : all_scim_objects) {
                 if (obj.endpoint == endpoint &&
+                    part.contains(obj.uuid) &&
                     !current.has_object(obj.uuid)) {
                     to_delete.push_back(obj.uuid);
                 }
@@ -379,6 +706,7 @@ int ScimActions::perform(const data_server &current,
             
             auto type_for_endpoint = endpoint_to_SS12000_type(endpoint, types);
             process_deletes_per_endpoint(to_delete, endpoint, stats[type_for_endpoint], type_for_endpoint);
+            end_step();
         }
     }
     else {
@@ -387,15 +715,66 @@ int ScimActions::perform(const data_server &current,
             if (!allOfType) {
                 allOfType = std::make_shared<object_list>();
             }
-            process_deletes(*allOfType, cached, type, stats[type]);        
+            process_deletes(*allOfType, cached, type, stats[type]);
+            if (!send_by_dependencies) {
+                end_step();
+            }
+        }
+        if (send_by_dependencies) {
+            end_step();
         }
     }
-    
+}
+
+void ScimActions::print_results(const std::map<std::string, statistics>& stats) const {
+    scim_sender& sender = scim_sender::instance();
+
     for (const auto& p : stats) {
         print_statistics(p.first, p.second);
     }
 
-    /* Save new cache file */
+    if (sender.get_retries() > 0) {
+        printf("Retried %d operations which failed temporarily\n", sender.get_retries());
+    }
+
+    if (scheduler.get_waited() > 0) {
+        printf("%zu operations waited for objects they refer to\n", scheduler.get_waited());
+    }
+
+    const auto& servers = sender.get_server_pool();
+    for (size_t i = 0; i < servers.size(); ++i) {
+        auto latency = servers.get_latency(i);
+        printf("Requests to server %s: %d, %.0f ms on average, unreachable %d times\n",
+               servers.get(i).url.c_str(),
+               servers.get_requests(i),
+               latency ? *latency * 1000 : 0.0,
+               servers.get_unreachable(i));
+    }
+
+    for (const auto& p : sender.get_circuit_breakers()) {
+        const auto& breaker = p.second;
+        if (breaker.get_times_opened() > 0) {
+            printf("Stopped sending to %s %d times since it was failing, skipped %d operations\n",
+                   p.first.c_str(), breaker.get_times_opened(), breaker.get_skipped());
+        }
+    }
+
+    if (sender.get_uncompressed_request_bytes() > 0) {
+        printf("Compressed request bodies from %llu to %llu bytes (%.1f%%)\n",
+               sender.get_uncompressed_request_bytes(),
+               sender.get_compressed_request_bytes(),
+               100.0 * sender.get_compressed_request_bytes() / sender.get_uncompressed_request_bytes());
+    }
+
+    if (config::http_adaptive_concurrency()) {
+        print_request_rates();
+    }
+}
+
+/**
+ * Writes the new cache to the file prepared with begin_rendered_cache_file.
+ */
+int ScimActions::save_new_cache(std::ofstream& cache_stream) {
     try {
         rendered_cache_file::save(cache_stream, scim_new_cache);
     } catch (const std::runtime_error& e) {
@@ -413,6 +792,252 @@ int ScimActions::perform(const data_server &current,
     return 0;
 }
 
+int ScimActions::perform(const data_server &current,
+                         const rendered_object_list &cached,
+                         const post_processing::plugins& ppp,
+                         bool rebuild_cache,
+                         const std::vector<ScimActions::scim_object_ref>& all_scim_objects) {
+    std::string types_string = config_file::instance().get("scim-type-send-order");
+    string_vector types = post_processing::filter_types(string_to_vector(types_string), ppp);
+
+    part = config::sync_shard();
+    auto rendered = start_rendering(current, types, ppp);
+
+    // Space for the new cache file is allocated as we go (see reserve_cache_space),
+    // we start with what we need if we keep all cached objects.
+    cache_size_upper_limit = rendered_cache_file::size_estimate(cached);
+    cache_size_allocated = cache_size_upper_limit;
+    out_of_cache_space = false;
+
+    /* Open new cache file */
+    std::ofstream cache_stream;
+    try {
+        rendered_cache_file::begin_rendered_cache_file(config_file::instance().get_path("cache-file"), cache_size_allocated, cache_stream);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << std::string("Failed to prepare new cache file: ") + e.what() << std::endl;
+        return -1;
+    }
+
+    if (config::scim_bulk() || config::scim_patch()) {
+        use_server_features();
+    }
+
+    std::map<std::string, statistics> stats;
+    new_cache_stream = &cache_stream;
+    process_all(current, *rendered, cached, ppp, rebuild_cache, all_scim_objects, types, stats);
+    new_cache_stream = nullptr;
+    print_results(stats);
+
+    /* Save new cache file */
+    int res = save_new_cache(cache_stream);
+    return out_of_cache_space ? -1 : res;
+}
+
+int ScimActions::write_plan(const data_server &current,
+                            const rendered_object_list &cached,
+                            const post_processing::plugins& ppp,
+                            bool rebuild_cache,
+                            const std::vector<ScimActions::scim_object_ref>& all_scim_objects,
+                            const change_plan::cache_fingerprint& source,
+                            const std::string& path) {
+    std::string types_string = config_file::instance().get("scim-type-send-order");
+    string_vector types = post_processing::filter_types(string_to_vector(types_string), ppp);
+
+    part = config::sync_shard();
+    auto rendered = start_rendering(current, types, ppp);
+
+    change_plan::plan plan;
+    plan.source = source;
+    plan_being_written = &plan;
+    plan_step = 0;
+
+    std::map<std::string, statistics> stats;
+    process_all(current, *rendered, cached, ppp, rebuild_cache, all_scim_objects, types, stats);
+
+    plan_being_written = nullptr;
+
+    // Since nothing was sent, only the unchanged objects are in the new cache
+    for (const auto& p : *scim_new_cache) {
+        plan.copies.push_back(p.first);
+    }
+
+    try {
+        change_plan::write(path, plan);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to write plan: " << e.what() << std::endl;
+        return -1;
+    }
+
+    size_t n_create = 0, n_update = 0, n_delete = 0;
+    for (const auto& op : plan.operations) {
+        if (op.what == change_plan::kind::create) {
+            ++n_create;
+        }
+        else if (op.what == change_plan::kind::update) {
+            ++n_update;
+        }
+        else {
+            ++n_delete;
+        }
+    }
+    printf("Wrote a plan to %s with %zu creates, %zu updates and %zu deletes (%zu unchanged objects)\n",
+           path.c_str(), n_create, n_update, n_delete, plan.copies.size());
+
+    return 0;
+}
+
+int ScimActions::apply_plan(const std::string& path,
+                            const rendered_object_list &cached) {
+    change_plan::plan plan;
+    try {
+        plan = change_plan::read(path);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to read plan: " << e.what() << std::endl;
+        return -1;
+    }
+
+    if (plan.finished) {
+        std::cerr << "The plan in " << path << " has already been applied" << std::endl;
+        return -1;
+    }
+
+    // The plan was made from the cache file, so it mustn't have changed since.
+    // (Until the plan is finished, the cache file isn't changed by applying it.)
+    // Objects added to it since would otherwise be lost, and planned creates
+    // or updates could be out of date.
+    if (change_plan::fingerprint(cached) != plan.source) {
+        std::cerr << "The cache file has changed since the plan was written" << std::endl;
+        return -1;
+    }
+
+    std::map<std::string, statistics> stats;
+    for (const auto& id : plan.copies) {
+        auto object = cached.get_object(id);
+        if (object == nullptr) {
+            std::cerr << "The plan doesn't match the cache file" << std::endl;
+            return -1;
+        }
+        auto& type_stats = stats[object->get_type()];
+        ++type_stats.n_copy;
+        if (ScimActions::copy_func(*object)(*this) == -1) {
+            ++type_stats.n_copy_fail;
+            std::cerr << simplescim_error_string_get() << std::endl;
+        }
+    }
+
+    rendered_object_list planned;
+    for (const auto& op : plan.operations) {
+        if (op.object != nullptr) {
+            planned.add_object(op.object);
+        }
+    }
+
+    std::ofstream cache_stream;
+    try {
+        rendered_cache_file::begin_rendered_cache_file(config_file::instance().get_path("cache-file"),
+                                                       rendered_cache_file::size_estimate(planned, cached),
+                                                       cache_stream);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << std::string("Failed to prepare new cache file: ") + e.what() << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<change_plan::progress> progress;
+    try {
+        progress = std::make_unique<change_plan::progress>(path, plan);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to open plan: " << e.what() << std::endl;
+        return -1;
+    }
+
+    // What the operations we've already done left in the cache
+    for (const auto& p : plan.done) {
+        const auto& op = plan.operations[p.first];
+        switch (p.second.what) {
+        case change_plan::outcome::nothing:
+            break;
+        case change_plan::outcome::object:
+            scim_new_cache->add_object(op.object);
+            break;
+        case change_plan::outcome::previous:
+            scim_new_cache->add_object(op.previous);
+            break;
+        case change_plan::outcome::other:
+            scim_new_cache->add_object(p.second.other);
+            break;
+        }
+    }
+    if (!plan.done.empty()) {
+        printf("Continuing with the plan, %zu of %zu operations were already done\n",
+               plan.done.size(), plan.operations.size());
+    }
+
+    if (config::scim_bulk() || config::scim_patch()) {
+        use_server_features();
+    }
+
+    use_concurrency_limits(string_to_vector(conf.get("scim-type-send-order")));
+
+    scim_sender& sender = scim_sender::instance();
+    std::optional<uint64_t> step;
+
+    for (uint64_t i = 0; i < plan.operations.size(); ++i) {
+        const auto& op = plan.operations[i];
+        if (plan.done.count(i)) {
+            continue;
+        }
+
+        if (step != op.step) {
+            sender.wait_for_all();
+            step = op.step;
+        }
+
+        // Remember what the operation left in the new cache
+        execute(op, stats[op.type], [this, i, &op, &progress, &sender](bool failed) {
+            if (failed && sender.is_aborted()) {
+                // It wasn't really tried, do it next time
+                return;
+            }
+            change_plan::result r;
+            auto object = scim_new_cache->get_object(op.id);
+            if (object == nullptr) {
+                r.what = change_plan::outcome::nothing;
+            }
+            else if (op.object != nullptr && *object == *op.object) {
+                r.what = change_plan::outcome::object;
+            }
+            else if (op.previous != nullptr && *object == *op.previous) {
+                r.what = change_plan::outcome::previous;
+            }
+            else {
+                r.what = change_plan::outcome::other;
+                r.other = object;
+            }
+            progress->done(i, r);
+        });
+    }
+    sender.wait_for_all();
+
+    print_results(stats);
+
+    if (sender.is_aborted()) {
+        std::cerr << "Applying the plan was interrupted, apply it again to continue" << std::endl;
+        return -1;
+    }
+
+    if (save_new_cache(cache_stream) == -1) {
+        return -1;
+    }
+
+    progress->finished();
+    return 0;
+}
+
 int ScimActions::copy_func::operator()(const ScimActions &actions) {
     if (cached.get_id().empty()) {
         return -1;
@@ -424,89 +1049,100 @@ int ScimActions::copy_func::operator()(const ScimActions &actions) {
 
 }
 
-int ScimActions::delete_func::operator()(const ScimActions &actions, bool& non_existent) {
-    non_existent = false;
-    if (object.get_id().empty()) {
+void ScimActions::delete_func::operator()(const ScimActions &actions, std::function<void(int err, bool non_existent)> done) {
+    if (object->get_id().empty()) {
         simplescim_error_string_set_prefix("ScimActions::delete_func:"
                                            "get-attribute");
         simplescim_error_string_set_message("cached object does not have unique identifier attribute");
-        return -1;
+        done(-1, false);
+        return;
     }
     std::string url = actions.scim_server_info.get_url();
-    std::string urlified = unifyurl(object.get_id());
-    std::string endpoint = config_file::instance().get(object.get_type() + "-scim-url-endpoint");
+    std::string urlified = unifyurl(object->get_id());
+    std::string endpoint = config_file::instance().get(object->get_type() + "-scim-url-endpoint");
     url = concat_url(url, endpoint);
     url = concat_url(url, urlified);
 
     /* Send SCIM delete request */
-    int err = scim_sender::instance().send_delete(url);
-
-    if (err != 0 && err != 404) { // Recache if delete failed, 404 is no failure
-        actions.scim_new_cache->add_object(std::make_shared<rendered_object>(object));
-    }
-    if (err == 404) {
-        non_existent = true;
-        simplescim_error_string_set_prefix("ScimActions::delete_func:");
-        simplescim_error_string_set_message("tried to delete an object which the server says it doesn't have. Will not attempt to delete next run.");
-    }
+    scim_sender::instance().send_delete(url, [&actions, object = object, done](long err) {
+        if (err != 0 && err != 404) { // Recache if delete failed, 404 is no failure
+            actions.scim_new_cache->add_object(std::make_shared<rendered_object>(*object));
+        }
+        bool non_existent = false;
+        if (err == 404) {
+            non_existent = true;
+            simplescim_error_string_set_prefix("ScimActions::delete_func:");
+            simplescim_error_string_set_message("tried to delete an object which the server says it doesn't have. Will not attempt to delete next run.");
+        }
 
-    return err;
+        done(err, non_existent);
+    });
 }
 
-int ScimActions::create_func::operator()(const ScimActions &actions, bool& conflict) {
+void ScimActions::create_func::operator()(const ScimActions &actions, std::function<void(int err, bool conflict)> done) {
     std::string url = actions.scim_server_info.get_url();
-    std::string endpoint = config_file::instance().get(create.get_type() + "-scim-url-endpoint");
+    std::string endpoint = config_file::instance().get(create->get_type() + "-scim-url-endpoint");
     url = concat_url(url, endpoint);
 
     /* Send SCIM create request */
-    conflict = false;
-    std::optional<std::string> response_json =
-        scim_sender::instance().send_create(url, create.get_json(), conflict);
-    std::string id = create.get_id();
-    if (response_json)
-        actions.scim_new_cache->add_object(std::make_shared<rendered_object>(create));
-    else {
-        if (conflict) {
-            // Put it in cache, but with a dummy object to make sure we update in the next run
-            auto copied_object = std::make_shared<rendered_object>(create.get_id(), create.get_type(), dummy_SCIM_object(create.get_id(), "create conflict"));
-            actions.scim_new_cache->add_object(copied_object);
+    scim_sender::instance().send_create(url, create->get_json(), [&actions, create = create, done](std::optional<std::string> response_json, bool conflict) {
+        if (response_json)
+            actions.scim_new_cache->add_object(std::make_shared<rendered_object>(*create));
+        else {
+            if (conflict) {
+                // Put it in cache, but with a dummy object to make sure we update in the next run
+                auto copied_object = std::make_shared<rendered_object>(create->get_id(), create->get_type(), dummy_SCIM_object(create->get_id(), "create conflict"));
+                actions.scim_new_cache->add_object(copied_object);
+            }
+            done(-1, conflict);
+            return;
         }
-        return -1;
-    }
 
-    return 0;
+        done(0, false);
+    }, create->get_id());
 }
 
-int ScimActions::update_func::operator()(const ScimActions &actions, bool& non_existent) {
-    std::string id = object.get_id();
+void ScimActions::update_func::operator()(const ScimActions &actions, std::function<void(int err, bool non_existent)> done) {
+    std::string id = object->get_id();
 
     if (id.empty()) {
-        return -1;
+        done(-1, false);
+        return;
     }
 
-    std::string unified = unifyurl(object.get_id());
+    std::string unified = unifyurl(object->get_id());
     std::string url = actions.scim_server_info.get_url();
-    std::string endpoint = config_file::instance().get(object.get_type() + "-scim-url-endpoint");
+    std::string endpoint = config_file::instance().get(object->get_type() + "-scim-url-endpoint");
     url = concat_url(url, endpoint);
     url = concat_url(url, unified);
 
-    non_existent = false;
-    std::optional<std::string> response_json =
-        scim_sender::instance().send_update(url, object.get_json(), non_existent);
-
-    /* Insert copied object into new cache */
-    if (!response_json) {
-        if (!non_existent) {
-            // Keep it in cache, but with a dummy object to make sure we retry the update next run
-            auto copied_object = std::make_shared<rendered_object>(object.get_id(), object.get_type(), dummy_SCIM_object(object.get_id(), "failed update"));
-            actions.scim_new_cache->add_object(copied_object);
+    auto update_done = [&actions, object = object, done](std::optional<std::string> response_json, bool non_existent) {
+        /* Insert copied object into new cache */
+        if (!response_json) {
+            if (!non_existent) {
+                // Keep it in cache, but with a dummy object to make sure we retry the update next run
+                auto copied_object = std::make_shared<rendered_object>(object->get_id(), object->get_type(), dummy_SCIM_object(object->get_id(), "failed update"));
+                actions.scim_new_cache->add_object(copied_object);
+            }
+            done(-1, non_existent);
+            return;
         }
-        return -1;
-    } else {
-        actions.scim_new_cache->add_object(std::make_shared<rendered_object>(object));
+
+        actions.scim_new_cache->add_object(std::make_shared<rendered_object>(*object));
+        done(0, false);
+    };
+
+    std::optional<std::string> patch;
+    if (actions.use_patch && previous != nullptr) {
+        patch = scim_patch::make_patch(previous->get_json(), object->get_json());
     }
 
-    return 0;
+    if (patch) {
+        scim_sender::instance().send_patch(url, *patch, update_done);
+    }
+    else {
+        scim_sender::instance().send_update(url, object->get_json(), update_done);
+    }
 }
 
 std::vector<ScimActions::scim_object_ref> ScimActions::get_all_objects_from_scim_server() {
@@ -523,18 +1159,22 @@ std::vector<ScimActions::scim_object_ref> ScimActions::get_all_objects_from_scim
         }
     }
 
-    std::vector<scim_object_ref> results;
-    
+    std::vector<std::string> urls;
     for (const auto& endpoint : endpoints) {
-        std::vector<boost::property_tree::ptree> resources;
-        std::string url = scim_server_info.get_url();
-        url = concat_url(url, endpoint);
-        scim_sender::instance().query(url, resources);
+        urls.push_back(concat_url(scim_server_info.get_url(), endpoint));
+    }
+
+    auto& sender = scim_sender::instance();
+    sender.set_max_concurrent_requests(config::http_max_concurrent_requests());
+    auto ids = sender.query_ids(urls, config::scim_query_page_size());
 
-        for (const auto& resource : resources) {
-            auto uuid = resource.get<std::string>("id");
+    std::vector<scim_object_ref> results;
+    size_t i = 0;
+    for (const auto& endpoint : endpoints) {
+        for (const auto& uuid : ids[i]) {
             results.push_back(scim_object_ref(uuid, endpoint));
         }
+        ++i;
     }
 
     return results;
@@ -26,7 +26,15 @@
 #include "scim_server_info.hpp"
 #include "renderer.hpp"
 #include "model/rendered_object_list.hpp"
+#include "utility/async_log.hpp"
+#include "change_plan.hpp"
+#include "render_pipeline.hpp"
+#include "dependency_scheduler.hpp"
+#include "shard.hpp"
+#include <fstream>
 #include <memory>
+#include <functional>
+#include <unordered_map>
 
 class base_object;
 
@@ -74,8 +82,37 @@ private:
     const config_file &conf = config_file::instance();
     const SCIMServerInfo& scim_server_info;
 
+    /// Should updates be sent as PATCH when possible?
+    bool use_patch = false;
+
+    /// If set, operations are added to this plan instead of being sent
+    change_plan::plan* plan_being_written = nullptr;
+    uint64_t plan_step = 0;
+
+    /// The new cache file while we're sending (see reserve_cache_space)
+    std::ofstream* new_cache_stream = nullptr;
+    size_t cache_size_upper_limit = 0;
+    size_t cache_size_allocated = 0;
+
+    /// Set if we couldn't grow the new cache file, nothing more is created or updated then
+    bool out_of_cache_space = false;
+
+    /// Should operations only wait for what they refer to? (see schedule)
+    bool send_by_dependencies = false;
+    dependency_scheduler scheduler;
+
+    /// The objects we take care of, the others are left as if they weren't there
+    shard part;
+
+    /// For objects we delete, the objects (being deleted) which refer to them
+    std::unordered_map<std::string, std::vector<std::string>> referenced_by;
+
     void simplescim_scim_clear() const;
 
+    void use_server_features();
+
+    void use_concurrency_limits(const string_vector& types) const;
+
     int simplescim_scim_init() const;
 
     struct statistics {
@@ -85,8 +122,27 @@ private:
         size_t n_delete = 0, n_delete_fail = 0;
     };
 
+    std::unique_ptr<render_pipeline> start_rendering(const data_server &current,
+                                                     const string_vector& types,
+                                                     const post_processing::plugins& ppp) const;
+
+    static std::shared_ptr<rendered_object> take_rendered(render_pipeline& rendered,
+                                                          const std::string& readable);
+
+    bool reserve_cache_space(std::shared_ptr<rendered_object> object,
+                             std::shared_ptr<rendered_object> cached_object);
+
+    void process_all(const data_server &current,
+                     render_pipeline& rendered,
+                     const rendered_object_list &cached,
+                     const post_processing::plugins& ppp,
+                     bool rebuild_cache,
+                     const std::vector<scim_object_ref>& all_scim_objects,
+                     const string_vector& types,
+                     std::map<std::string, statistics>& stats);
+
     void process_changes(const object_list& current,
-                         const rendered_object_list& pre_rendered,
+                         render_pipeline& rendered,
                          const rendered_object_list& cache,
                          const post_processing::plugins& ppp,
                          statistics& stats,
@@ -103,9 +159,23 @@ private:
                                       statistics& stats,
                                       const std::string& type);    
 
+    void execute(const change_plan::operation& op,
+                 statistics& stats,
+                 std::function<void(bool failed)> completed = nullptr);
+
+    void schedule(const change_plan::operation& op, statistics& stats);
+
+    void end_step();
+
     static void print_statistics(const std::string& type,
                                  const statistics& stats);
 
+    void print_results(const std::map<std::string, statistics>& stats) const;
+
+    int save_new_cache(std::ofstream& cache_stream);
+
+    static void print_request_rates();
+
 public:
     ScimActions(const SCIMServerInfo& si)
            : scim_server_info(si) {
@@ -155,6 +225,39 @@ public:
                 bool rebuild_cache,
                 const std::vector<scim_object_ref>& all_scim_objects);
 
+    /**
+     * Works out what perform() would do, and writes it to a plan
+     * file at 'path' instead of doing it. Nothing is sent to the
+     * SCIM server and the cache file isn't changed.
+     *
+     * 'source' is the fingerprint of the cache file as it was read
+     * (before --force-update or --force-create changed 'cached'), so
+     * that the plan can only be applied to that cache file.
+     *
+     * On success, zero is returned. On error, -1 is returned.
+     */
+    int write_plan(const data_server &current,
+                   const rendered_object_list &cached,
+                   const post_processing::plugins& ppp,
+                   bool rebuild_cache,
+                   const std::vector<scim_object_ref>& all_scim_objects,
+                   const change_plan::cache_fingerprint& source,
+                   const std::string& path);
+
+    /**
+     * Performs the operations in a plan written by write_plan()
+     * and updates the cache file. 'cached' must be the contents of
+     * the cache file the plan was made from.
+     *
+     * The progress is recorded in the plan file, so if applying the
+     * plan is interrupted, calling this again continues where we
+     * left off.
+     *
+     * On success, zero is returned. On error, -1 is returned.
+     */
+    int apply_plan(const std::string& path,
+                   const rendered_object_list &cached);
+
     class copy_func {
         const rendered_object &cached;
     public:
@@ -163,29 +266,44 @@ public:
         int operator()(const ScimActions &);
     };
 
+    /*
+     * The create, update and delete functors start a SCIM request
+     * and call 'done' when the request has completed (which may be
+     * after the functor has returned, see scim_sender).
+     */
+
     class create_func {
-        const rendered_object &create;
+        std::shared_ptr<rendered_object> create;
     public:
-        explicit create_func(const rendered_object &c) : create(c) {}
+        explicit create_func(std::shared_ptr<rendered_object> c) : create(c) {}
 
-        int operator()(const ScimActions &, bool& conflict);
+        void operator()(const ScimActions &, std::function<void(int err, bool conflict)> done);
     };
 
+    /*
+     * If the server supports PATCH (and we're configured to use it),
+     * update_func sends the difference between the previous version
+     * of the object (from the cache, can be nullptr) and the current
+     * version. Otherwise the whole object is sent with a PUT.
+     */
     class update_func {
-        const rendered_object &object;
+        std::shared_ptr<rendered_object> object;
+        std::shared_ptr<rendered_object> previous;
     public:
-        update_func(const rendered_object &o) : object(o)
+        update_func(std::shared_ptr<rendered_object> o,
+                    std::shared_ptr<rendered_object> p = nullptr)
+            : object(o), previous(p)
             {}
 
-        int operator()(const ScimActions &, bool& non_existent);
+        void operator()(const ScimActions &, std::function<void(int err, bool non_existent)> done);
     };
 
     class delete_func {
-        const rendered_object &object;
+        std::shared_ptr<rendered_object> object;
     public:
-        explicit delete_func(const rendered_object &o) : object(o) {}
+        explicit delete_func(std::shared_ptr<rendered_object> o) : object(o) {}
 
-        int operator()(const ScimActions &, bool& non_existent);
+        void operator()(const ScimActions &, std::function<void(int err, bool non_existent)> done);
     };
     
     /** Gets a list of all resources in the SCIM server.
@@ -199,7 +317,7 @@ public:
     std::shared_ptr<rendered_object_list> get_new_cache() { return scim_new_cache; }
 
     // The audit_log stream will be unopened if audit logging isn't configured.
-    std::ofstream audit_log;
+    async_ofstream audit_log;
 };
 
 
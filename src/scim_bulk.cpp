@@ -0,0 +1,158 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scim_bulk.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace pt = boost::property_tree;
+
+// Defined in scim_json_parse.cpp
+std::string json_string_escape(const std::string& str);
+
+namespace scim_bulk {
+
+namespace {
+
+pt::ptree parse_json(const std::string& json, const std::string& what) {
+    std::istringstream iss(json);
+    pt::ptree root;
+    try {
+        pt::read_json(iss, root);
+    }
+    catch (const pt::ptree_error& e) {
+        throw std::runtime_error("Failed to parse " + what + ": " + e.what());
+    }
+    return root;
+}
+
+// The status is a string in SCIM 2.0 ("201"), but some servers send
+// a number, and SCIM 1.1 had an object with a code ({"code": "201"})
+long parse_status(const pt::ptree& operation) {
+    auto status = operation.get_child_optional("status");
+    if (!status) {
+        return 0;
+    }
+    auto code = status->get_optional<long>("code");
+    if (code) {
+        return *code;
+    }
+    return status->get_value<long>(0);
+}
+
+} // anonymous namespace
+
+settings parse_service_provider_config(const std::string& json) {
+    auto root = parse_json(json, "ServiceProviderConfig");
+
+    settings result;
+    try {
+        result.supported = root.get<bool>("bulk.supported", false);
+        result.max_operations = root.get<int>("bulk.maxOperations", 0);
+        result.max_payload_size = root.get<size_t>("bulk.maxPayloadSize", 0);
+    }
+    catch (const pt::ptree_error& e) {
+        throw std::runtime_error(std::string("Failed to parse bulk settings in ServiceProviderConfig: ") + e.what());
+    }
+
+    // Without limits we can't know how much to send in each request
+    if (result.max_operations <= 0 || result.max_payload_size == 0) {
+        result.supported = false;
+    }
+
+    return result;
+}
+
+std::string operation_json(const std::string& method,
+                           const std::string& path,
+                           const std::string& data,
+                           const std::string& bulk_id) {
+    std::string json = "{\"method\":\"" + method +
+        "\",\"bulkId\":\"" + json_string_escape(bulk_id) +
+        "\",\"path\":\"" + json_string_escape(path) + "\"";
+    if (!data.empty()) {
+        json += ",\"data\":" + data;
+    }
+    json += "}";
+    return json;
+}
+
+std::string request_json(const std::vector<std::string>& operations) {
+    std::string json = "{\"schemas\":[\"urn:ietf:params:scim:api:messages:2.0:BulkRequest\"],\"Operations\":[";
+    for (size_t i = 0; i < operations.size(); ++i) {
+        if (i != 0) {
+            json += ",";
+        }
+        json += operations[i];
+    }
+    json += "]}";
+    return json;
+}
+
+std::vector<std::optional<operation_result>> parse_response(const std::string& json,
+                                                             size_t n_operations) {
+    auto root = parse_json(json, "bulk response");
+
+    std::vector<std::optional<operation_result>> results(n_operations);
+
+    auto operations = root.get_child_optional("Operations");
+    if (!operations) {
+        throw std::runtime_error("No Operations list in bulk response");
+    }
+
+    size_t position = 0;
+    for (const auto& cur : *operations) {
+        const auto& operation = cur.second;
+
+        size_t index = position++;
+        auto bulk_id = operation.get_optional<std::string>("bulkId");
+        if (bulk_id) {
+            try {
+                index = std::stoul(*bulk_id);
+            }
+            catch (const std::exception&) {
+                // Not one of ours, go with the position
+            }
+        }
+
+        if (index >= n_operations) {
+            continue;
+        }
+
+        operation_result result;
+        result.status = parse_status(operation);
+
+        auto response = operation.get_child_optional("response");
+        if (response) {
+            std::ostringstream oss;
+            pt::write_json(oss, *response, false);
+            result.response = oss.str();
+            result.detail = response->get<std::string>("detail", "");
+        }
+
+        results[index] = result;
+    }
+
+    return results;
+}
+
+} // namespace scim_bulk
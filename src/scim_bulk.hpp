@@ -0,0 +1,91 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_SCIM_BULK_HPP
+#define EGILSCIM_SCIM_BULK_HPP
+
+#include <string>
+#include <vector>
+#include <optional>
+
+/**
+ * Helpers for SCIM Bulk requests (RFC 7644 section 3.7), which let us
+ * send many create, update and delete operations in one HTTP request.
+ *
+ * This only deals with the JSON, scim_sender does the batching and
+ * the actual requests.
+ */
+namespace scim_bulk {
+
+/** What the server says about its bulk support in /ServiceProviderConfig */
+struct settings {
+    bool supported = false;
+    int max_operations = 0;
+    size_t max_payload_size = 0;
+};
+
+/**
+ * Parses the server's ServiceProviderConfig. Throws std::runtime_error
+ * if it can't be parsed.
+ */
+settings parse_service_provider_config(const std::string& json);
+
+/**
+ * Returns the JSON for one operation in a bulk request.
+ *
+ * 'path' is relative to the SCIM base URL (e.g. "/Users" or
+ * "/Users/<id>"), 'data' is the resource's JSON (empty for DELETE).
+ */
+std::string operation_json(const std::string& method,
+                           const std::string& path,
+                           const std::string& data,
+                           const std::string& bulk_id);
+
+/** Returns the JSON for a bulk request with the given operations. */
+std::string request_json(const std::vector<std::string>& operations);
+
+/** The outcome of one operation in a bulk response */
+struct operation_result {
+    /// The HTTP status code for the operation
+    long status = 0;
+
+    /// The "response" object for the operation (if any), as JSON
+    std::string response;
+
+    /// An error message from the server (if any)
+    std::string detail;
+};
+
+/**
+ * Parses a bulk response for a request where the operations had
+ * bulkIds "0", "1", ... "n_operations - 1".
+ *
+ * Returns a result for each operation in the request, in the same
+ * order. The server should include the bulkId for each operation, if
+ * it doesn't we rely on the order of the operations in the response.
+ * An operation the server didn't respond to has no result.
+ *
+ * Throws std::runtime_error if the response can't be parsed.
+ */
+std::vector<std::optional<operation_result>> parse_response(const std::string& json,
+                                                             size_t n_operations);
+
+} // namespace scim_bulk
+
+#endif // EGILSCIM_SCIM_BULK_HPP
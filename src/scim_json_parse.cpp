@@ -25,6 +25,7 @@
 #include <optional>
 #include <algorithm>
 #include <iterator>
+#include <mutex>
 #include <regex>
 #include <iomanip>
 
@@ -844,7 +845,9 @@ std::shared_ptr<std::regex> scim_json_parser::parse_regex() {
     }
 
     static std::map<std::string, std::shared_ptr<std::regex>> regex_cache;
+    static std::mutex regex_cache_mutex;
 
+    std::lock_guard<std::mutex> lock(regex_cache_mutex);
     auto itr = regex_cache.find(pattern);
 
     if (itr != regex_cache.end()) {
@@ -0,0 +1,215 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scim_patch.hpp"
+#include "utility/utils.hpp"
+
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <boost/json.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace json = boost::json;
+namespace pt = boost::property_tree;
+
+// Defined in scim_json_parse.cpp
+std::string json_string_escape(const std::string& str);
+
+namespace scim_patch {
+
+namespace {
+
+void add_operation(json::array& operations,
+                   const char* op,
+                   const std::string& path,
+                   const json::value* value = nullptr) {
+    json::object operation;
+    operation["op"] = op;
+    operation["path"] = path;
+    if (value != nullptr) {
+        operation["value"] = *value;
+    }
+    operations.push_back(std::move(operation));
+}
+
+/* A multi-valued attribute where each element has a "value" which
+ * identifies it, such as the members of a group. The values must be
+ * unique so we can refer to the elements with a value filter.
+ */
+bool value_list(const json::array& arr, std::map<std::string, const json::value*>& by_value) {
+    for (const auto& element : arr) {
+        auto obj = element.if_object();
+        if (obj == nullptr) {
+            return false;
+        }
+        auto value = obj->if_contains("value");
+        if (value == nullptr || !value->is_string()) {
+            return false;
+        }
+        if (!by_value.emplace(std::string(value->get_string()), &element).second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Removes the elements which are gone or have changed, and adds
+ * the new or changed elements. Returns false if the attribute isn't
+ * a value list (see above).
+ */
+bool diff_value_list(const std::string& path,
+                     const json::array& previous,
+                     const json::array& current,
+                     json::array& operations) {
+    std::map<std::string, const json::value*> previous_by_value, current_by_value;
+    if (!value_list(previous, previous_by_value) ||
+        !value_list(current, current_by_value)) {
+        return false;
+    }
+
+    for (const auto& p : previous_by_value) {
+        auto itr = current_by_value.find(p.first);
+        if (itr == current_by_value.end() || *itr->second != *p.second) {
+            add_operation(operations, "remove",
+                          path + "[value eq \"" + json_string_escape(p.first) + "\"]");
+        }
+    }
+
+    json::array added;
+    for (const auto& element : current) {
+        auto itr = previous_by_value.find(std::string(element.get_object().at("value").get_string()));
+        if (itr == previous_by_value.end() || *itr->second != element) {
+            added.push_back(element);
+        }
+    }
+
+    if (!added.empty()) {
+        json::value value(std::move(added));
+        add_operation(operations, "add", path, &value);
+    }
+    return true;
+}
+
+/* Adds the operations needed to turn the attributes in previous into
+ * the attributes in current. prefix is put before each attribute name
+ * in the paths. If complex is true, complex attributes are diffed per
+ * sub-attribute, otherwise they are replaced as a whole.
+ */
+void diff_attributes(const std::string& prefix,
+                     const json::object& previous,
+                     const json::object& current,
+                     bool complex,
+                     json::array& operations) {
+    for (const auto& attribute : current) {
+        auto name = std::string(attribute.key());
+        auto path = prefix + name;
+        const auto& value = attribute.value();
+        auto old_value = previous.if_contains(name);
+
+        if (old_value == nullptr) {
+            add_operation(operations, "add", path, &value);
+        }
+        else if (*old_value == value) {
+            continue;
+        }
+        else if (prefix.empty() && startsWith(name, "urn:") &&
+                 old_value->is_object() && value.is_object()) {
+            // Attributes in an extension schema are referred to as <schema URN>:<attribute>
+            diff_attributes(path + ":", old_value->get_object(), value.get_object(), true, operations);
+        }
+        else if (complex && old_value->is_object() && value.is_object()) {
+            diff_attributes(path + ".", old_value->get_object(), value.get_object(), false, operations);
+        }
+        else if (!old_value->is_array() || !value.is_array() ||
+                 !diff_value_list(path, old_value->get_array(), value.get_array(), operations)) {
+            add_operation(operations, "replace", path, &value);
+        }
+    }
+
+    for (const auto& attribute : previous) {
+        if (!current.contains(attribute.key())) {
+            add_operation(operations, "remove", prefix + std::string(attribute.key()));
+        }
+    }
+}
+
+} // anonymous namespace
+
+bool supported(const std::string& service_provider_config) {
+    std::istringstream iss(service_provider_config);
+    pt::ptree root;
+    try {
+        pt::read_json(iss, root);
+        return root.get<bool>("patch.supported", false);
+    }
+    catch (const pt::ptree_error& e) {
+        throw std::runtime_error(std::string("Failed to parse ServiceProviderConfig: ") + e.what());
+    }
+}
+
+std::optional<std::string> make_patch(const std::string& previous, const std::string& current) {
+    json::value previous_value, current_value;
+    try {
+        previous_value = json::parse(previous);
+        current_value = json::parse(current);
+    }
+    catch (const std::exception&) {
+        return std::nullopt;
+    }
+
+    auto previous_object = previous_value.if_object();
+    auto current_object = current_value.if_object();
+    if (previous_object == nullptr || current_object == nullptr) {
+        return std::nullopt;
+    }
+
+    // Changing the schemas of a resource is better done with a PUT. This
+    // also covers the dummy objects we put in the cache after failures,
+    // they don't have any schemas and we don't know what the server has.
+    auto previous_schemas = previous_object->if_contains("schemas");
+    auto current_schemas = current_object->if_contains("schemas");
+    if (previous_schemas == nullptr || current_schemas == nullptr ||
+        *previous_schemas != *current_schemas) {
+        return std::nullopt;
+    }
+
+    json::array operations;
+    diff_attributes("", *previous_object, *current_object, true, operations);
+
+    if (operations.empty()) {
+        return std::nullopt;
+    }
+
+    json::array schemas;
+    schemas.push_back("urn:ietf:params:scim:api:messages:2.0:PatchOp");
+
+    json::object patch;
+    patch["schemas"] = json::value(std::move(schemas));
+    patch["Operations"] = json::value(std::move(operations));
+
+    auto result = json::serialize(patch);
+    if (result.size() >= current.size()) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+} // namespace scim_patch
@@ -0,0 +1,58 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_SCIM_PATCH_HPP
+#define EGILSCIM_SCIM_PATCH_HPP
+
+#include <string>
+#include <optional>
+
+/**
+ * Helpers for updating resources with SCIM PATCH (RFC 7644 section 3.5.2)
+ * instead of replacing them with PUT, so that we only need to send what
+ * has changed since the last run.
+ */
+namespace scim_patch {
+
+/**
+ * Returns whether the server's ServiceProviderConfig says it supports
+ * PATCH. Throws std::runtime_error if it can't be parsed.
+ */
+bool supported(const std::string& service_provider_config);
+
+/**
+ * Computes a PATCH request (a PatchOp message) which turns the resource
+ * 'previous' (as we sent it last time) into 'current'.
+ *
+ * Changed attributes are replaced, sub-attributes of complex attributes
+ * (such as name.givenName) and attributes in extension schemas are handled
+ * individually. Multi-valued attributes with a "value" in each element
+ * (such as members in a group) are updated by removing and adding
+ * individual values.
+ *
+ * Returns nothing if the resource should be replaced with a PUT instead,
+ * which is the case if the patch wouldn't be smaller than the resource,
+ * if the schemas have changed, or if either of the resources can't be
+ * parsed.
+ */
+std::optional<std::string> make_patch(const std::string& previous, const std::string& current);
+
+} // namespace scim_patch
+
+#endif // EGILSCIM_SCIM_PATCH_HPP
@@ -0,0 +1,234 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scim_query.hpp"
+
+#include <boost/json/basic_parser_impl.hpp>
+#include <cstdint>
+#include <stdexcept>
+
+namespace scim_query {
+
+namespace json = boost::json;
+
+namespace {
+
+// Deeper than any SCIM resource, but keeps us from running out of stack on garbage
+const std::size_t MAX_DEPTH = 256;
+
+/**
+ * Handler for json::basic_parser which only keeps totalResults and the
+ * resources' ids, everything else is skipped without being stored.
+ *
+ * Strings and keys may come in several parts, they are put together
+ * in 'text'.
+ */
+struct ids_handler {
+    constexpr static std::size_t max_object_size = std::size_t(-1);
+    constexpr static std::size_t max_array_size = std::size_t(-1);
+    constexpr static std::size_t max_key_size = std::size_t(-1);
+    constexpr static std::size_t max_string_size = std::size_t(-1);
+
+    page result;
+    bool found_total = false;
+    bool found_resources = false;
+
+    /// Number of objects and arrays we're in (1 in the ListResponse)
+    std::size_t depth = 0;
+
+    /// Are we in the Resources array? The resources are then at depth 3
+    bool in_resources = false;
+    bool resource_has_id = false;
+
+    /// The last key in the ListResponse and in the current resource
+    std::string key;
+    std::string resource_key;
+
+    std::string text;
+
+    bool is_total() const {
+        return depth == 1 && key == "totalResults";
+    }
+
+    /// A value which isn't an object, is it in the Resources array itself?
+    void not_a_resource() const {
+        if (in_resources && depth == 2) {
+            throw std::runtime_error("Resource without id in query result");
+        }
+    }
+
+    bool on_document_begin(json::error_code&) { return true; }
+    bool on_document_end(json::error_code&) { return true; }
+
+    bool on_object_begin(json::error_code&) {
+        if (in_resources && depth == 2) {
+            resource_has_id = false;
+            resource_key.clear();
+        }
+        ++depth;
+        return true;
+    }
+
+    bool on_object_end(std::size_t, json::error_code&) {
+        --depth;
+        if (in_resources && depth == 2 && !resource_has_id) {
+            throw std::runtime_error("Resource without id in query result");
+        }
+        return true;
+    }
+
+    bool on_array_begin(json::error_code&) {
+        not_a_resource();
+        if (depth == 1 && key == "Resources") {
+            in_resources = true;
+            found_resources = true;
+        }
+        ++depth;
+        return true;
+    }
+
+    bool on_array_end(std::size_t, json::error_code&) {
+        if (--depth == 1) {
+            in_resources = false;
+        }
+        return true;
+    }
+
+    bool on_key_part(json::string_view s, std::size_t, json::error_code&) {
+        text.append(s.data(), s.size());
+        return true;
+    }
+
+    bool on_key(json::string_view s, std::size_t, json::error_code&) {
+        text.append(s.data(), s.size());
+        if (depth == 1) {
+            key = text;
+        }
+        else if (in_resources && depth == 3) {
+            resource_key = text;
+        }
+        text.clear();
+        return true;
+    }
+
+    bool on_string_part(json::string_view s, std::size_t, json::error_code&) {
+        text.append(s.data(), s.size());
+        return true;
+    }
+
+    bool on_string(json::string_view s, std::size_t, json::error_code&) {
+        not_a_resource();
+        text.append(s.data(), s.size());
+        if (in_resources && depth == 3 && resource_key == "id" && !resource_has_id) {
+            result.ids.push_back(text);
+            resource_has_id = true;
+        }
+        text.clear();
+        return true;
+    }
+
+    bool on_number_part(json::string_view, json::error_code&) { return true; }
+
+    bool on_int64(int64_t i, json::string_view, json::error_code&) {
+        return on_number(static_cast<long long>(i));
+    }
+
+    bool on_uint64(uint64_t u, json::string_view, json::error_code&) {
+        return on_number(static_cast<long long>(u));
+    }
+
+    bool on_double(double d, json::string_view, json::error_code&) {
+        return on_number(static_cast<long long>(d));
+    }
+
+    bool on_number(long long value) {
+        not_a_resource();
+        if (is_total()) {
+            result.total_results = value;
+            found_total = true;
+        }
+        return true;
+    }
+
+    bool on_bool(bool, json::error_code&) {
+        not_a_resource();
+        return true;
+    }
+
+    bool on_null(json::error_code&) {
+        not_a_resource();
+        if (depth == 1 && key == "Resources") {
+            found_resources = true;
+        }
+        return true;
+    }
+
+    bool on_comment_part(json::string_view, json::error_code&) { return true; }
+    bool on_comment(json::string_view, json::error_code&) { return true; }
+};
+
+} // anonymous namespace
+
+std::string page_url(const std::string& url, long long start_index, int count, bool only_ids) {
+    std::string result = url + (url.find('?') == std::string::npos ? "?" : "&");
+    if (only_ids) {
+        result += "attributes=id&";
+    }
+    result += "startIndex=" + std::to_string(start_index) + "&count=" + std::to_string(count);
+    return result;
+}
+
+page parse_ids(const std::string& list_response) {
+    json::parse_options options;
+    options.max_depth = MAX_DEPTH;
+    json::basic_parser<ids_handler> parser(options);
+
+    json::error_code ec;
+    auto n = parser.write_some(false, list_response.data(), list_response.size(), ec);
+    if (ec) {
+        throw std::runtime_error("Failed to parse query result: " + ec.message() +
+                                 " at offset " + std::to_string(n));
+    }
+    if (list_response.find_first_not_of(" \t\r\n", n) != std::string::npos) {
+        throw std::runtime_error("Failed to parse query result: unexpected data after the response");
+    }
+
+    auto& handler = parser.handler();
+    if (!handler.found_total) {
+        throw std::runtime_error("No totalResults in query result");
+    }
+
+    if (handler.result.total_results > 0 && !handler.found_resources) {
+        throw std::runtime_error("No Resources list in query result");
+    }
+    return std::move(handler.result);
+}
+
+std::vector<long long> remaining_pages(long long total_results, int page_size) {
+    std::vector<long long> result;
+    if (page_size <= 0) {
+        return result;
+    }
+    for (long long start = 1 + page_size; start <= total_results; start += page_size) {
+        result.push_back(start);
+    }
+    return result;
+}
+
+} // namespace scim_query
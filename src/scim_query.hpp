@@ -0,0 +1,65 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_SCIM_QUERY_HPP
+#define EGILSCIM_SCIM_QUERY_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * Helpers for listing the ids of all resources at an endpoint
+ * (RFC 7644 section 3.4.2), used when rebuilding the cache.
+ *
+ * We only ask for the ids, and once the first page tells us how many
+ * resources there are the rest of the pages can be fetched in parallel.
+ */
+namespace scim_query {
+
+/** The part of a ListResponse we care about */
+struct page {
+    long long total_results = 0;
+    std::vector<std::string> ids;
+};
+
+/**
+ * Returns the URL for a page of the resources at 'url', starting at
+ * 'start_index' (1 for the first resource) with 'count' resources.
+ * If 'only_ids' is true we ask the server to only return the ids.
+ */
+std::string page_url(const std::string& url, long long start_index, int count, bool only_ids);
+
+/**
+ * Extracts totalResults and the resources' ids from a ListResponse,
+ * without building up a representation of the whole response.
+ *
+ * Throws std::runtime_error if it can't be parsed or a resource has no id.
+ */
+page parse_ids(const std::string& list_response);
+
+/**
+ * Returns the start index for each page after the first, when there are
+ * 'total_results' resources and the server returns 'page_size' of them
+ * per page.
+ */
+std::vector<long long> remaining_pages(long long total_results, int page_size);
+
+} // namespace scim_query
+
+#endif // EGILSCIM_SCIM_QUERY_HPP
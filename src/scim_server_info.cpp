@@ -46,6 +46,12 @@ SCIMServerInfo::SCIMServerInfo(const config_file& config) {
             pinned_public_keys = federated_tls_auth::concatenate_keys(end_point.pins);
             ca_bundle_path = connection_info.castore->get_path();
             castore_file = connection_info.castore;
+
+            if (config.get_bool("metadata-all-servers") && connection_info.end_points.size() > 1) {
+                for (const auto& ep : connection_info.end_points) {
+                    servers.push_back({ ep.url, federated_tls_auth::concatenate_keys(ep.pins) });
+                }
+            }
         }
         catch (const std::runtime_error&) {
             std::cerr << "Failed to load metadata from " << metadata_path << std::endl;
@@ -73,3 +79,7 @@ std::string SCIMServerInfo::get_pinned_public_keys() const {
 std::string SCIMServerInfo::get_ca_bundle_path() const {
     return ca_bundle_path;
 }
+
+std::vector<server_pool::server> SCIMServerInfo::get_servers() const {
+    return servers;
+}
@@ -22,7 +22,9 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 #include "fedtlsauth/castore_file.hpp"
+#include "server_pool.hpp"
 
 class config_file;
 
@@ -53,10 +55,18 @@ public:
     // Full path to CA bundle file
     std::string get_ca_bundle_path() const;
 
+    /*
+     * All servers to send requests to, if the metadata has several
+     * matching servers and we should use all of them (metadata-all-servers).
+     * Otherwise empty. The first one is the server given by get_url().
+     */
+    std::vector<server_pool::server> get_servers() const;
+
 private:    
     std::string url;
     std::string pinned_public_keys;
     std::string ca_bundle_path;
+    std::vector<server_pool::server> servers;
 
     std::shared_ptr<federated_tls_auth::castore_file> castore_file;
 };
@@ -0,0 +1,88 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "server_pool.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// How much a new latency sample counts in the smoothed latency
+const double SMOOTHING = 0.2;
+
+// Latency (seconds) to assume for a server before we've measured it
+const double DEFAULT_LATENCY = 0.001;
+
+}
+
+server_pool::server_pool(const std::vector<server>& s, clock::duration u)
+    : unreachable_time(u) {
+    for (const auto& info : s) {
+        state st;
+        st.info = info;
+        servers.push_back(st);
+    }
+}
+
+std::optional<size_t> server_pool::pick(clock::time_point now) const {
+    // Servers we haven't measured yet are assumed to be as fast as
+    // the fastest one, so they get requests and we learn their latency
+    std::optional<double> fastest;
+    for (const auto& s : servers) {
+        if (s.smoothed_latency) {
+            fastest = std::min(fastest.value_or(*s.smoothed_latency), *s.smoothed_latency);
+        }
+    }
+
+    std::optional<size_t> best;
+    double best_wait = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        const auto& s = servers[i];
+        if (now < s.unreachable_until) {
+            continue;
+        }
+        double latency = s.smoothed_latency.value_or(fastest.value_or(DEFAULT_LATENCY));
+        double wait = (s.in_flight + 1) * std::max(latency, DEFAULT_LATENCY);
+        if (!best || wait < best_wait) {
+            best = i;
+            best_wait = wait;
+        }
+    }
+    return best;
+}
+
+void server_pool::request_started(size_t i) {
+    servers[i].in_flight++;
+}
+
+void server_pool::request_completed(size_t i, clock::duration latency) {
+    auto& s = servers[i];
+    s.in_flight = std::max(s.in_flight - 1, 0);
+    s.requests++;
+
+    double seconds = std::chrono::duration<double>(latency).count();
+    s.smoothed_latency = s.smoothed_latency ? (1 - SMOOTHING) * *s.smoothed_latency + SMOOTHING * seconds : seconds;
+}
+
+void server_pool::unreachable(size_t i, clock::time_point now) {
+    auto& s = servers[i];
+    s.in_flight = std::max(s.in_flight - 1, 0);
+    s.unreachable++;
+    s.unreachable_until = now + unreachable_time;
+}
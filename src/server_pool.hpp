@@ -0,0 +1,111 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_SERVER_POOL_HPP
+#define EGILSCIM_SERVER_POOL_HPP
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Decides which of several servers for the same SCIM service (for
+ * instance the servers with matching tags in the federation metadata)
+ * a request should be sent to.
+ *
+ * A request goes to the server where we expect it to be done the
+ * soonest, which is the server's smoothed latency times the number of
+ * requests in flight to it (including the new one). A server we
+ * couldn't reach isn't used for a while, after that we try it again.
+ */
+class server_pool {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct server {
+        /// The base URL, for instance https://node1.example.com/scim/v2
+        std::string url;
+
+        /// Pinned public keys in the format expected by CURLOPT_PINNEDPUBLICKEY
+        std::string pinned_public_keys;
+    };
+
+    /** An empty pool, requests are sent to the configured server. */
+    server_pool() = default;
+
+    /**
+     * 'unreachable_time' is how long we wait before we try
+     * a server again after failing to reach it.
+     */
+    server_pool(const std::vector<server>& servers, clock::duration unreachable_time);
+
+    size_t size() const {
+        return servers.size();
+    }
+
+    const server& get(size_t i) const {
+        return servers[i].info;
+    }
+
+    /**
+     * Returns the server the next request should go to, or nothing if
+     * none of the servers are reachable at the moment.
+     */
+    std::optional<size_t> pick(clock::time_point now) const;
+
+    /** Called when a request is started. */
+    void request_started(size_t i);
+
+    /** Called when a request to server i has completed (with or without a response). */
+    void request_completed(size_t i, clock::duration latency);
+
+    /** Called when a request couldn't reach server i. */
+    void unreachable(size_t i, clock::time_point now);
+
+    /** Number of completed requests to server i */
+    int get_requests(size_t i) const {
+        return servers[i].requests;
+    }
+
+    /** The smoothed latency for server i (seconds), if we've had a request */
+    std::optional<double> get_latency(size_t i) const {
+        return servers[i].smoothed_latency;
+    }
+
+    /** Number of times we couldn't reach server i */
+    int get_unreachable(size_t i) const {
+        return servers[i].unreachable;
+    }
+
+private:
+    struct state {
+        server info;
+        int in_flight = 0;
+        std::optional<double> smoothed_latency;
+        clock::time_point unreachable_until;
+        int requests = 0;
+        int unreachable = 0;
+    };
+
+    std::vector<state> servers;
+    clock::duration unreachable_time;
+};
+
+#endif // EGILSCIM_SERVER_POOL_HPP
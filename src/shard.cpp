@@ -0,0 +1,70 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "shard.hpp"
+
+#include <cctype>
+#include <stdexcept>
+
+shard::shard(int i, int n)
+        : index(i), count(n) {
+    if (n < 1 || i < 1 || i > n) {
+        throw std::runtime_error("bad shard " + std::to_string(i) + "/" + std::to_string(n) +
+                                 " (should be i/N where i is between 1 and N)");
+    }
+}
+
+shard shard::parse(const std::string& s) {
+    auto slash = s.find('/');
+    auto is_number = [](const std::string& n) {
+        return !n.empty() && n.size() < 7 &&
+            n.find_first_not_of("0123456789") == std::string::npos;
+    };
+
+    if (slash == std::string::npos ||
+        !is_number(s.substr(0, slash)) ||
+        !is_number(s.substr(slash + 1))) {
+        throw std::runtime_error("bad shard \"" + s + "\" (should be i/N, e.g. 2/4)");
+    }
+    return shard(std::stoi(s.substr(0, slash)), std::stoi(s.substr(slash + 1)));
+}
+
+bool shard::contains(const std::string& uuid) const {
+    return all() || hash(uuid) % count == static_cast<uint64_t>(index - 1);
+}
+
+int shard::share(int total) const {
+    return (total + count - 1) / count;
+}
+
+std::string shard::file_suffix() const {
+    if (all()) {
+        return "";
+    }
+    return ".shard-" + std::to_string(index) + "-of-" + std::to_string(count);
+}
+
+uint64_t shard::hash(const std::string& uuid) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (char c : uuid) {
+        h ^= static_cast<uint8_t>(tolower(static_cast<unsigned char>(c)));
+        h *= 0x100000001b3;
+    }
+    return h;
+}
@@ -0,0 +1,84 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_SHARD_HPP
+#define EGILSCIM_SHARD_HPP
+
+#include <cstdint>
+#include <string>
+
+/**
+ * One of several parts of the objects, so that several processes (or
+ * machines) can sync with the same configuration in parallel, each
+ * taking care of the objects in its own shard (see --shard).
+ *
+ * Which shard an object belongs to is decided by a hash of its UUID,
+ * which is the same for all processes and doesn't depend on the
+ * platform. A default constructed shard contains all objects.
+ */
+class shard {
+public:
+    shard() = default;
+
+    /** Shard 'index' (counting from 1) of 'count' */
+    shard(int index, int count);
+
+    /**
+     * Parses a shard written as "i/N" (e.g. "2/4").
+     * Throws std::runtime_error if it isn't valid.
+     */
+    static shard parse(const std::string& s);
+
+    /** Is the object with the given UUID in this shard? */
+    bool contains(const std::string& uuid) const;
+
+    /** Is this all objects (i.e. no sharding)? */
+    bool all() const {
+        return count == 1;
+    }
+
+    /**
+     * This shard's share of a limit for all shards (like a threshold),
+     * rounded up.
+     */
+    int share(int total) const;
+
+    /**
+     * Added to file names (like the cache file) which should be different
+     * for each shard, e.g. ".shard-2-of-4" (empty if there's no sharding).
+     */
+    std::string file_suffix() const;
+
+    int get_index() const {
+        return index;
+    }
+
+    int get_count() const {
+        return count;
+    }
+
+    /** The hash which decides which shard a UUID is in (64 bit FNV-1a, case insensitive) */
+    static uint64_t hash(const std::string& uuid);
+
+private:
+    int index = 1;
+    int count = 1;
+};
+
+#endif // EGILSCIM_SHARD_HPP
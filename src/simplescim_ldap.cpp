@@ -19,8 +19,11 @@
 
 #include "simplescim_ldap.hpp"
 
+#include <ctime>
+#include <functional>
 #include <set>
 #include "config.hpp"
+#include "config_file.hpp"
 #include "utility/simplescim_error_string.hpp"
 #include "model/base_object.hpp"
 #include "model/object_list.hpp"
@@ -37,22 +40,19 @@ store_relation(base_object &generated_object,
                const std::pair<std::string, std::string> &master_id);
 
 /**
- * Construct the object list from the LDAP response.
- * On success, a pointer to the constructed list is
- * returned. On error, nullptr is returned and
- * simplescim_error_string is set to an appropriate
- * error message.
+ * Constructs the object list from entries (as they come from LDAP),
+ * 'next_entry' returns the entries one at a time and then nullptr.
  */
-std::shared_ptr<object_list> ldap_to_object_list(ldap_wrapper& ldap,
-                                                 const std::string& type,
-                                                 std::shared_ptr<transformer> transform,
-                                                 std::shared_ptr<load_limiter> limiter,
-                                                 indented_logger& load_logger) {
+std::shared_ptr<object_list> entries_to_object_list(const std::function<std::shared_ptr<base_object>()>& next_entry,
+                                                    const std::string& type,
+                                                    std::shared_ptr<transformer> transform,
+                                                    std::shared_ptr<load_limiter> limiter,
+                                                    indented_logger& load_logger) {
   std::shared_ptr<object_list> objects;
   std::string uid;
 
   objects = std::make_shared<object_list>();
-  std::shared_ptr<base_object> obj = ldap.first_object();
+  std::shared_ptr<base_object> obj = next_entry();
   {
       indented_logger::indenter indenter(load_logger);
       while (obj != nullptr) {
@@ -71,12 +71,147 @@ std::shared_ptr<object_list> ldap_to_object_list(ldap_wrapper& ldap,
               }
           }
 
-          obj = ldap.next_object();
+          obj = next_entry();
       }
   }
   load_related(type, objects, load_logger);
   return objects;
-}  
+}
+
+/**
+ * Construct the object list from the LDAP response.
+ * On success, a pointer to the constructed list is
+ * returned. On error, nullptr is returned and
+ * simplescim_error_string is set to an appropriate
+ * error message.
+ */
+std::shared_ptr<object_list> ldap_to_object_list(ldap_wrapper& ldap,
+                                                 const std::string& type,
+                                                 std::shared_ptr<transformer> transform,
+                                                 std::shared_ptr<load_limiter> limiter,
+                                                 indented_logger& load_logger) {
+  bool first = true;
+  auto next_entry = [&]() {
+      if (first) {
+          first = false;
+          return ldap.first_object();
+      }
+      return ldap.next_object();
+  };
+  return entries_to_object_list(next_entry, type, transform, limiter, load_logger);
+}
+
+namespace {
+
+/**
+ * Describes everything which affects which entries we get from LDAP for
+ * a type, and what they look like. If this changes, the entries saved
+ * from the last run can't be used.
+ */
+std::string search_description(const std::string& type) {
+    const config_file& config = config_file::instance();
+    std::string description;
+    for (const auto& variable : { std::string("ldap-uri"), std::string("ldap-base"),
+                                  std::string("ldap-scope"), type + "-ldap-filter",
+                                  std::string("ldap-UUID"), std::string("ldap-MS-UUID"),
+                                  type + "-unique-identifier", std::string("all-scim-variables") }) {
+        description += config.get(variable, true) + "\n";
+    }
+    return description + config::ldap_incremental_attribute();
+}
+
+/**
+ * Loads a type from LDAP, but only asks for the entries which have changed
+ * since the last run. They are merged with the entries saved from the last
+ * run and the result is loaded as if all entries came from LDAP.
+ *
+ * Entries which are deleted from LDAP can't be found this way, so every
+ * ldap-full-load-interval hours we ask for all entries instead.
+ */
+std::shared_ptr<object_list> ldap_get_incremental(ldap_wrapper &ldap,
+                                                  const std::string &type,
+                                                  indented_logger& load_logger) {
+    auto& snapshot = data_server::instance().get_ldap_snapshot().get(type);
+    auto attribute = config::ldap_incremental_attribute();
+    auto search = search_description(type);
+    int64_t now = time(nullptr);
+    int64_t full_load_interval = int64_t(config::ldap_full_load_interval()) * 3600;
+
+    bool full_load = snapshot.search != search ||
+        snapshot.watermark.empty() ||
+        now - snapshot.last_full_load >= full_load_interval ||
+        now < snapshot.last_full_load;
+
+    std::string watermark;
+    if (full_load) {
+        if (!ldap.search(type, load_logger)) {
+            return nullptr;
+        }
+        snapshot = ldap_snapshot::type_snapshot();
+        snapshot.search = search;
+        snapshot.last_full_load = now;
+    }
+    else {
+        watermark = snapshot.watermark;
+        auto changed = ldap_snapshot::changed_since(attribute, watermark);
+
+        // Entries which have changed so they no longer match the type's filter
+        if (!ldap.search_with_condition(type, load_logger, changed, false)) {
+            return nullptr;
+        }
+        auto uid_attribute = base_object::uid_attribute(type);
+        size_t removed = 0;
+        for (auto entry = ldap.first_object(); entry != nullptr; entry = ldap.next_object()) {
+            for (const auto& value : entry->get_values(attribute)) {
+                watermark = ldap_snapshot::highest(watermark, value);
+            }
+            if (entry->has_attribute(uid_attribute)) {
+                removed += snapshot.entries.erase(entry->get_uid());
+            }
+        }
+        if (removed > 0) {
+            load_logger.log(std::to_string(removed) + " entries no longer match the filter");
+        }
+
+        if (!ldap.search_with_condition(type, load_logger, changed)) {
+            return nullptr;
+        }
+    }
+
+    size_t found = 0;
+    for (auto entry = ldap.first_object(); entry != nullptr; entry = ldap.next_object()) {
+        for (const auto& value : entry->get_values(attribute)) {
+            watermark = ldap_snapshot::highest(watermark, value);
+        }
+        auto uid = entry->get_uid();
+        if (!uid.empty()) {
+            snapshot.entries[uid] = entry;
+            ++found;
+        }
+    }
+    snapshot.watermark = watermark;
+
+    if (full_load) {
+        load_logger.log("Full load, found " + std::to_string(found) + " entries");
+    }
+    else {
+        load_logger.log("Found " + std::to_string(found) + " changed entries, " +
+                        std::to_string(snapshot.entries.size()) + " entries in total");
+    }
+
+    // The saved entries are loaded as copies, since transforms and
+    // relations modify the objects
+    auto itr = snapshot.entries.begin();
+    auto next_entry = [&]() -> std::shared_ptr<base_object> {
+        if (itr == snapshot.entries.end()) {
+            return nullptr;
+        }
+        return std::make_shared<base_object>(*(itr++)->second);
+    };
+    return entries_to_object_list(next_entry, type, get_transformer(type), get_limiter(type), load_logger);
+}
+
+} // namespace
 
 /**
  * Reads user data from LDAP into a user list object
@@ -92,6 +227,10 @@ std::shared_ptr<object_list> ldap_get(ldap_wrapper &ldap,
     load_logger.log(std::string("Loading entries for type ") + type + " from LDAP");
     indented_logger::indenter indenter(load_logger);
     
+    if (!config::ldap_incremental_file().empty()) {
+        return ldap_get_incremental(ldap, type, load_logger);
+    }
+
     std::shared_ptr<object_list> objects;
     if (ldap.search(type, load_logger)) {
         auto transform = get_transformer(type);        
@@ -23,11 +23,20 @@
 #include <string.h>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <thread>
+#include <deque>
+#include <set>
 #include <boost/property_tree/json_parser.hpp>
 
 #include "utility/simplescim_error_string.hpp"
 #include "config_file.hpp"
 #include "config.hpp"
+#include "tls_session_cache.hpp"
+#include "http_retry.hpp"
+#include "utility/gzip.hpp"
+#include "scim_query.hpp"
 #include "EgilSCIM_config.h"
 
 namespace pt = boost::property_tree;
@@ -37,9 +46,52 @@ std::string simplescim_scim_send_key;
 std::string simplescim_scim_send_pinnedpubkey;
 std::string simplescim_scim_send_ca_bundle_path;
 
-static char simplescim_scim_send_errbuf[CURL_ERROR_SIZE];
+/**
+ * An HTTP request which has been handed over to curl.
+ * The request owns everything curl needs to have access to
+ * until the request has completed.
+ */
+struct scim_sender::request {
+    CURL *curl = nullptr;
+    curl_slist *chunk = nullptr;
+    std::string url;
+    std::string resource;
+    std::string method;
+
+    /// The resource compressed with gzip, if we send it compressed
+    std::string compressed_resource;
+
+    std::string http_response;
+    char errbuf[CURL_ERROR_SIZE] = "";
+    std::string user_agent;
+    completion_callback done;
+
+    /// If false the response body is thrown away as it arrives, see send_async()
+    bool keep_body = true;
+
+    /// Whether the TLS connection resumed a session (if we could tell)
+    std::optional<bool> tls_resumed;
+
+    /// The endpoint the request is for, see endpoint_of()
+    std::string endpoint;
 
-static void simplescim_scim_send_print_curl_error(const char *function, CURLcode errnum) {
+    /// The Retry-After header from the response (if any)
+    std::string retry_after;
+
+    /// What to retry if the request fails temporarily, see send_async()
+    std::vector<scim_sender::operation> operations;
+
+    /// The URL we actually send to, which is on another server than url if we use several
+    std::string target_url;
+
+    /// The pinned public keys for the server we send to
+    std::string pinned_public_keys;
+
+    /// The server we send to, if we use several (see scim_sender::use_servers)
+    std::optional<size_t> server;
+};
+
+static void simplescim_scim_send_print_curl_error(char *errbuf, const char *function, CURLcode errnum) {
     size_t len;
 
     /* Set prefix */
@@ -48,36 +100,63 @@ static void simplescim_scim_send_print_curl_error(const char *function, CURLcode
 
     /* Set message */
 
-    len = strlen(simplescim_scim_send_errbuf);
+    len = strlen(errbuf);
 
     if (len == 0) {
         simplescim_error_string_set_message("%s", curl_easy_strerror(errnum));
     } else {
-        if (simplescim_scim_send_errbuf[len - 1] == '\n') {
-            simplescim_scim_send_errbuf[len - 1] = '\0';
+        if (errbuf[len - 1] == '\n') {
+            errbuf[len - 1] = '\0';
         }
 
-        simplescim_error_string_set_message("%s", simplescim_scim_send_errbuf);
+        simplescim_error_string_set_message("%s", errbuf);
     }
 }
 
 static size_t simplescim_scim_send_write_func(void *ptr, size_t size, size_t nmemb, void *userdata) {
-    std::vector<char> *http_response = static_cast<std::vector<char>*>(userdata);
+    auto r = static_cast<scim_sender::request*>(userdata);
     size_t len = size * nmemb;
 
-    for (size_t i = 0; i < len; ++i) {
-        char c = ((char *) ptr)[i];
+    if (!r->keep_body) {
+        return len;
+    }
 
-        if (c == '\r') {
-            continue;
+    if (r->http_response.empty()) {
+        // Make room for the whole body at once if the server told us how big it is
+        curl_off_t content_length = -1;
+        if (curl_easy_getinfo(r->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length) == CURLE_OK &&
+            content_length > 0) {
+            r->http_response.reserve(static_cast<size_t>(content_length));
         }
-
-        http_response->push_back(c);
     }
 
+    r->http_response.append(static_cast<const char*>(ptr), len);
     return len;
 }
 
+static size_t simplescim_scim_send_header_func(char *buffer, size_t size, size_t nitems, void *userdata) {
+    auto r = static_cast<scim_sender::request*>(userdata);
+    size_t len = size * nitems;
+    std::string header(buffer, len);
+
+    const std::string name = "retry-after:";
+    if (header.size() > name.size() &&
+        std::equal(name.begin(), name.end(), header.begin(),
+                   [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); })) {
+        auto value = header.substr(name.size());
+        auto first = value.find_first_not_of(" \t");
+        auto last = value.find_last_not_of(" \t\r\n");
+        r->retry_after = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+    }
+    return len;
+}
+
+static int simplescim_scim_send_prereq_func(void *clientp, char *, char *, int, int) {
+    auto r = static_cast<scim_sender::request*>(clientp);
+    r->tls_resumed = tls_session_cache::handshake_resumed(r->curl);
+    return CURL_PREREQFUNC_OK;
+}
+
 static std::string http_header(const std::string& header, const std::string& value) {
     return header + ": " + value;
 }
@@ -104,6 +183,22 @@ static long to_curl_ssl_version(const std::string& min_tls_version) {
     }
 }
 
+// Converts a CURLINFO_HTTP_VERSION value to a name suitable for the status file.
+static std::string to_http_version_name(long version) {
+    switch (version) {
+    case CURL_HTTP_VERSION_1_0:
+        return "HTTP/1.0";
+    case CURL_HTTP_VERSION_1_1:
+        return "HTTP/1.1";
+    case CURL_HTTP_VERSION_2_0:
+        return "HTTP/2";
+    case CURL_HTTP_VERSION_3:
+        return "HTTP/3";
+    default:
+        return "unknown";
+    }
+}
+
 // Build User-Agent header from compiled version and optional comment from config
 static std::string build_user_agent() {
     std::string ua = std::string("EgilSCIM/") +
@@ -118,7 +213,7 @@ static std::string build_user_agent() {
     return ua;
 }
 
-static struct curl_slist *simplescim_scim_send_create_slist(const std::string &method) {
+static struct curl_slist *simplescim_scim_send_create_slist(const std::string &method, bool compressed) {
     std::vector<std::string> headers;
 
     std::string media_type = config_file::instance().get("scim-media-type", true);
@@ -133,9 +228,12 @@ static struct curl_slist *simplescim_scim_send_create_slist(const std::string &m
         headers.push_back(http_header(api_key_header, api_key_value));
     }
 
-    if ((method == "POST") || (method == "PUT")) {
+    if ((method == "POST") || (method == "PUT") || (method == "PATCH")) {
         headers.push_back(http_header("Accept", media_type));
         headers.push_back(http_header("Content-Type", media_type));
+        if (compressed) {
+            headers.push_back(http_header("Content-Encoding", "gzip"));
+        }
     }
     else if (method == "DELETE") {
         headers.push_back("Accept:");
@@ -163,33 +261,39 @@ static struct curl_slist *simplescim_scim_send_create_slist(const std::string &m
     return chunk;
 }
 
-static int simplescim_scim_send(CURL* curl,
-                                const std::string &url, const std::string &resource,
-                                const std::string &method, std::string& body, long *response_code,
-                                std::ofstream& http_log,
-                                int connection_timeout,
-                                int request_timeout,
-                                bool& timedout,
-                                bool& permanent_failure) {
-
+/**
+ * Prepares a curl easy handle for a request. The handle is
+ * added to the multi handle by the caller.
+ *
+ * On success, zero is returned. On error, -1 is returned
+ * and simplescim_error_string is set to an appropriate
+ * error message.
+ */
+static int simplescim_scim_send_setup(scim_sender::request &r,
+                                      int connection_timeout,
+                                      int request_timeout) {
+    CURL *curl = r.curl;
     CURLcode errnum;
-    curl_slist *chunk;
-    std::vector<char> http_response;
-    long http_code;
 
-    body = "";
-    timedout = false;
-    permanent_failure = false;
-    
     /* Enable more elaborate error messages */
 
-    errnum = curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, simplescim_scim_send_errbuf);
+    errnum = curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, r.errbuf);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_ERRORBUFFER)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_ERRORBUFFER)", errnum);
         return -1;
     }
 
+    curl_easy_setopt(curl, CURLOPT_SSLVERSION,
+                     to_curl_ssl_version(config_file::instance().get("min-tls-version", true)));
+
+    auto cipher_list(config_file::instance().get("tls-cipher-list", true));
+
+    if (cipher_list != "") {
+        curl_easy_setopt(curl, CURLOPT_SSL_CIPHER_LIST,
+                         cipher_list.c_str());
+    }
+
     bool auth = !config_file::instance().get_bool("scim-auth-WEAK");
     /* host verification */
     if (auth) {
@@ -201,14 +305,14 @@ static int simplescim_scim_send(CURL* curl,
 
     // CURLE_BAD_FUNCTION_ARGUMENT is returned when setting CURLOPT_SSL_VERIFYHOST 1, odd IMHO
     if (errnum != CURLE_OK && errnum != CURLE_BAD_FUNCTION_ARGUMENT) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_SSL_VERIFYHOST)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_SSL_VERIFYHOST)", errnum);
         return -1;
     }
 
     /* Set certificate */
     errnum = curl_easy_setopt(curl, CURLOPT_SSLCERT, simplescim_scim_send_cert.c_str());
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_SSLCERT)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_SSLCERT)", errnum);
         return -1;
     }
 
@@ -217,7 +321,7 @@ static int simplescim_scim_send(CURL* curl,
     errnum = curl_easy_setopt(curl, CURLOPT_SSLKEY, simplescim_scim_send_key.c_str());
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_SSLKEY)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_SSLKEY)", errnum);
         return -1;
     }
 
@@ -226,17 +330,17 @@ static int simplescim_scim_send(CURL* curl,
         errnum = curl_easy_setopt(curl, CURLOPT_CAINFO, simplescim_scim_send_ca_bundle_path.c_str());
 
         if (errnum != CURLE_OK) {
-            simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_CAINFO)", errnum);
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_CAINFO)", errnum);
             return -1;
         }
     }
 
     if (auth) {
         /* Set pinned public key */
-        errnum = curl_easy_setopt(curl, CURLOPT_PINNEDPUBLICKEY, simplescim_scim_send_pinnedpubkey.c_str());
+        errnum = curl_easy_setopt(curl, CURLOPT_PINNEDPUBLICKEY, r.pinned_public_keys.c_str());
         
         if (errnum != CURLE_OK) {
-            simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_PINNEDPUBLICKEY)", errnum);
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_PINNEDPUBLICKEY)", errnum);
             return -1;
         }
     }
@@ -245,77 +349,96 @@ static int simplescim_scim_send(CURL* curl,
     errnum = curl_easy_setopt(curl, CURLOPT_VERBOSE, verbose_curl);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_VERBOSE)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_VERBOSE)", errnum);
         return -1;
     }
 
     errnum = curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connection_timeout);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_CONNECTTIMEOUT)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_CONNECTTIMEOUT)", errnum);
         return -1;
     }
 
     errnum = curl_easy_setopt(curl, CURLOPT_TIMEOUT, request_timeout);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_TIMEOUT)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_TIMEOUT)", errnum);
         return -1;
     }
 
     /* Set HTTP method */
 
-    errnum = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    errnum = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, r.method.c_str());
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_CUSTOMREQUEST)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_CUSTOMREQUEST)", errnum);
         return -1;
     }
 
     /* Set URL */
 
-    errnum = curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    errnum = curl_easy_setopt(curl, CURLOPT_URL, r.target_url.c_str());
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_URL)", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_URL)", errnum);
         return -1;
     }
 
     /* Set SCIM resource */
 
-    if (!resource.empty()) {
-        errnum = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, resource.c_str());
+    if (!r.resource.empty()) {
+        const auto& body = r.compressed_resource.empty() ? r.resource : r.compressed_resource;
+
+        errnum = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size()));
 
         if (errnum != CURLE_OK) {
-            simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_POSTFIELDS)", errnum);
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_POSTFIELDSIZE_LARGE)", errnum);
+            return -1;
+        }
+
+        errnum = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+
+        if (errnum != CURLE_OK) {
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_POSTFIELDS)", errnum);
+            return -1;
+        }
+    }
+
+    /* Let the server compress what it sends us when we fetch resources */
+
+    if (r.method == "GET") {
+        errnum = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+        if (errnum != CURLE_OK) {
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_ACCEPT_ENCODING)", errnum);
             return -1;
         }
     }
 
     /* Set empty body for DELETE operations */
     
-    if (method == "DELETE") {
+    if (r.method == "DELETE") {
         errnum = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
 
         if (errnum != CURLE_OK) {
-            simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_POSTFIELDS)", errnum);
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_POSTFIELDS)", errnum);
             return -1;
         }        
     }
 
     /* Set HTTP headers for SCIM */
 
-    chunk = simplescim_scim_send_create_slist(method);
+    r.chunk = simplescim_scim_send_create_slist(r.method, !r.compressed_resource.empty());
 
-    if (chunk == nullptr) {
+    if (r.chunk == nullptr) {
         return -1;
     }
 
-    errnum = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+    errnum = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, r.chunk);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_HTTPHEADER)", errnum);
-        curl_slist_free_all(chunk);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_HTTPHEADER)", errnum);
         return -1;
     }
 
@@ -324,39 +447,114 @@ static int simplescim_scim_send(CURL* curl,
     errnum = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, simplescim_scim_send_write_func);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_WRITEFUNCTION)", errnum);
-        curl_slist_free_all(chunk);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_WRITEFUNCTION)", errnum);
         return -1;
     }
 
     /* Set data pointer */
 
-    errnum = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &http_response);
+    errnum = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &r);
+
+    if (errnum != CURLE_OK) {
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_WRITEDATA)", errnum);
+        return -1;
+    }
+
+    /* Look for Retry-After in the response headers */
+
+    errnum = curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, simplescim_scim_send_header_func);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_WRITEDATA)", errnum);
-        curl_slist_free_all(chunk);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_HEADERFUNCTION)", errnum);
+        return -1;
+    }
+
+    errnum = curl_easy_setopt(curl, CURLOPT_HEADERDATA, &r);
+
+    if (errnum != CURLE_OK) {
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_HEADERDATA)", errnum);
         return -1;
     }
 
     /* Set User-Agent */
-    auto user_agent = build_user_agent();
-    errnum = curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.c_str());
+    r.user_agent = build_user_agent();
+    errnum = curl_easy_setopt(curl, CURLOPT_USERAGENT, r.user_agent.c_str());
+
+    if (errnum != CURLE_OK) {
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_USERAGENT)", errnum);
+        return -1;
+    }
+
+    if (config::http2_multiplexing()) {
+        /* Ask for HTTP/2 and wait for an existing connection rather than opening a new one */
+
+        errnum = curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+
+        if (errnum != CURLE_OK) {
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_HTTP_VERSION)", errnum);
+            return -1;
+        }
+
+        errnum = curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+        if (errnum != CURLE_OK) {
+            simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_PIPEWAIT)", errnum);
+            return -1;
+        }
+    }
+
+    /* Find out whether the TLS handshake resumed a session, the connection
+     * must still be in use when we ask so we do it before the request is sent */
+
+    errnum = curl_easy_setopt(curl, CURLOPT_PREREQFUNCTION, simplescim_scim_send_prereq_func);
+
+    if (errnum != CURLE_OK) {
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_PREREQFUNCTION)", errnum);
+        return -1;
+    }
+
+    errnum = curl_easy_setopt(curl, CURLOPT_PREREQDATA, &r);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_setopt(CURLOPT_USERAGENT)", errnum);
-        curl_slist_free_all(chunk);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_PREREQDATA)", errnum);
         return -1;
     }
 
-    /* Perform request */
+    /* Remember which request the handle belongs to */
 
-    errnum = curl_easy_perform(curl);
+    errnum = curl_easy_setopt(curl, CURLOPT_PRIVATE, &r);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_perform", errnum);
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_setopt(CURLOPT_PRIVATE)", errnum);
+        return -1;
+    }
 
-        curl_slist_free_all(chunk);
+    return 0;
+}
+
+/**
+ * Interprets the result of a request which curl has finished.
+ *
+ * On success, zero is returned and response_code and
+ * http_version_name are set (the body is in r.http_response).
+ * On error, -1 is returned, r.http_response is emptied and
+ * simplescim_error_string is set to an appropriate error message.
+ */
+static int simplescim_scim_send_finish(scim_sender::request &r,
+                                       CURLcode errnum,
+                                       long *response_code,
+                                       std::string& http_version_name,
+                                       std::ostream& http_log,
+                                       bool& timedout,
+                                       bool& permanent_failure) {
+    long http_code;
+
+    timedout = false;
+    permanent_failure = false;
+
+    if (errnum != CURLE_OK) {
+        r.http_response.clear();
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_perform", errnum);
 
         if (errnum == CURLE_OPERATION_TIMEDOUT) {
             timedout = true;
@@ -371,15 +569,11 @@ static int simplescim_scim_send(CURL* curl,
         return -1;
     }
 
-    if (http_response.size() > 0) {
-        body = std::string(http_response.begin(), http_response.end());
-    }
-
     if (http_log) {
         http_log << ">>>>>>>>>>\n";
-        http_log << method << " to " << url;
-        if (!resource.empty()) {
-            http_log << " with body:\n" << resource;
+        http_log << r.method << " to " << r.target_url;
+        if (!r.resource.empty()) {
+            http_log << " with body:\n" << r.resource;
         }
         http_log << "\n";
         http_log << ">>>>>>>>>>\n";
@@ -387,34 +581,84 @@ static int simplescim_scim_send(CURL* curl,
     
     /* Get response code */
 
-    errnum = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    errnum = curl_easy_getinfo(r.curl, CURLINFO_RESPONSE_CODE, &http_code);
 
     if (errnum != CURLE_OK) {
-        simplescim_scim_send_print_curl_error("curl_easy_getinfo", errnum);
-
-        curl_slist_free_all(chunk);
+        r.http_response.clear();
+        simplescim_scim_send_print_curl_error(r.errbuf, "curl_easy_getinfo", errnum);
         return -1;
     }
 
-    /* Clean up */
-
     *response_code = http_code;
 
+    long http_version = 0;
+    curl_easy_getinfo(r.curl, CURLINFO_HTTP_VERSION, &http_version);
+    http_version_name = to_http_version_name(http_version);
+
     if (http_log) {
         http_log << "<<<<<<<<<<\n";
         http_log << "Got reply with HTTP code " << http_code;
-        if (!body.empty()) {
-            http_log << " and body:\n" << body;
+        if (!r.http_response.empty()) {
+            http_log << " and body:\n" << r.http_response;
         }
         http_log << "\n";
         http_log << "<<<<<<<<<<\n";       
     }    
 
-    curl_slist_free_all(chunk);
-
     return 0;
 }
 
+/**
+ * Returns the endpoint a request is for, which is the URL without
+ * query and (for requests to a specific resource) without the resource's id.
+ * For instance https://example.com/scim/Users
+ */
+static std::string endpoint_of(const std::string& url, const std::string& method) {
+    auto endpoint = url.substr(0, url.find('?'));
+    if (method == "PUT" || method == "PATCH" || method == "DELETE") {
+        auto slash = endpoint.rfind('/');
+        if (slash != std::string::npos) {
+            endpoint = endpoint.substr(0, slash);
+        }
+    }
+    return endpoint;
+}
+
+/**
+ * Parses a Retry-After header, which is either a number of seconds
+ * or an HTTP date. We won't wait longer than http-max-retry-after.
+ */
+static std::optional<rate_controller::clock::duration> parse_retry_after(const std::string& value) {
+    if (value.empty()) {
+        return std::nullopt;
+    }
+
+    long long seconds;
+    if (std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+        seconds = std::stoll(value.substr(0, 18));
+    }
+    else {
+        time_t date = curl_getdate(value.c_str(), nullptr);
+        if (date == -1) {
+            return std::nullopt;
+        }
+        seconds = date - time(nullptr);
+    }
+
+    seconds = std::clamp(seconds, 0LL, static_cast<long long>(config::http_max_retry_after()));
+    return std::chrono::seconds(seconds);
+}
+
+scim_sender::scim_sender()
+    : multi(nullptr), max_concurrent_requests(1), discard_response_bodies(false),
+      compress_requests(false), uncompressed_request_bytes(0), compressed_request_bytes(0),
+      adaptive_concurrency(false), bulk_payload_size(0),
+      max_retries(0), number_of_retries(0), random_engine(std::random_device{}()), aborted(false) {
+}
+
+scim_sender::~scim_sender() {
+}
+
 /**
  * Initialises simplescim_scim_send.
  *
@@ -424,6 +668,9 @@ static int simplescim_scim_send(CURL* curl,
  * 'pinnedpubkey' must be the sha256 hash of the server's
  * public key in base64 encoding.
  *
+ * 'server_url' is the SCIM server's URL, it's used to tell
+ * whether saved TLS sessions are for this server.
+ *
  * On success, zero is returned. On error, -1 is returned
  * and simplescim_error_string is set to an appropriate
  * error message.
@@ -431,35 +678,34 @@ static int simplescim_scim_send(CURL* curl,
 int scim_sender::send_init(std::string cert,
                            std::string key,
                            std::string pinnedpubkey,
-                           std::string ca_bundle_path) {
-    number_of_timeouts = 0;
+                           std::string ca_bundle_path,
+                           std::string server_url) {
+    circuit_breakers.clear();
+    rate_controllers.clear();
+    servers = server_pool();
     aborted = false;
     CURLcode errnum;
 
     errnum = curl_global_init(CURL_GLOBAL_DEFAULT);
 
     if (errnum != 0) {
-        simplescim_scim_send_print_curl_error("curl_global_init", errnum);
+        simplescim_error_string_set("curl_global_init", curl_easy_strerror(errnum));
         return -1;
     }
 
-    /* Initialise curl session */
+    /* Initialise curl multi session, easy handles are created as needed */
 
-    curl = curl_easy_init();
+    multi = curl_multi_init();
 
-    if (curl == nullptr) {
-        simplescim_error_string_set("curl_easy_init", "curl_easy_init() returned nullptr");
+    if (multi == nullptr) {
+        simplescim_error_string_set("curl_multi_init", "curl_multi_init() returned nullptr");
         return -1;
     }
 
-    curl_easy_setopt(curl, CURLOPT_SSLVERSION,
-                     to_curl_ssl_version(config_file::instance().get("min-tls-version", true)));
-
-    auto cipher_list(config_file::instance().get("tls-cipher-list", true));
-
-    if (cipher_list != "") {
-        curl_easy_setopt(curl, CURLOPT_SSL_CIPHER_LIST,
-                         cipher_list.c_str());
+    if (config::http2_multiplexing()) {
+        // One connection to the server, with the concurrent requests as streams within it
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
     }
 
     simplescim_scim_send_cert = cert;
@@ -467,6 +713,25 @@ int scim_sender::send_init(std::string cert,
     simplescim_scim_send_pinnedpubkey = pinnedpubkey;
     simplescim_scim_send_ca_bundle_path = ca_bundle_path;
 
+    adaptive_concurrency = config::http_adaptive_concurrency();
+    max_retries = config::http_retries();
+    timings = request_timings(config::status_file_slowest_requests());
+
+    // The statistics are for one run (a daemon initialises for each sync)
+    http_versions.clear();
+    tls_handshakes.clear();
+    uncompressed_request_bytes = 0;
+    compressed_request_bytes = 0;
+    number_of_retries = 0;
+    compress_requests = config::http_compress_requests();
+
+    tls_sessions = std::make_unique<tls_session_cache>();
+    tls_session_file = config::tls_session_cache_file();
+    if (!tls_session_file.empty()) {
+        tls_session_identity = tls_session_cache::make_identity(server_url, pinnedpubkey, cert);
+        tls_sessions->load(tls_session_file, tls_session_identity);
+    }
+
     auto http_log_file = format_log_path(config_file::instance().get_path("http-log-file", true));
     if (http_log_file != "" && !http_log.is_open()) {
         http_log.open(http_log_file, std::ios_base::out | std::ios_base::trunc);
@@ -475,157 +740,890 @@ int scim_sender::send_init(std::string cert,
     return 0;
 }
 
+void scim_sender::use_servers(const std::vector<server_pool::server>& s) {
+    servers = server_pool(s, std::chrono::seconds(config::http_circuit_breaker_cooldown()));
+}
+
 /**
  * Clears simplescim_scim_send and frees any associated
  * dynamically allocated memory.
  */
 void scim_sender::send_clear() {
+    bulk_operations.clear();
+    bulk_queued.clear();
+    bulk_base_url.clear();
+    retries.clear();
+    service_provider_config.reset();
+
+    for (auto& itr : in_flight) {
+        curl_multi_remove_handle(multi, itr.first);
+        curl_slist_free_all(itr.second->chunk);
+        curl_easy_cleanup(itr.first);
+    }
+    in_flight.clear();
+
+    for (auto curl : idle_handles) {
+        curl_easy_cleanup(curl);
+    }
+    idle_handles.clear();
+
+    if (tls_sessions) {
+        if (!tls_session_file.empty() &&
+            !tls_sessions->save(tls_session_file, tls_session_identity)) {
+            std::cerr << "Failed to save TLS sessions to " << tls_session_file << std::endl;
+        }
+        tls_handshakes = tls_sessions->get_handshakes();
+        tls_sessions.reset();
+    }
+
+    if (multi != nullptr) {
+        curl_multi_cleanup(multi);
+        multi = nullptr;
+    }
     curl_global_cleanup();
-    curl_easy_cleanup(curl);
 }
 
-std::optional<std::string>
-scim_sender::send_create(const std::string &url,
-                         const std::string &body,
-                         bool& conflict) {
-    conflict = false;
+void scim_sender::set_max_concurrent_requests(int n, const std::map<std::string, int>& per_endpoint) {
+    max_concurrent_requests = std::max(n, 1);
+    endpoint_max_concurrent_requests = per_endpoint;
 
-    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
-        return {};
+    for (auto& itr : rate_controllers) {
+        itr.second.set_max_limit(max_concurrent_requests_for(itr.first));
     }
-    
-    std::string response_data;
-    long response_code;
-    int err;
-    
-    bool timedout = false;
-    bool permanent_failure = false;
-    err = simplescim_scim_send(curl, url, body, "POST", 
-        response_data, &response_code, 
-        http_log, config::http_connection_timeout(), config::http_request_timeout(), timedout, permanent_failure);
+}
 
-    if (timedout) {
-        register_timeout();
+int scim_sender::max_concurrent_requests_for(const std::string& endpoint) const {
+    auto itr = endpoint_max_concurrent_requests.find(endpoint);
+    if (itr == endpoint_max_concurrent_requests.end()) {
+        return max_concurrent_requests;
     }
+    return std::clamp(itr->second, 1, max_concurrent_requests);
+}
 
-    if (permanent_failure) {
-        set_aborted();
+int scim_sender::in_flight_to(const std::string& endpoint) const {
+    return static_cast<int>(std::count_if(in_flight.begin(), in_flight.end(),
+                                          [&](const auto& itr) { return itr.second->endpoint == endpoint; }));
+}
+
+circuit_breaker& scim_sender::circuit_breaker_for(const std::string& endpoint) {
+    auto itr = circuit_breakers.find(endpoint);
+    if (itr == circuit_breakers.end()) {
+        circuit_breaker breaker(config::http_max_acceptable_timeouts(),
+                                std::chrono::seconds(config::http_circuit_breaker_cooldown()));
+        itr = circuit_breakers.emplace(endpoint, breaker).first;
     }
+    return itr->second;
+}
 
-    if (err == -1) {
-        return {};
+rate_controller& scim_sender::rate_controller_for(const std::string& endpoint) {
+    auto itr = rate_controllers.find(endpoint);
+    if (itr == rate_controllers.end()) {
+        itr = rate_controllers.emplace(endpoint, rate_controller(max_concurrent_requests_for(endpoint))).first;
     }
-    
-    if (response_code != 201 && response_code != 200) {
-        simplescim_error_string_set_prefix("simplescim_scim_send_create");
-        std::string extra;
-        if (response_code == 409) {
-            conflict = true;
-            extra = " (object already exists)";
+    return itr->second;
+}
+
+/**
+ * Starts a request. If we already have the maximum number of requests
+ * in flight we'll first wait for one of them to complete.
+ * 
+ * If the request can't be started, done is called immediately.
+ */
+void scim_sender::send_async(const std::string &url,
+                             const std::string &resource,
+                             const std::string &method,
+                             completion_callback done,
+                             std::vector<operation> operations,
+                             bool keep_body) {
+    auto endpoint = endpoint_of(url, method);
+    rate_controller *controller = adaptive_concurrency ? &rate_controller_for(endpoint) : nullptr;
+
+    while (static_cast<int>(in_flight.size()) >= max_concurrent_requests ||
+           in_flight_to(endpoint) >= max_concurrent_requests_for(endpoint) ||
+           (controller && !controller->may_start(rate_controller::clock::now()))) {
+        if (in_flight.empty()) {
+            if (rate_controller::clock::now() >= controller->get_paused_until()) {
+                // Nothing is in flight, so there's nothing to wait for
+                break;
+            }
+            // The server has asked us to wait before sending more
+            std::this_thread::sleep_until(controller->get_paused_until());
+        }
+        else {
+            run_once(true);
         }
-        simplescim_error_string_set_message("HTTP response code %ld returned%s, expected 201",
-                                            response_code, extra.c_str());
-        return {};
     }
 
-    return response_data;
+    auto r = std::make_unique<request>();
+    r->endpoint = endpoint;
+    r->url = url;
+    r->resource = resource;
+    r->method = method;
+    r->done = done;
+    r->operations = std::move(operations);
+    r->keep_body = keep_body || http_log.is_open();
+
+    if (compress_requests && !r->resource.empty() && method != "GET" && method != "DELETE") {
+        try {
+            auto compressed = gzip_compress(r->resource);
+
+            // Small resources may not get any smaller
+            if (compressed.size() < r->resource.size()) {
+                r->compressed_resource = std::move(compressed);
+            }
+        }
+        catch (const std::runtime_error&) {
+            // We can always send it uncompressed
+        }
+        uncompressed_request_bytes += r->resource.size();
+        compressed_request_bytes += r->compressed_resource.empty() ? r->resource.size() : r->compressed_resource.size();
+    }
+
+    if (!idle_handles.empty()) {
+        r->curl = idle_handles.back();
+        idle_handles.pop_back();
+        curl_easy_reset(r->curl);
+    }
+    else {
+        r->curl = curl_easy_init();
+
+        if (r->curl == nullptr) {
+            simplescim_error_string_set("curl_easy_init", "curl_easy_init() returned nullptr");
+            done(-1, 0, "");
+            return;
+        }
+    }
+
+    if (!start(*r)) {
+        idle_handles.push_back(r->curl);
+        done(-1, 0, "");
+        return;
+    }
+
+    if (controller) {
+        controller->request_started(rate_controller::clock::now());
+    }
+
+    CURL *curl = r->curl;
+    in_flight[curl] = std::move(r);
+
+    // Get the request going without waiting
+    run_once(false);
 }
 
-std::optional<std::string>
-scim_sender::send_update(const std::string &url,
-                         const std::string &body,
-                         bool& non_existent) {
-    non_existent = false;
+bool scim_sender::start(request& r) {
+    r.target_url = r.url;
+    r.pinned_public_keys = simplescim_scim_send_pinnedpubkey;
+    r.server.reset();
+
+    if (servers.size() > 0) {
+        // If none of the servers are reachable we try the first one again
+        auto base = servers.get(0).url;
+        r.server = servers.pick(std::chrono::steady_clock::now()).value_or(0);
+        if (r.url.compare(0, base.size(), base) == 0) {
+            const auto& server = servers.get(*r.server);
+            r.target_url = server.url + r.url.substr(base.size());
+            r.pinned_public_keys = server.pinned_public_keys;
+        }
+        else {
+            r.server.reset();
+        }
+    }
 
-    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
-        return {};
+    if (simplescim_scim_send_setup(r, config::http_connection_timeout(), config::http_request_timeout()) == -1) {
+        curl_slist_free_all(r.chunk);
+        r.chunk = nullptr;
+        return false;
     }
-    
-    std::string response_data;
-    long response_code;
-    int err;
+
+    tls_sessions->attach(r.curl);
+
+    CURLMcode mc = curl_multi_add_handle(multi, r.curl);
+
+    if (mc != CURLM_OK) {
+        simplescim_error_string_set("curl_multi_add_handle", curl_multi_strerror(mc));
+        curl_slist_free_all(r.chunk);
+        r.chunk = nullptr;
+        return false;
+    }
+
+    if (r.server) {
+        servers.request_started(*r.server);
+    }
+    return true;
+}
+
+bool scim_sender::fail_over(std::unique_ptr<request>& r, CURLcode result) {
+    auto now = std::chrono::steady_clock::now();
+    auto server = *r->server;
+
+    curl_off_t connect_time = 0;
+    curl_easy_getinfo(r->curl, CURLINFO_CONNECT_TIME_T, &connect_time);
+
+    // Only if we never got through to the server, otherwise it may have handled the request
+    bool unreachable =
+        result == CURLE_COULDNT_CONNECT || result == CURLE_COULDNT_RESOLVE_HOST ||
+        (result == CURLE_OPERATION_TIMEDOUT && connect_time == 0);
+
+    if (!unreachable) {
+        curl_off_t total_time = 0;
+        curl_easy_getinfo(r->curl, CURLINFO_TOTAL_TIME_T, &total_time);
+        servers.request_completed(server, std::chrono::microseconds(total_time));
+        return false;
+    }
+
+    servers.unreachable(server, now);
+    if (!servers.pick(now)) {
+        return false;
+    }
+
+    std::cout << "Failed to reach " << servers.get(server).url
+              << ", sending to the other servers" << std::endl;
+
+    curl_slist_free_all(r->chunk);
+    r->chunk = nullptr;
+    curl_easy_reset(r->curl);
+    r->http_response.clear();
+    r->retry_after.clear();
+    r->tls_resumed.reset();
+    r->errbuf[0] = '\0';
+
+    if (!start(*r)) {
+        return false;
+    }
+
+    // It's not an error as long as another server can handle it
+    simplescim_error_string_set(nullptr, nullptr);
+
+    CURL *curl = r->curl;
+    in_flight[curl] = std::move(r);
+    return true;
+}
+
+/**
+ * Lets curl make progress on the requests in flight and
+ * handles the requests that have completed.
+ *
+ * If block is true we'll wait for activity if there
+ * was nothing to do right away.
+ */
+void scim_sender::run_once(bool block, int max_wait_ms) {
+    int running = 0;
+    CURLMcode mc = curl_multi_perform(multi, &running);
+
+    if (mc != CURLM_OK) {
+        throw std::runtime_error(std::string("curl_multi_perform failed: ") + curl_multi_strerror(mc));
+    }
+
+    bool completed_any = false;
+    CURLMsg *msg;
+    int msgs_left = 0;
+    while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+        if (msg->msg == CURLMSG_DONE) {
+            complete(msg->easy_handle, msg->data.result);
+            completed_any = true;
+        }
+    }
+
+    if (block && !completed_any && !in_flight.empty()) {
+        mc = curl_multi_poll(multi, nullptr, 0, max_wait_ms, nullptr);
+
+        if (mc != CURLM_OK) {
+            throw std::runtime_error(std::string("curl_multi_poll failed: ") + curl_multi_strerror(mc));
+        }
+    }
+}
+
+void scim_sender::complete(CURL *curl, CURLcode result) {
+    auto itr = in_flight.find(curl);
+    if (itr == in_flight.end()) {
+        return;
+    }
+    std::unique_ptr<request> r = std::move(itr->second);
+    in_flight.erase(itr);
+
+    curl_multi_remove_handle(multi, curl);
+
+    long response_code = 0;
+    std::string http_version;
     bool timedout = false;
     bool permanent_failure = false;
-    err = simplescim_scim_send(curl, url, body, "PUT", 
-        response_data, &response_code, 
-        http_log, config::http_connection_timeout(), config::http_request_timeout(), timedout, permanent_failure);
+    int err = simplescim_scim_send_finish(*r, result, &response_code,
+                                          http_version, http_log, timedout, permanent_failure);
+
+    if (r->server && fail_over(r, result)) {
+        return;
+    }
+
+    if (err == 0) {
+        http_versions[http_version]++;
+    }
+
+    register_timing(*r, response_code);
 
-    if (timedout) {
-        register_timeout();
+    long new_connections = 0;
+    if (r->tls_resumed &&
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connections) == CURLE_OK &&
+        new_connections > 0) {
+        tls_sessions->register_handshake(*r->tls_resumed);
+    }
+
+    if (adaptive_concurrency) {
+        adapt_concurrency(*r, err, response_code, timedout);
+    }
+
+    curl_slist_free_all(r->chunk);
+    r->chunk = nullptr;
+    idle_handles.push_back(curl);
+
+    if (!r->operations.empty()) {
+        update_circuit_breakers(*r, err, response_code, permanent_failure);
     }
 
     if (permanent_failure) {
         set_aborted();
     }
 
-    if (err == -1) {
-        return {};
+    if (err == 0 && response_code == 415 && !r->compressed_resource.empty() && !r->operations.empty()) {
+        // 415 Unsupported Media Type, the server doesn't accept compressed requests.
+        // Send the operations again (uncompressed) together with the retries.
+        if (compress_requests) {
+            compress_requests = false;
+            std::cout << "The SCIM server doesn't accept compressed requests, "
+                      << "sending the rest of the requests uncompressed" << std::endl;
+        }
+        for (auto& op : r->operations) {
+            retries.emplace(std::chrono::steady_clock::now(), std::move(op));
+        }
+        return;
     }
 
-    if (response_code != 200) {
-        simplescim_error_string_set_prefix("simplescim_scim_send_update");
-        simplescim_error_string_set_message("HTTP response code %ld returned, expected %ld", response_code, 200L);
+    if (!r->operations.empty() && !is_aborted() &&
+        (err == -1 ? http_retry::transient_error(result) : http_retry::transient_response(response_code))) {
+        auto retry_after = parse_retry_after(r->retry_after);
+        auto random = retry_jitter();
+        for (auto& op : r->operations) {
+            if (!retry_later(op, retry_after, random)) {
+                op.done(err, response_code, std::string(r->http_response));
+            }
+        }
+        return;
+    }
 
-        if (response_code == 404) {
-            non_existent = true;
+    // The callback may take the body, so it isn't copied
+    r->done(err, response_code, std::move(r->http_response));
+}
+
+/**
+ * Returns the id of the resource a request is for. It's the last part
+ * of the URL for requests to a specific resource, for a create we only
+ * know it if the caller told us.
+ */
+static std::string resource_id_of(const scim_sender::request& r) {
+    if (r.operations.size() == 1 && !r.operations[0].resource_id.empty()) {
+        return r.operations[0].resource_id;
+    }
+    if (r.method != "PUT" && r.method != "PATCH" && r.method != "DELETE") {
+        return "";
+    }
+    auto path = r.url.substr(0, r.url.find('?'));
+    auto last = path.substr(path.rfind('/') + 1);
+    int length = 0;
+    char *unescaped = curl_easy_unescape(r.curl, last.c_str(), static_cast<int>(last.size()), &length);
+    if (unescaped == nullptr) {
+        return last;
+    }
+    std::string id(unescaped, length);
+    curl_free(unescaped);
+    return id;
+}
+
+/**
+ * Adds the request's timing to the request timings. Failed
+ * requests are included, they can be among the slowest.
+ */
+void scim_sender::register_timing(const request& r, long response_code) {
+    request_timings::sample s;
+    s.endpoint = r.endpoint;
+    s.method = r.method;
+    s.url = r.url;
+    s.resource_id = resource_id_of(r);
+    s.response_code = response_code;
+
+    auto get_value = [&r](CURLINFO info) -> uint64_t {
+        curl_off_t value = 0;
+        if (curl_easy_getinfo(r.curl, info, &value) != CURLE_OK || value < 0) {
+            return 0;
         }
-        
-        return {};
+        return static_cast<uint64_t>(value);
+    };
+
+    s.name_lookup = get_value(CURLINFO_NAMELOOKUP_TIME_T);
+    s.connect = get_value(CURLINFO_CONNECT_TIME_T);
+    s.tls_handshake = get_value(CURLINFO_APPCONNECT_TIME_T);
+    s.first_byte = get_value(CURLINFO_STARTTRANSFER_TIME_T);
+    s.total = get_value(CURLINFO_TOTAL_TIME_T);
+    s.request_bytes = get_value(CURLINFO_SIZE_UPLOAD_T);
+    s.response_bytes = get_value(CURLINFO_SIZE_DOWNLOAD_T);
+
+    timings.add(s);
+}
+
+/**
+ * Returns whether a response means the server failed to handle the
+ * request, rather than the request being wrong in some way.
+ */
+static bool server_failure(long response_code) {
+    return response_code >= 500 || response_code == 408;
+}
+
+void scim_sender::update_circuit_breakers(const request& r, int err, long response_code, bool permanent_failure) {
+    auto now = circuit_breaker::clock::now();
+    bool failed = (err == -1 && !permanent_failure) || (err == 0 && server_failure(response_code));
+    bool bulk = r.url != r.operations[0].url;
+
+    if (!failed) {
+        // The operations' statuses in a bulk response are handled in flush_bulk()
+        if (!bulk && err == 0) {
+            circuit_breaker_for(r.endpoint).success();
+        }
+        return;
+    }
+
+    std::set<std::string> endpoints;
+    for (const auto& op : r.operations) {
+        endpoints.insert(endpoint_of(op.url, op.method));
+    }
+
+    for (const auto& endpoint : endpoints) {
+        endpoint_failed(endpoint, now);
+    }
+}
+
+void scim_sender::endpoint_failed(const std::string& endpoint, circuit_breaker::clock::time_point now) {
+    auto& breaker = circuit_breaker_for(endpoint);
+    auto times_opened = breaker.get_times_opened();
+    breaker.failure(now);
+    if (breaker.get_times_opened() > times_opened) {
+        std::cout << "Skipping requests to " << endpoint << " for "
+                  << config::http_circuit_breaker_cooldown()
+                  << " seconds since it has been failing" << std::endl;
     }
-    return response_data;
 }
 
 /**
- * Sends a request to delete a SCIM resource.
- *
- * 'url' must be of the format:
- * <protocol>://<host><endpoint>/<resource-identifier>
- *
- * For example:
- * https://example.com/Users/2819c223-7f76-453a-919d-413861904646
- *
- * On success, zero is returned. This means the server responded
- * with HTTP code 204 (No Content).
- * If we didn't successfully perform an HTTP request, -1 is returned
- * and simplescim_error_string is set to an appropriate
- * error message. This could mean failed to connect or a timeout.
- * If a successful HTTP request was performed but we received a 
- * different response than HTTP 204, we will return the HTTP code
- * (such as 404 Not found).
+ * Lets the endpoint's rate controller know how the request went.
  */
-long scim_sender::send_delete(const std::string &url) {
+void scim_sender::adapt_concurrency(const request& r, int err, long response_code, bool timedout) {
+    auto& controller = rate_controller_for(r.endpoint);
+    auto now = rate_controller::clock::now();
+    bool decreased = false;
+    std::string reason;
+
+    if (err == 0) {
+        curl_off_t total_time = 0;
+        curl_easy_getinfo(r.curl, CURLINFO_TOTAL_TIME_T, &total_time);
+        decreased = controller.response(response_code,
+                                        std::chrono::microseconds(total_time),
+                                        parse_retry_after(r.retry_after),
+                                        now);
+        reason = "HTTP response code " + std::to_string(response_code);
+    }
+    else if (timedout) {
+        decreased = controller.timeout(now);
+        reason = "timeout";
+    }
+    else {
+        controller.failure(now);
+    }
+
+    if (decreased) {
+        std::cout << "Reducing to " << controller.get_limit() << " concurrent requests for "
+                  << r.endpoint << " (" << reason << ")" << std::endl;
+    }
+}
+
+void scim_sender::wait_for_all(const std::function<void()>& more) {
+    flush_bulk();
+
+    while (true) {
+        if (more) {
+            more();
+            flush_bulk();
+        }
+        if (in_flight.empty() && retries.empty()) {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (!retries.empty() && retries.begin()->first <= now) {
+            send_due_retries();
+            flush_bulk();
+        }
+        else if (in_flight.empty()) {
+            std::this_thread::sleep_until(retries.begin()->first);
+        }
+        else {
+            // Don't wait for activity past the time of the next retry
+            auto max_wait = std::chrono::milliseconds(1000);
+            if (!retries.empty()) {
+                max_wait = std::min(max_wait,
+                                    std::chrono::duration_cast<std::chrono::milliseconds>(retries.begin()->first - now) +
+                                    std::chrono::milliseconds(1));
+            }
+            run_once(true, static_cast<int>(max_wait.count()));
+        }
+    }
+}
+
+bool scim_sender::retry_later(operation op,
+                              std::optional<std::chrono::steady_clock::duration> retry_after,
+                              double random) {
+    if (op.retries >= max_retries) {
+        return false;
+    }
+
+    ++op.retries;
+    ++number_of_retries;
+    std::chrono::steady_clock::duration delay = http_retry::backoff(op.retries, random);
+    if (retry_after) {
+        delay = std::max(delay, *retry_after);
+    }
+    retries.emplace(std::chrono::steady_clock::now() + delay, std::move(op));
+    return true;
+}
+
+double scim_sender::retry_jitter() {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random_engine);
+}
+
+void scim_sender::send_due_retries() {
+    // Requests we start here may fail and add new (later) retries to the queue
+    while (!retries.empty() && retries.begin()->first <= std::chrono::steady_clock::now()) {
+        auto op = std::move(retries.begin()->second);
+        retries.erase(retries.begin());
+
+        if (is_aborted()) {
+            simplescim_error_string_set_prefix("scim_sender::send_due_retries");
+            simplescim_error_string_set_message("%s to %s not retried since earlier requests have failed",
+                                                op.method.c_str(), op.url.c_str());
+            op.done(-1, 0, "");
+            continue;
+        }
+
+        send_operation(std::move(op));
+    }
+}
+
+int scim_sender::send_sync(const std::string &url,
+                           const std::string &method,
+                           std::string& response_data,
+                           long *response_code) {
+    int result = -1;
+    bool completed = false;
+
+    send_async(url, "", method,
+               [&](int err, long code, std::string&& body) {
+                   result = err;
+                   *response_code = code;
+                   response_data = std::move(body);
+                   completed = true;
+               });
+
+    while (!completed) {
+        run_once(true);
+    }
+    return result;
+}
+
+void scim_sender::send_operation(const std::string &url,
+                                 const std::string &resource,
+                                 const std::string &method,
+                                 completion_callback done) {
+    send_operation(operation{ url, resource, method, done });
+}
+
+void scim_sender::send_operation(operation op) {
+    auto endpoint = endpoint_of(op.url, op.method);
+    if (!circuit_breaker_for(endpoint).allow(circuit_breaker::clock::now())) {
+        simplescim_error_string_set_prefix("scim_sender::send_operation");
+        simplescim_error_string_set_message("%s to %s skipped since %s has been failing",
+                                            op.method.c_str(), op.url.c_str(), endpoint.c_str());
+        op.done(-1, 0, "");
+        return;
+    }
+
+    auto send_plain = [this](operation op) {
+        auto url = op.url, resource = op.resource, method = op.method;
+        auto done = op.done;
+        send_async(url, resource, method, done, { std::move(op) }, !discard_response_bodies);
+    };
+
+    auto prefix = bulk_base_url + "/";
+    if (bulk_base_url.empty() || op.url.compare(0, prefix.size(), prefix) != 0) {
+        send_plain(std::move(op));
+        return;
+    }
+
+    // The bulkId is the operation's index in the bulk request
+    auto path = op.url.substr(bulk_base_url.size());
+    auto make_operation = [&]() {
+        return scim_bulk::operation_json(op.method, path, op.resource, std::to_string(bulk_operations.size()));
+    };
+    auto json = make_operation();
+
+    // An operation which doesn't fit in a bulk request even on its own
+    // would only get rejected by the server, send it by itself instead
+    if (scim_bulk::request_json({}).size() + json.size() + 1 > bulk_settings.max_payload_size) {
+        send_plain(std::move(op));
+        return;
+    }
+
+    if (!bulk_operations.empty() &&
+        bulk_payload_size + json.size() + 1 > bulk_settings.max_payload_size) {
+        flush_bulk();
+        json = make_operation();
+    }
+
+    if (bulk_operations.empty()) {
+        bulk_payload_size = scim_bulk::request_json({}).size();
+    }
+
+    bulk_payload_size += json.size() + 1;
+    bulk_operations.push_back(json);
+    bulk_queued.push_back(std::move(op));
+
+    if (static_cast<int>(bulk_operations.size()) >= bulk_settings.max_operations) {
+        flush_bulk();
+    }
+}
+
+void scim_sender::flush_bulk() {
+    if (bulk_operations.empty()) {
+        return;
+    }
+
+    auto body = scim_bulk::request_json(bulk_operations);
+    auto operations = std::make_shared<std::vector<operation>>(std::move(bulk_queued));
+    bulk_operations.clear();
+    bulk_queued.clear();
+    bulk_payload_size = 0;
+
+    auto fail_all = [operations]() {
+        for (const auto& op : *operations) {
+            op.done(-1, 0, "");
+        }
+    };
+
     if (is_aborted()) { // Don't actually do the request, return as if there's a failure
-        return -1;
+        fail_all();
+        return;
     }
 
-    long response_code;
+    send_async(bulk_base_url + "/Bulk", body, "POST",
+               [this, operations, fail_all](int err, long response_code, const std::string& response_data) {
+                   if (err == -1) {
+                       fail_all();
+                       return;
+                   }
+
+                   if (response_code != 200) {
+                       simplescim_error_string_set_prefix("scim_sender::flush_bulk");
+                       simplescim_error_string_set_message("HTTP response code %ld returned for bulk request, expected %ld",
+                                                           response_code, 200L);
+                       fail_all();
+                       return;
+                   }
+
+                   std::vector<std::optional<scim_bulk::operation_result>> results;
+                   try {
+                       results = scim_bulk::parse_response(response_data, operations->size());
+                   }
+                   catch (const std::runtime_error& e) {
+                       simplescim_error_string_set_prefix("scim_sender::flush_bulk");
+                       simplescim_error_string_set_message("%s", e.what());
+                       fail_all();
+                       return;
+                   }
+
+                   auto random = retry_jitter();
+                   auto now = circuit_breaker::clock::now();
+                   for (size_t i = 0; i < operations->size(); ++i) {
+                       auto& op = (*operations)[i];
+                       if (results[i]) {
+                           auto endpoint = endpoint_of(op.url, op.method);
+                           if (server_failure(results[i]->status)) {
+                               endpoint_failed(endpoint, now);
+                           }
+                           else {
+                               circuit_breaker_for(endpoint).success();
+                           }
+                       }
+
+                       if (!results[i]) {
+                           simplescim_error_string_set_prefix("scim_sender::flush_bulk");
+                           simplescim_error_string_set_message("no result for the operation in the bulk response");
+                           op.done(-1, 0, "");
+                       }
+                       else if (http_retry::transient_response(results[i]->status) &&
+                                !is_aborted() && retry_later(op, std::nullopt, random)) {
+                           // The server couldn't handle this operation right now, we'll send it again later
+                       }
+                       else {
+                           op.done(0, results[i]->status, std::move(results[i]->response));
+                       }
+                   }
+               },
+               *operations);
+}
+
+static std::string without_trailing_slash(std::string url) {
+    while (!url.empty() && url.back() == '/') {
+        url.pop_back();
+    }
+    return url;
+}
+
+std::string scim_sender::get_service_provider_config(const std::string& base_url) {
+    if (service_provider_config) {
+        return *service_provider_config;
+    }
+
+    auto url = without_trailing_slash(base_url) + "/ServiceProviderConfig";
     std::string response_data;
-    int err;
-    bool timedout = false;
-    bool permanent_failure = false;
-    err = simplescim_scim_send(curl, url, "", "DELETE", 
-        response_data, &response_code, http_log, 
-        config::http_connection_timeout(), config::http_request_timeout(), timedout, permanent_failure);
+    long response_code = 0;
+    if (send_sync(url, "GET", response_data, &response_code) == -1) {
+        throw std::runtime_error(simplescim_error_string_get());
+    }
 
-    if (timedout) {
-        register_timeout();
+    if (response_code != 200) {
+        throw std::runtime_error("Failed to GET " + url + ", HTTP response code " +
+                                 std::to_string(response_code) + " returned, expected 200");
     }
 
-    if (permanent_failure) {
-        set_aborted();
+    service_provider_config = response_data;
+    return response_data;
+}
+
+void scim_sender::enable_bulk(const std::string& base_url, const scim_bulk::settings& settings) {
+    bulk_base_url = without_trailing_slash(base_url);
+    bulk_settings = settings;
+}
+
+void scim_sender::send_create(const std::string &url,
+                              const std::string &body,
+                              create_callback done,
+                              const std::string &resource_id) {
+    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
+        done({}, false);
+        return;
     }
 
-    if (err == -1) {
-        return -1;
+    operation op;
+    op.url = url;
+    op.resource = body;
+    op.method = "POST";
+    op.resource_id = resource_id;
+    op.done = [done](int err, long response_code, const std::string& response_data) {
+                       if (err == -1) {
+                           done({}, false);
+                           return;
+                       }
+
+                       if (response_code != 201 && response_code != 200) {
+                           simplescim_error_string_set_prefix("simplescim_scim_send_create");
+                           std::string extra;
+                           bool conflict = false;
+                           if (response_code == 409) {
+                               conflict = true;
+                               extra = " (object already exists)";
+                           }
+                           simplescim_error_string_set_message("HTTP response code %ld returned%s, expected 201",
+                                                               response_code, extra.c_str());
+                           done({}, conflict);
+                           return;
+                       }
+
+                       done(response_data, false);
+                   };
+    send_operation(std::move(op));
+}
+
+void scim_sender::send_update(const std::string &url,
+                              const std::string &body,
+                              update_callback done) {
+    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
+        done({}, false);
+        return;
     }
 
-    if (response_code != 204) {
-        simplescim_error_string_set_prefix("simplescim_scim_send_delete");
-        simplescim_error_string_set_message("HTTP response code %ld returned, expected %ld", response_code, 204L);
-        return response_code;
+    send_operation(url, body, "PUT",
+                   [done](int err, long response_code, const std::string& response_data) {
+                       if (err == -1) {
+                           done({}, false);
+                           return;
+                       }
+
+                       if (response_code != 200) {
+                           simplescim_error_string_set_prefix("simplescim_scim_send_update");
+                           simplescim_error_string_set_message("HTTP response code %ld returned, expected %ld", response_code, 200L);
+                           done({}, response_code == 404);
+                           return;
+                       }
+
+                       done(response_data, false);
+                   });
+}
+
+void scim_sender::send_patch(const std::string &url,
+                             const std::string &body,
+                             update_callback done) {
+    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
+        done({}, false);
+        return;
     }
 
-    return 0;
+    send_operation(url, body, "PATCH",
+                   [done](int err, long response_code, const std::string& response_data) {
+                       if (err == -1) {
+                           done({}, false);
+                           return;
+                       }
+
+                       if (response_code != 200 && response_code != 204) {
+                           simplescim_error_string_set_prefix("simplescim_scim_send_patch");
+                           simplescim_error_string_set_message("HTTP response code %ld returned, expected 200 or 204", response_code);
+                           done({}, response_code == 404);
+                           return;
+                       }
+
+                       done(response_data, false);
+                   });
+}
+
+void scim_sender::send_delete(const std::string &url, delete_callback done) {
+    if (is_aborted()) { // Don't actually do the request, return as if there's a failure
+        done(-1);
+        return;
+    }
+
+    send_operation(url, "", "DELETE",
+                   [done](int err, long response_code, const std::string&) {
+                       if (err == -1) {
+                           done(-1);
+                           return;
+                       }
+
+                       if (response_code != 204) {
+                           simplescim_error_string_set_prefix("simplescim_scim_send_delete");
+                           simplescim_error_string_set_message("HTTP response code %ld returned, expected %ld", response_code, 204L);
+                           done(response_code);
+                           return;
+                       }
+
+                       done(0);
+                   });
 }
 
 /**
@@ -691,29 +1689,115 @@ void simplescim_query_impl(const std::string& url, std::vector<pt::ptree>& resou
 void scim_sender::query(const std::string& url, std::vector<pt::ptree>& resources) {
     auto curl_getter =
         [this](const std::string& url, std::string& response_data, long *response_code) -> int {
-        bool timedout = false;
-        bool permanent_failure = false;
-        auto res = simplescim_scim_send(curl, url, "", "GET", 
-            response_data, response_code, 
-            http_log, config::http_connection_timeout(), config::http_request_timeout(), timedout, permanent_failure);
+        return send_sync(url, "GET", response_data, response_code);
+    };
+    
+    simplescim_query_impl(url, resources, curl_getter);
+}
+
+std::vector<std::vector<std::string>> scim_sender::query_ids(const std::vector<std::string>& urls, int page_size) {
+    struct page_request {
+        size_t endpoint;
+        long long start_index;
+        int count;
+        bool only_ids;
+    };
+
+    std::vector<std::vector<std::string>> ids(urls.size());
+
+    // The number of resources per endpoint, according to the first page
+    std::vector<long long> totals(urls.size());
+    std::deque<page_request> to_send;
+    std::optional<std::string> error;
+    int pending = 0;
 
-        if (timedout) {
-            register_timeout();
+    page_size = std::max(page_size, 1);
+    for (size_t i = 0; i < urls.size(); ++i) {
+        to_send.push_back({ i, 1, page_size, true });
+    }
+
+    // The callbacks only queue new pages, they're sent from the loop below
+    auto handle_page = [&](const page_request& p, const std::string& url,
+                           int err, long response_code, const std::string& body) {
+        --pending;
+        if (error) {
+            return;
+        }
+
+        if (err == -1) {
+            error = simplescim_error_string_get();
+            return;
+        }
+
+        if (response_code == 400 && p.only_ids && p.start_index == 1) {
+            // The server doesn't like our query parameters, ask for the whole resources instead
+            to_send.push_back({ p.endpoint, 1, p.count, false });
+            return;
+        }
+
+        if (response_code != 200) {
+            error = "Failed to GET " + url + ", HTTP response code " + std::to_string(response_code) + " returned, expected 200";
+            return;
+        }
+
+        scim_query::page page;
+        try {
+            page = scim_query::parse_ids(body);
+        }
+        catch (const std::runtime_error& e) {
+            error = std::string(e.what()) + " (" + url + ")";
+            return;
         }
 
-        if (permanent_failure) {
-            set_aborted();
+        auto received = static_cast<int>(page.ids.size());
+        auto& endpoint_ids = ids[p.endpoint];
+        endpoint_ids.insert(endpoint_ids.end(),
+                            std::make_move_iterator(page.ids.begin()),
+                            std::make_move_iterator(page.ids.end()));
+
+        if (p.start_index == 1) {
+            totals[p.endpoint] = page.total_results;
+
+            // The server may use smaller pages than we asked for, we'll use the same size
+            for (auto start : scim_query::remaining_pages(page.total_results, received)) {
+                to_send.push_back({ p.endpoint, start, received, p.only_ids });
+            }
+        }
+        else if (received > 0 && received < p.count && p.start_index + received <= page.total_results) {
+            // A smaller page than the first one, get the rest of it
+            to_send.push_back({ p.endpoint, p.start_index + received, p.count - received, p.only_ids });
         }
-            
-        return res;
     };
-    
-    simplescim_query_impl(url, resources, curl_getter);
-}
 
-void scim_sender::register_timeout() {
-    number_of_timeouts++;
-    if (number_of_timeouts > config::http_max_acceptable_timeouts()) {
-        set_aborted();
+    while (!to_send.empty() || pending > 0) {
+        if (error || to_send.empty()) {
+            to_send.clear();
+            run_once(true);
+            continue;
+        }
+
+        auto p = to_send.front();
+        to_send.pop_front();
+
+        auto url = scim_query::page_url(urls[p.endpoint], p.start_index, p.count, p.only_ids);
+        ++pending;
+        send_async(url, "", "GET",
+                   [&handle_page, p, url](int err, long response_code, std::string&& body) {
+                       handle_page(p, url, err, response_code, body);
+                   });
+    }
+
+    if (error) {
+        throw std::runtime_error(*error);
+    }
+
+    // If the server returned fewer resources than it said it had (e.g. an empty
+    // page) we can't tell what's missing, and can't use what we got
+    for (size_t i = 0; i < urls.size(); ++i) {
+        if (static_cast<long long>(ids[i].size()) != totals[i]) {
+            throw std::runtime_error("Got " + std::to_string(ids[i].size()) + " ids from " + urls[i] +
+                                     " but the server said there are " + std::to_string(totals[i]));
+        }
     }
+    return ids;
 }
@@ -30,7 +30,20 @@
 #include <curl/curl.h>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <random>
+#include <chrono>
 #include <boost/property_tree/ptree_fwd.hpp>
+#include "scim_bulk.hpp"
+#include "rate_controller.hpp"
+#include "circuit_breaker.hpp"
+#include "server_pool.hpp"
+#include "request_timings.hpp"
+#include "utility/async_log.hpp"
+
+class tls_session_cache;
 
 class scim_sender {
 public:
@@ -39,9 +52,50 @@ public:
         return sender;
     }
 
-    scim_sender()
-    : number_of_timeouts(0), aborted(false) {
-    }
+    scim_sender();
+    ~scim_sender();
+
+    /**
+     * Called when a create request has completed.
+     *
+     * On success, response is the response from the server,
+     * this should be the string representation of the JSON
+     * object returned by the server (or empty, see
+     * set_discard_response_bodies()). On error, response is
+     * empty and simplescim_error_string is set to an
+     * appropriate error message.
+     *
+     * If the request failed due to the object already existing
+     * on the server (409), conflict will be true.
+     */
+    typedef std::function<void(std::optional<std::string> response, bool conflict)> create_callback;
+
+    /**
+     * Called when an update request has completed.
+     *
+     * On success, response is the response from the server (or empty,
+     * see set_discard_response_bodies()). On error,
+     * response is empty and simplescim_error_string is set to an
+     * appropriate error message.
+     *
+     * If the request failed due to the object no longer existing
+     * on the server (404), non_existent will be true.
+     */
+    typedef std::function<void(std::optional<std::string> response, bool non_existent)> update_callback;
+
+    /**
+     * Called when a delete request has completed.
+     *
+     * result is zero on success. This means the server responded
+     * with HTTP code 204 (No Content).
+     * If we didn't successfully perform an HTTP request, result is -1
+     * and simplescim_error_string is set to an appropriate
+     * error message. This could mean failed to connect or a timeout.
+     * If a successful HTTP request was performed but we received a
+     * different response than HTTP 204, result is the HTTP code
+     * (such as 404 Not found).
+     */
+    typedef std::function<void(long result)> delete_callback;
 
     /**
      * Initialises simplescim_scim_send.
@@ -52,6 +106,9 @@ public:
      * 'pinnedpubkey' must be the sha256 hash of the server's
      * public key.
      *
+     * 'server_url' is the SCIM server's URL, it's used to tell
+     * whether saved TLS sessions are for this server.
+     *
      * On success, zero is returned. On error, -1 is returned
      * and simplescim_error_string is set to an appropriate
      * error message.
@@ -59,11 +116,28 @@ public:
     int send_init(std::string cert,
                   std::string key,
                   std::string pinnedpubkey,
-                  std::string ca_bundle_path);
+                  std::string ca_bundle_path,
+                  std::string server_url);
+
+    /**
+     * Spreads the requests over several servers for the same service
+     * instead of only using the server given to send_init (which must be
+     * the first one). Requests for URLs under the first server's URL are
+     * sent to the server where we expect them to be done the soonest
+     * (see server_pool). If a server can't be reached the request is
+     * sent to another server instead.
+     */
+    void use_servers(const std::vector<server_pool::server>& servers);
+
+    /** The servers we send to, see use_servers() */
+    const server_pool& get_server_pool() const {
+        return servers;
+    }
 
     /**
      * Clears simplescim_scim_send and frees any associated
-     * dynamically allocated memory.
+     * dynamically allocated memory. Requests which haven't
+     * completed yet are dropped without calling their callbacks.
      */
     void send_clear();
 
@@ -79,18 +153,19 @@ public:
      * 'body' must be the string representation of a JSON
      * object representing the SCIM resource.
      *
-     * On success, the response from the server is returned,
-     * this should be the string representation of the JSON
-     * object returned by the server. On error, no string is
-     * returned and simplescim_error_string is set to an 
-     * appropriate error message.
+     * The request is started but this function doesn't wait for
+     * it to complete (unless the maximum number of concurrent
+     * requests are already in flight, then we'll wait until one
+     * of them is done). 'done' is called when the request has
+     * completed, see create_callback.
      *
-     * If the request failed due to the object already existing
-     * on the server (409), conflict will be set to true.
+     * 'resource_id' is the resource's id, it's only used to tell
+     * which resource the request was for in the request timings.
      */
-    std::optional<std::string> send_create(const std::string &url,
-                                           const std::string &body,
-                                           bool& conflict);
+    void send_create(const std::string &url,
+                     const std::string &body,
+                     create_callback done,
+                     const std::string &resource_id = "");
 
     /**
      * Sends a request to update a SCIM resource.
@@ -104,18 +179,25 @@ public:
      * 'body' must be the string representation of a JSON
      * object representing the SCIM resource.
      *
-     * On success, the response from the server is returned,
-     * this should be the string representation of the JSON 
-     * object returned by the server. On error, no string is
-     * returned and simplescim_error_string is set to an 
-     * appropriate error message.
+     * Like send_create this doesn't wait for the request
+     * to complete, 'done' is called when it has, see update_callback.
+     */
+    void send_update(const std::string &url,
+                     const std::string &body,
+                     update_callback done);
+
+    /**
+     * Sends a request to modify a SCIM resource with a PATCH.
      *
-     * If the request failed due to the object no longer existing
-     * on the server (404), non_existent will be set to true.
+     * 'url' is the same as for send_update, 'body' must be a
+     * PatchOp message (see scim_patch::make_patch).
+     *
+     * The server may respond with the updated resource or without a
+     * body, otherwise this works just like send_update.
      */
-    std::optional<std::string> send_update(const std::string &url,
-                                           const std::string &body,
-                                           bool& non_existent);
+    void send_patch(const std::string &url,
+                    const std::string &body,
+                    update_callback done);
 
     /**
      * Sends a request to delete a SCIM resource.
@@ -126,14 +208,10 @@ public:
      * For example:
      * https://example.com/Users/2819c223-7f76-453a-919d-413861904646
      *
-     * If we didn't successfully perform an HTTP request, -1 is returned
-     * and simplescim_error_string is set to an appropriate
-     * error message. This could mean failed to connect or a timeout.
-     * If a successful HTTP request was performed but we received a 
-     * different response than HTTP 204, we will return the HTTP code
-     * (such as 404 Not found).
+     * Like send_create this doesn't wait for the request
+     * to complete, 'done' is called when it has, see delete_callback.
      */
-    long send_delete(const std::string &url);
+    void send_delete(const std::string &url, delete_callback done);
 
     /**
      * Gets all resources for an endpoint. Handles pagination
@@ -145,6 +223,136 @@ public:
      */
     void query(const std::string& url, std::vector<boost::property_tree::ptree>& resources);
 
+    /**
+     * Gets the ids of all resources for a number of endpoints. Only the ids
+     * are requested, 'page_size' at a time. The endpoints, and once we know
+     * how many resources there are, their pages, are fetched concurrently
+     * (as many at a time as set_max_concurrent_requests allows).
+     *
+     * Returns the ids for each URL in 'urls'.
+     *
+     * Throws an std::runtime_error if there is a failure to
+     * retrieve the ids.
+     */
+    std::vector<std::vector<std::string>> query_ids(const std::vector<std::string>& urls, int page_size);
+
+    /**
+     * Sets the maximum number of requests that may be in flight at the
+     * same time. Requests started after this call will wait for a free
+     * slot. With the default of 1 requests are done one at a time.
+     *
+     * 'per_endpoint' sets the limits for some endpoints (e.g.
+     * https://example.com/scim/Groups), a request to one of them also
+     * waits until fewer than its endpoint's limit are in flight. The
+     * limits replace those from earlier calls.
+     *
+     * With adaptive concurrency (http-adaptive-concurrency) this is the
+     * upper bound, the number of requests per endpoint is adjusted to
+     * what the server can handle (see rate_controller).
+     */
+    void set_max_concurrent_requests(int n, const std::map<std::string, int>& per_endpoint = {});
+
+    /**
+     * The rate controllers per endpoint (only used with adaptive
+     * concurrency), so we can report how fast we could send.
+     */
+    const std::map<std::string, rate_controller>& get_rate_controllers() const {
+        return rate_controllers;
+    }
+
+    /**
+     * The circuit breakers per endpoint, so we can report which
+     * endpoints we stopped sending to because they were failing.
+     */
+    const std::map<std::string, circuit_breaker>& get_circuit_breakers() const {
+        return circuit_breakers;
+    }
+
+    /**
+     * Returns the server's ServiceProviderConfig (as JSON), which describes
+     * what the server supports. It's only fetched the first time.
+     *
+     * Throws std::runtime_error if we fail to get it.
+     */
+    std::string get_service_provider_config(const std::string& base_url);
+
+    /**
+     * From now on creates, updates and deletes are collected into SCIM
+     * Bulk requests to base_url + "/Bulk", as large as the server
+     * allows (see settings), instead of one request each.
+     */
+    void enable_bulk(const std::string& base_url, const scim_bulk::settings& settings);
+
+    /**
+     * Waits until all started requests have completed (and their
+     * callbacks have been called). Used as a barrier, for instance
+     * between the types in scim-type-send-order.
+     *
+     * Operations waiting to be sent in a bulk request are sent first.
+     *
+     * Creates, updates and deletes which failed in a way that is likely to
+     * be temporary (see http_retry) are retried here, after a backoff,
+     * until they succeed or we've tried http-retries times.
+     *
+     * If 'more' is set it's called while we wait, at a point where it's
+     * safe to start new requests (which we then also wait for).
+     */
+    void wait_for_all(const std::function<void()>& more = nullptr);
+
+    /**
+     * Returns how many requests have been completed per HTTP version
+     * (e.g. "HTTP/1.1" or "HTTP/2"), so we can tell what was actually
+     * negotiated with the server.
+     */
+    const std::map<std::string, int>& get_http_versions() const {
+        return http_versions;
+    }
+
+    /**
+     * Returns how long the requests took (per endpoint and method)
+     * and which requests were the slowest.
+     */
+    const request_timings& get_request_timings() const {
+        return timings;
+    }
+
+    /**
+     * Returns how many new TLS connections resumed a session ("resumed")
+     * and how many needed a full handshake ("full"). Available after
+     * send_clear().
+     */
+    const std::map<std::string, int>& get_tls_handshakes() const {
+        return tls_handshakes;
+    }
+
+    /**
+     * If discard is true, the response bodies for creates, updates and
+     * deletes aren't kept (the callbacks get an empty response on success),
+     * which saves us from buffering resources we never look at. Bodies are
+     * still kept if the HTTP log is enabled, and for bulk requests and
+     * queries which need them.
+     */
+    void set_discard_response_bodies(bool discard) {
+        discard_response_bodies = discard;
+    }
+
+    /**
+     * Returns the total size of the request bodies we've sent with
+     * compression enabled, before and after compression.
+     */
+    unsigned long long get_uncompressed_request_bytes() const {
+        return uncompressed_request_bytes;
+    }
+
+    unsigned long long get_compressed_request_bytes() const {
+        return compressed_request_bytes;
+    }
+
+    /** Returns how many times we've retried a create, update or delete. */
+    int get_retries() const {
+        return number_of_retries;
+    }
+
     /** Sets the aborted state (see documentation for the aborted member below).
      *  Note that this class is not thread safe, this should not be called while
      *  another thread might be making requests.
@@ -160,24 +368,223 @@ public:
         return aborted;
     }
 
+    /// An HTTP request handed over to curl (defined in simplescim_scim_send.cpp)
+    struct request;
+
 private:
 
-    void register_timeout();
+    /**
+     * Called when an HTTP request has completed.
+     * err is -1 if we failed to perform the request (simplescim_error_string
+     * is then set), otherwise zero and response_code and body are set.
+     * The callback may move the body, it's not used after the call.
+     */
+    typedef std::function<void(int err, long response_code, std::string&& body)> completion_callback;
+
+    /// A create, update or delete, kept until it's done so it can be retried
+    struct operation {
+        std::string url;
+        std::string resource;
+        std::string method;
+        completion_callback done;
+
+        /// Number of times we've retried it so far
+        int retries = 0;
+
+        /// The id of the resource, if we know it and it isn't in the URL
+        std::string resource_id;
+    };
+
+    /**
+     * Starts a request. If the request fails in a way that is likely
+     * to be temporary, 'operations' (the operations the request was
+     * made for) are retried later instead of calling 'done'.
+     *
+     * If 'keep_body' is false the response body is thrown away as it
+     * arrives and 'done' gets an empty body.
+     */
+    void send_async(const std::string &url,
+                    const std::string &resource,
+                    const std::string &method,
+                    completion_callback done,
+                    std::vector<operation> operations = {},
+                    bool keep_body = true);
+
+    /**
+     * Sends a request, or adds it to the next bulk request if bulk
+     * requests are enabled. 'done' gets the status and response
+     * for the operation either way.
+     */
+    void send_operation(const std::string &url,
+                        const std::string &resource,
+                        const std::string &method,
+                        completion_callback done);
+
+    void send_operation(operation op);
+
+    /// Sends the operations collected for the next bulk request
+    void flush_bulk();
+
+    /**
+     * Puts an operation in the retry queue. Returns false if it
+     * shouldn't be retried (we've already retried it enough times).
+     * We'll wait at least 'retry_after' if the server asked us to.
+     *
+     * 'random' is for the jitter in the backoff (see http_retry::backoff),
+     * operations from the same request use the same value so they are
+     * retried together (and end up in the same bulk request).
+     */
+    bool retry_later(operation op,
+                     std::optional<std::chrono::steady_clock::duration> retry_after,
+                     double random);
+
+    /// A random number in [0, 1) for retry_later()
+    double retry_jitter();
+
+    /// Sends the operations in the retry queue which are due
+    void send_due_retries();
+
+    int send_sync(const std::string &url,
+                  const std::string &method,
+                  std::string& response_data,
+                  long *response_code);
+
+    void run_once(bool block, int max_wait_ms = 1000);
+
+    /**
+     * Chooses the server for a request (see use_servers), prepares the
+     * request's easy handle and hands it over to curl. Returns false if
+     * that fails (simplescim_error_string is then set).
+     */
+    bool start(request& r);
+
+    /**
+     * Lets the server pool know how a request to one of its servers went.
+     * If the request couldn't reach the server and another server is
+     * reachable, the request is started again with that server (and
+     * put back in flight) and true is returned.
+     */
+    bool fail_over(std::unique_ptr<request>& r, CURLcode result);
+
+    void complete(CURL *curl, CURLcode result);
+
+    circuit_breaker& circuit_breaker_for(const std::string& endpoint);
+
+    /**
+     * Lets the circuit breakers know how a request for operations went.
+     * A request which got no response (other than a permanent failure,
+     * see set_aborted()) or a server error counts as a failure for the
+     * endpoints of its operations.
+     */
+    void update_circuit_breakers(const request& r, int err, long response_code, bool permanent_failure);
+
+    /// Counts a failure for the endpoint's circuit breaker
+    void endpoint_failed(const std::string& endpoint, circuit_breaker::clock::time_point now);
+
+    rate_controller& rate_controller_for(const std::string& endpoint);
+
+    /// The limit for an endpoint, see set_max_concurrent_requests()
+    int max_concurrent_requests_for(const std::string& endpoint) const;
+
+    /// The number of requests in flight to an endpoint
+    int in_flight_to(const std::string& endpoint) const;
+
+    void adapt_concurrency(const request& r, int err, long response_code, bool timedout);
+
+    void register_timing(const request& r, long response_code);
+
+    CURLM *multi;
+
+    /// Easy handles which can be reused for new requests
+    std::vector<CURL*> idle_handles;
+
+    /// Requests which have been handed over to curl and not yet completed
+    std::map<CURL*, std::unique_ptr<request>> in_flight;
+
+    int max_concurrent_requests;
+
+    /// Limits for some endpoints, see set_max_concurrent_requests()
+    std::map<std::string, int> endpoint_max_concurrent_requests;
+
+    /// Should we throw away the response bodies for operations? See set_discard_response_bodies()
+    bool discard_response_bodies;
+
+    /// Should request bodies be compressed? Turned off if the server doesn't accept it
+    bool compress_requests;
+
+    /// See get_uncompressed_request_bytes() and get_compressed_request_bytes()
+    unsigned long long uncompressed_request_bytes;
+    unsigned long long compressed_request_bytes;
+
+    /// Should the number of concurrent requests adapt to the server's responses?
+    bool adaptive_concurrency;
+
+    /// One rate controller per endpoint, used with adaptive_concurrency
+    std::map<std::string, rate_controller> rate_controllers;
+
+    /// The servers we send to if there are several, see use_servers()
+    server_pool servers;
+
+    /// One circuit breaker per endpoint, for creates, updates and deletes
+    std::map<std::string, circuit_breaker> circuit_breakers;
+
+    /// The ServiceProviderConfig, once we've fetched it
+    std::optional<std::string> service_provider_config;
+
+    /// The base URL for bulk operations' paths, empty unless bulk requests are enabled
+    std::string bulk_base_url;
+
+    /// The server's limits for bulk requests
+    scim_bulk::settings bulk_settings;
+
+    /// Operations (as JSON) collected for the next bulk request
+    std::vector<std::string> bulk_operations;
+
+    /// The operations in bulk_operations (with their callbacks)
+    std::vector<operation> bulk_queued;
+
+    /// Size of the bulk request with the operations collected so far
+    size_t bulk_payload_size;
+
+    /// Maximum number of retries for an operation, see config::http_retries()
+    int max_retries;
+
+    /// Operations waiting to be retried, by when they should be sent
+    std::multimap<std::chrono::steady_clock::time_point, operation> retries;
+
+    /// Total number of retries we've done
+    int number_of_retries;
+
+    /// For the random part of the backoff
+    std::mt19937 random_engine;
+
+    /// How long the requests took
+    request_timings timings;
+
+    /// Number of completed requests per negotiated HTTP version
+    std::map<std::string, int> http_versions;
+
+    /// TLS sessions shared between the easy handles
+    std::unique_ptr<tls_session_cache> tls_sessions;
+
+    /// Where the TLS sessions are saved between runs (empty if they aren't)
+    std::string tls_session_file;
 
-    CURL *curl;
+    /// What the saved TLS sessions are valid for, see tls_session_cache::load()
+    std::string tls_session_identity;
 
-    /// Number of timeouts we've had so far
-    int number_of_timeouts;
+    /// Handshake outcomes from tls_sessions, kept after send_clear()
+    std::map<std::string, int> tls_handshakes;
 
     /** Aborted means we shouldn't do any more real requests, just return errors.
-     *  The aborted state is set if we've had too many timeouts when doing requests,
-     *  if a request has failed in a way that implies later requests will also fail,
+     *  The aborted state is set if a request has failed in a way that implies
+     *  later requests to any endpoint will also fail (e.g. we can't connect),
      *  or if surrounding code has asked us to go to the aborted state (typically
      *  because the program is being shut down and wants to exit prematurely).
      */
     bool aborted;
 
-    std::ofstream http_log;
+    async_ofstream http_log;
 };
 
 #endif
@@ -0,0 +1,62 @@
+#include "catch.hpp"
+
+#include "utility/async_log.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+std::string read_file(const std::filesystem::path& path) {
+    std::ifstream is(path);
+    std::ostringstream os;
+    os << is.rdbuf();
+    return os.str();
+}
+
+}
+
+TEST_CASE("Async log writes everything before close returns") {
+    auto path = std::filesystem::temp_directory_path() / "egilscim_async_log_test.log";
+    std::filesystem::remove(path);
+
+    async_ofstream log;
+    REQUIRE(!log.is_open());
+    REQUIRE(!log);
+
+    log.open(path.string());
+    REQUIRE(log.is_open());
+    REQUIRE(log);
+
+    std::string expected;
+    for (int i = 0; i < 10000; ++i) {
+        log << "line " << i << "\n";
+        expected += "line " + std::to_string(i) + "\n";
+        if (i % 1000 == 0) {
+            log << std::flush;
+        }
+    }
+    log.close();
+    REQUIRE(!log);
+
+    REQUIRE(read_file(path) == expected);
+
+    // Appending
+    log.open(path.string(), std::ios_base::out | std::ios_base::app);
+    log << "last" << std::endl;
+    log.close();
+    REQUIRE(read_file(path) == expected + "last\n");
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Async log which isn't open") {
+    async_ofstream log;
+    log << "ignored";
+    REQUIRE(!log);
+
+    log.open((std::filesystem::temp_directory_path() / "no-such-dir" / "x.log").string());
+    REQUIRE(!log.is_open());
+    REQUIRE(log.fail());
+}
@@ -0,0 +1,178 @@
+#include "catch.hpp"
+
+#include "change_plan.hpp"
+
+#include <filesystem>
+
+namespace {
+
+std::filesystem::path plan_path() {
+    return std::filesystem::temp_directory_path() / "egilscim_change_plan_test.plan";
+}
+
+change_plan::plan make_plan() {
+    change_plan::plan p;
+    p.source.objects = 2;
+    p.source.digest[0] = 42;
+    p.copies = { "a", "b" };
+
+    change_plan::operation create;
+    create.what = change_plan::kind::create;
+    create.type = "Student";
+    create.id = "c";
+    create.readable = "user c";
+    create.object = std::make_shared<rendered_object>("c", "Student", R"({"userName":"c"})");
+    p.operations.push_back(create);
+
+    change_plan::operation update;
+    update.what = change_plan::kind::update;
+    update.type = "Student";
+    update.id = "d";
+    update.object = std::make_shared<rendered_object>("d", "Student", R"({"userName":"d2"})");
+    update.previous = std::make_shared<rendered_object>("d", "Student", R"({"userName":"d"})");
+    p.operations.push_back(update);
+
+    change_plan::operation remove;
+    remove.what = change_plan::kind::remove_from_endpoint;
+    remove.step = 1;
+    remove.type = "Student";
+    remove.id = "e";
+    remove.endpoint = "Users";
+    p.operations.push_back(remove);
+
+    return p;
+}
+
+}
+
+TEST_CASE("Write and read a change plan") {
+    auto path = plan_path().string();
+    change_plan::write(path, make_plan());
+
+    auto p = change_plan::read(path);
+    REQUIRE(p.source.objects == 2);
+    REQUIRE(p.source.digest[0] == 42);
+    REQUIRE(p.copies == std::vector<std::string>{ "a", "b" });
+    REQUIRE(p.operations.size() == 3);
+    REQUIRE(p.done.empty());
+    REQUIRE(!p.finished);
+
+    const auto& create = p.operations[0];
+    REQUIRE(create.what == change_plan::kind::create);
+    REQUIRE(create.readable == "user c");
+    REQUIRE(create.object->get_id() == "c");
+    REQUIRE(create.object->get_type() == "Student");
+    REQUIRE(create.object->get_json() == R"({"userName":"c"})");
+    REQUIRE(create.previous == nullptr);
+
+    REQUIRE(p.operations[1].previous->get_json() == R"({"userName":"d"})");
+
+    const auto& remove = p.operations[2];
+    REQUIRE(remove.what == change_plan::kind::remove_from_endpoint);
+    REQUIRE(remove.step == 1);
+    REQUIRE(remove.endpoint == "Users");
+    REQUIRE(remove.object == nullptr);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("A failed change plan write keeps the old plan") {
+    auto path = plan_path().string();
+    change_plan::write(path, make_plan());
+    auto size = std::filesystem::file_size(path);
+    REQUIRE(!std::filesystem::exists(path + ".tmp"));
+
+    // The temporary file can't be created if there's a directory in the way
+    std::filesystem::create_directory(path + ".tmp");
+    change_plan::plan empty;
+    REQUIRE_THROWS_AS(change_plan::write(path, empty), std::runtime_error);
+    REQUIRE(std::filesystem::file_size(path) == size);
+    REQUIRE(change_plan::read(path).operations.size() == 3);
+
+    std::filesystem::remove(path + ".tmp");
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Change plan progress") {
+    auto path = plan_path().string();
+    change_plan::write(path, make_plan());
+
+    {
+        auto p = change_plan::read(path);
+        change_plan::progress progress(path, p);
+
+        change_plan::result other;
+        other.what = change_plan::outcome::other;
+        other.other = std::make_shared<rendered_object>("d", "Student", "{}");
+        progress.done(1, other);
+
+        change_plan::result object;
+        object.what = change_plan::outcome::object;
+        progress.done(0, object);
+    }
+
+    auto p = change_plan::read(path);
+    REQUIRE(p.done.size() == 2);
+    REQUIRE(p.done[0].what == change_plan::outcome::object);
+    REQUIRE(p.done[1].what == change_plan::outcome::other);
+    REQUIRE(p.done[1].other->get_id() == "d");
+    REQUIRE(p.done[1].other->get_json() == "{}");
+    REQUIRE(!p.finished);
+
+    // An outcome we didn't finish writing is ignored, and removed when we continue
+    auto complete_size = std::filesystem::file_size(path);
+    std::filesystem::resize_file(path, complete_size + 3);
+    p = change_plan::read(path);
+    REQUIRE(p.done.size() == 2);
+    REQUIRE(p.file_size == complete_size);
+
+    {
+        change_plan::progress progress(path, p);
+        progress.done(2, change_plan::result());
+        progress.finished();
+    }
+
+    p = change_plan::read(path);
+    REQUIRE(p.done.size() == 3);
+    REQUIRE(p.done[2].what == change_plan::outcome::nothing);
+    REQUIRE(p.finished);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Bad change plan files") {
+    auto path = plan_path().string();
+    change_plan::write(path, make_plan());
+
+    // Truncated in the middle of the operations
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 10);
+    REQUIRE_THROWS_AS(change_plan::read(path), std::runtime_error);
+
+    // Not a plan at all
+    std::filesystem::resize_file(path, 4);
+    REQUIRE_THROWS_AS(change_plan::read(path), std::runtime_error);
+
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(change_plan::read(path), std::runtime_error);
+}
+
+TEST_CASE("Cache fingerprints") {
+    rendered_object_list cache;
+    cache.add_object(std::make_shared<rendered_object>("a", "Student", R"({"userName":"a"})"));
+    cache.add_object(std::make_shared<rendered_object>("b", "Student", R"({"userName":"b"})"));
+    auto original = change_plan::fingerprint(cache);
+    REQUIRE(original.objects == 2);
+    REQUIRE(original == change_plan::fingerprint(cache));
+
+    // An added object
+    cache.add_object(std::make_shared<rendered_object>("c", "Student", R"({"userName":"c"})"));
+    auto added = change_plan::fingerprint(cache);
+    REQUIRE(added != original);
+
+    // A changed object
+    cache.remove_object("c");
+    REQUIRE(change_plan::fingerprint(cache) == original);
+    cache.remove_object("b");
+    cache.add_object(std::make_shared<rendered_object>("b", "Student", R"({"userName":"b2"})"));
+    REQUIRE(change_plan::fingerprint(cache) != original);
+}
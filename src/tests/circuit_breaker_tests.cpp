@@ -0,0 +1,73 @@
+#include "catch.hpp"
+
+#include "circuit_breaker.hpp"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("Circuit breaker opens after too many failures in a row") {
+    circuit_breaker breaker(3, 30s);
+    auto now = circuit_breaker::clock::now();
+
+    REQUIRE(breaker.get_state() == circuit_breaker::state::closed);
+
+    // A success in between starts the count over
+    breaker.failure(now);
+    breaker.failure(now);
+    breaker.failure(now);
+    breaker.success();
+    breaker.failure(now);
+    breaker.failure(now);
+    breaker.failure(now);
+    REQUIRE(breaker.get_state() == circuit_breaker::state::closed);
+    REQUIRE(breaker.allow(now));
+
+    breaker.failure(now);
+    REQUIRE(breaker.get_state() == circuit_breaker::state::open);
+    REQUIRE(breaker.get_times_opened() == 1);
+
+    REQUIRE(!breaker.allow(now));
+    REQUIRE(!breaker.allow(now + 29s));
+    REQUIRE(breaker.get_skipped() == 2);
+
+    // Requests which were in flight when it opened don't close it
+    breaker.success();
+    REQUIRE(breaker.get_state() == circuit_breaker::state::open);
+}
+
+TEST_CASE("Circuit breaker probes after the cooldown") {
+    circuit_breaker breaker(0, 30s);
+    auto now = circuit_breaker::clock::now();
+
+    breaker.failure(now);
+    REQUIRE(breaker.get_state() == circuit_breaker::state::open);
+
+    // One probe, the rest are skipped until we know how it went
+    now += 30s;
+    REQUIRE(breaker.allow(now));
+    REQUIRE(breaker.get_state() == circuit_breaker::state::half_open);
+    REQUIRE(!breaker.allow(now));
+
+    // The probe failed, wait another cooldown
+    breaker.failure(now);
+    REQUIRE(breaker.get_state() == circuit_breaker::state::open);
+    REQUIRE(breaker.get_times_opened() == 2);
+    REQUIRE(!breaker.allow(now + 10s));
+
+    now += 30s;
+    REQUIRE(breaker.allow(now));
+    breaker.success();
+    REQUIRE(breaker.get_state() == circuit_breaker::state::closed);
+    REQUIRE(breaker.allow(now));
+    REQUIRE(breaker.get_skipped() == 2);
+}
+
+TEST_CASE("Circuit breaker sends a new probe if the last one got lost") {
+    circuit_breaker breaker(0, 30s);
+    auto now = circuit_breaker::clock::now();
+
+    breaker.failure(now);
+    REQUIRE(breaker.allow(now + 30s));
+    REQUIRE(!breaker.allow(now + 59s));
+    REQUIRE(breaker.allow(now + 60s));
+    REQUIRE(breaker.get_state() == circuit_breaker::state::half_open);
+}
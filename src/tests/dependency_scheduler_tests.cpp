@@ -0,0 +1,71 @@
+#include "catch.hpp"
+
+#include "dependency_scheduler.hpp"
+
+TEST_CASE("Operations wait for what they depend on") {
+    dependency_scheduler scheduler;
+    std::vector<std::string> started;
+    auto start = [&](const std::string& name) {
+        return [&started, name]() { started.push_back(name); };
+    };
+
+    scheduler.add("school", {}, start("school"));
+    scheduler.add("other school", {}, start("other school"));
+    REQUIRE(started == std::vector<std::string>{ "school", "other school" });
+
+    // Only waits for pending operations, "nobody" was never added
+    scheduler.add("student", { "school", "nobody" }, start("student"));
+    scheduler.add("group", { "student", "other school" }, start("group"));
+    scheduler.add("", { "nobody" }, start("update"));
+    REQUIRE(started.size() == 3);
+    REQUIRE(scheduler.waiting() == 2);
+
+    // done() doesn't start anything itself
+    scheduler.done("school");
+    REQUIRE(started.size() == 3);
+    REQUIRE(scheduler.start_ready());
+    REQUIRE(started.back() == "student");
+    REQUIRE(!scheduler.start_ready());
+
+    scheduler.done("student");
+    scheduler.start_ready();
+    REQUIRE(started.size() == 4);
+
+    scheduler.done("other school");
+    scheduler.start_ready();
+    REQUIRE(started.back() == "group");
+    REQUIRE(scheduler.waiting() == 0);
+    REQUIRE(scheduler.get_waited() == 2);
+
+    // Already done, doesn't wait
+    scheduler.add("", { "school" }, start("late"));
+    REQUIRE(started.back() == "late");
+}
+
+TEST_CASE("Operations done as they are started") {
+    dependency_scheduler scheduler;
+    std::vector<std::string> started;
+
+    scheduler.add("a", {}, [&]() { started.push_back("a"); });
+    scheduler.add("b", { "a" }, [&]() { started.push_back("b"); scheduler.done("b"); });
+    scheduler.add("c", { "b" }, [&]() { started.push_back("c"); scheduler.done("c"); });
+    scheduler.add("d", { "a", "c" }, [&]() { started.push_back("d"); });
+
+    scheduler.done("a");
+    scheduler.start_ready();
+    REQUIRE(started == std::vector<std::string>{ "a", "b", "c", "d" });
+    REQUIRE(scheduler.waiting() == 0);
+}
+
+TEST_CASE("String values in JSON") {
+    auto values = dependency_scheduler::string_values(R"({
+  "externalId": "1234",
+  "displayName" : "A \"quoted\" name",
+  "members": [ { "value": "5678" }, { "value":"9abc" } ],
+  "number": 7
+})");
+    REQUIRE(values == std::vector<std::string>{ "1234", "A \"quoted\" name", "5678", "9abc" });
+
+    REQUIRE(dependency_scheduler::string_values("").empty());
+    REQUIRE(dependency_scheduler::string_values("{}").empty());
+}
@@ -0,0 +1,43 @@
+#include "catch.hpp"
+
+#include "utility/gzip.hpp"
+
+#include <zlib.h>
+
+namespace {
+
+std::string decompress(const std::string& data) {
+    z_stream stream{};
+    REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+
+    std::string result(1000000, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+    stream.avail_out = static_cast<uInt>(result.size());
+    REQUIRE(inflate(&stream, Z_FINISH) == Z_STREAM_END);
+    result.resize(stream.total_out);
+    inflateEnd(&stream);
+    return result;
+}
+
+}
+
+TEST_CASE("gzip compression") {
+    std::string members;
+    for (int i = 0; i < 1000; ++i) {
+        members += "{\"value\":\"5e5547ed-e8a9-5e46-9d63-" + std::to_string(100000000000 + i) + "\"},";
+    }
+
+    auto compressed = gzip_compress(members);
+
+    // gzip magic number
+    REQUIRE(compressed.size() > 2);
+    REQUIRE(static_cast<unsigned char>(compressed[0]) == 0x1f);
+    REQUIRE(static_cast<unsigned char>(compressed[1]) == 0x8b);
+
+    REQUIRE(compressed.size() < members.size() / 5);
+    REQUIRE(decompress(compressed) == members);
+
+    REQUIRE(decompress(gzip_compress("")) == "");
+}
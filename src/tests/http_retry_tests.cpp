@@ -0,0 +1,35 @@
+#include "catch.hpp"
+
+#include "http_retry.hpp"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("Transient failures") {
+    REQUIRE(http_retry::transient_response(503));
+    REQUIRE(http_retry::transient_response(429));
+    REQUIRE(http_retry::transient_response(500));
+    REQUIRE(http_retry::transient_response(504));
+
+    REQUIRE(!http_retry::transient_response(200));
+    REQUIRE(!http_retry::transient_response(400));
+    REQUIRE(!http_retry::transient_response(404));
+    REQUIRE(!http_retry::transient_response(409));
+
+    REQUIRE(http_retry::transient_error(CURLE_OPERATION_TIMEDOUT));
+    REQUIRE(http_retry::transient_error(CURLE_RECV_ERROR));
+    REQUIRE(!http_retry::transient_error(CURLE_SSL_PINNEDPUBKEYNOTMATCH));
+    REQUIRE(!http_retry::transient_error(CURLE_URL_MALFORMAT));
+}
+
+TEST_CASE("Exponential backoff with jitter") {
+    // Half the delay is fixed, the other half random
+    REQUIRE(http_retry::backoff(1, 0.0) == 500ms);
+    REQUIRE(http_retry::backoff(1, 0.5) == 750ms);
+    REQUIRE(http_retry::backoff(2, 0.0) == 1000ms);
+    REQUIRE(http_retry::backoff(3, 0.0) == 2000ms);
+    REQUIRE(http_retry::backoff(4, 0.999) < 8000ms);
+
+    // Bounded
+    REQUIRE(http_retry::backoff(10, 0.0) == 15000ms);
+    REQUIRE(http_retry::backoff(100, 1.0) == 30000ms);
+}
@@ -0,0 +1,87 @@
+#include "catch.hpp"
+
+#include "ldap_snapshot.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+namespace {
+std::string snapshot_path() {
+    return (std::filesystem::temp_directory_path() / "egilscim_ldap_snapshot_test.ldap").string();
+}
+}
+
+TEST_CASE("LDAP snapshot is saved and read back") {
+    auto path = snapshot_path();
+    std::filesystem::remove(path);
+
+    // No file means nothing was loaded before
+    auto empty = ldap_snapshot::read(path);
+    REQUIRE(empty.get("Student").entries.empty());
+    REQUIRE(empty.get("Student").watermark.empty());
+
+    ldap_snapshot snapshot;
+    auto& students = snapshot.get("Student");
+    students.search = "ldap://ldap.example.com\nou=Students";
+    students.watermark = "20261017101530.0Z";
+    students.last_full_load = 1791000000;
+    students.entries["1234"] = std::make_shared<base_object>(attrib_map{
+        { "uid", { "1234" } },
+        { "cn", { "Anna" } },
+        { "memberOf", { "a", "b", "" } },
+        { "ss12000type", { "Student" } } });
+    students.entries["5678"] = std::make_shared<base_object>(attrib_map{ { "uid", { "5678" } } });
+    snapshot.get("SchoolUnit");
+    snapshot.write(path);
+
+    auto read = ldap_snapshot::read(path);
+    auto& read_students = read.get("Student");
+    REQUIRE(read_students.search == students.search);
+    REQUIRE(read_students.watermark == students.watermark);
+    REQUIRE(read_students.last_full_load == students.last_full_load);
+    REQUIRE(read_students.entries.size() == 2);
+    REQUIRE(read_students.entries["1234"]->get_values("cn") == string_vector{ "Anna" });
+    REQUIRE(read_students.entries["1234"]->get_values("memberOf") == string_vector{ "a", "b", "" });
+    REQUIRE(read_students.entries["1234"]->getSS12000type() == "Student");
+    REQUIRE(read_students.entries["5678"]->get_values("uid") == string_vector{ "5678" });
+    REQUIRE(read.get("SchoolUnit").entries.empty());
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("LDAP snapshot with bad contents") {
+    auto path = snapshot_path();
+    {
+        std::ofstream ofs(path, std::ios_base::binary);
+        ofs << "not a snapshot";
+    }
+    REQUIRE_THROWS_AS(ldap_snapshot::read(path), std::runtime_error);
+
+    // Truncated
+    ldap_snapshot snapshot;
+    snapshot.get("Student").entries["1234"] = std::make_shared<base_object>(attrib_map{ { "uid", { "1234" } } });
+    snapshot.write(path);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    REQUIRE_THROWS_AS(ldap_snapshot::read(path), std::runtime_error);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("LDAP snapshot watermarks") {
+    // Numbers (like uSNChanged) are compared as numbers
+    REQUIRE(ldap_snapshot::highest("999", "1000") == "1000");
+    REQUIRE(ldap_snapshot::highest("1000", "999") == "1000");
+    REQUIRE(ldap_snapshot::highest("0042", "41") == "0042");
+
+    // Time stamps as strings
+    REQUIRE(ldap_snapshot::highest("20261017101530.0Z", "20261016235959.0Z") == "20261017101530.0Z");
+    REQUIRE(ldap_snapshot::highest("20251231235959Z", "20260101000000Z") == "20260101000000Z");
+
+    REQUIRE(ldap_snapshot::highest("", "17") == "17");
+    REQUIRE(ldap_snapshot::highest("17", "") == "17");
+
+    REQUIRE(ldap_snapshot::changed_since("uSNChanged", "12345") == "(uSNChanged>=12345)");
+    REQUIRE(ldap_snapshot::changed_since("modifyTimestamp", "20261017101530.0Z") ==
+            "(modifyTimestamp>=20261017101530.0Z)");
+    REQUIRE(ldap_snapshot::changed_since("x", "a*(b)\\") == "(x>=a\\2a\\28b\\29\\5c)");
+}
@@ -0,0 +1,104 @@
+#include "catch.hpp"
+
+#include "rate_controller.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Completes n requests with the given response code and latency, one at a time
+rate_controller::clock::time_point respond(rate_controller& controller,
+                                           rate_controller::clock::time_point now,
+                                           int n,
+                                           long response_code = 200,
+                                           rate_controller::clock::duration latency = 100ms) {
+    for (int i = 0; i < n; ++i) {
+        controller.request_started(now);
+        now += latency;
+        controller.response(response_code, latency, std::nullopt, now);
+    }
+    return now;
+}
+
+}
+
+TEST_CASE("Ramp up while the server is healthy") {
+    rate_controller controller(16);
+    auto now = rate_controller::clock::now();
+
+    REQUIRE(controller.get_limit() == 1);
+    REQUIRE(controller.may_start(now));
+
+    controller.request_started(now);
+    REQUIRE(!controller.may_start(now));
+
+    controller.response(201, 100ms, std::nullopt, now + 100ms);
+    REQUIRE(controller.get_limit() == 2);
+
+    // Slow start until the maximum
+    now = respond(controller, now, 20);
+    REQUIRE(controller.get_limit() == 16);
+    REQUIRE(controller.get_highest_limit() == 16);
+    REQUIRE(controller.get_requests() == 21);
+    REQUIRE(controller.get_throttled() == 0);
+
+    controller.set_max_limit(4);
+    REQUIRE(controller.get_limit() == 4);
+}
+
+TEST_CASE("Back off when the server is overloaded") {
+    rate_controller controller(64);
+    auto now = rate_controller::clock::now();
+
+    now = respond(controller, now, 31);
+    REQUIRE(controller.get_limit() == 32);
+
+    // Several requests fail at the same time, we only halve once
+    for (int i = 0; i < 8; ++i) {
+        controller.request_started(now);
+    }
+    REQUIRE(controller.response(429, 100ms, std::nullopt, now));
+    REQUIRE(!controller.response(429, 100ms, std::nullopt, now));
+    REQUIRE(!controller.timeout(now));
+    REQUIRE(controller.get_limit() == 16);
+    REQUIRE(controller.get_throttled() == 3);
+
+    // A later overload halves again
+    now += 1s;
+    REQUIRE(controller.response(503, 100ms, std::nullopt, now));
+    REQUIRE(controller.get_limit() == 8);
+    for (int i = 0; i < 4; ++i) {
+        controller.failure(now);
+    }
+    REQUIRE(controller.get_in_flight() == 0);
+
+    // No more slow start, one more request per round trip
+    now = respond(controller, now, 8);
+    REQUIRE(controller.get_limit() == 9);
+}
+
+TEST_CASE("Honour Retry-After") {
+    rate_controller controller(8);
+    auto now = rate_controller::clock::now();
+
+    controller.request_started(now);
+    controller.response(429, 100ms, std::chrono::duration_cast<rate_controller::clock::duration>(30s), now);
+
+    REQUIRE(!controller.may_start(now));
+    REQUIRE(!controller.may_start(now + 29s));
+    REQUIRE(controller.may_start(now + 30s));
+    REQUIRE(controller.get_paused_until() == now + 30s);
+}
+
+TEST_CASE("Ease off when the latency grows") {
+    rate_controller controller(8);
+    auto now = rate_controller::clock::now();
+
+    now = respond(controller, now, 10, 200, 100ms);
+    REQUIRE(controller.get_limit() == 8);
+
+    now = respond(controller, now, 10, 200, 1s);
+    REQUIRE(controller.get_limit() < 8);
+    REQUIRE(controller.get_limit() >= 1);
+    REQUIRE(controller.get_throttled() == 0);
+}
@@ -0,0 +1,70 @@
+#include "catch.hpp"
+
+#include "render_pipeline.hpp"
+#include "utility/simplescim_error_string.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+TEST_CASE("Render pipeline returns the objects in order") {
+    const size_t count = 1000;
+    auto render = [](size_t i) {
+        simplescim_error_string_set(nullptr, nullptr);
+        if (i % 10 == 3) {
+            simplescim_error_string_set("render", ("object " + std::to_string(i)).c_str());
+            throw std::runtime_error("failed " + std::to_string(i));
+        }
+        return std::make_shared<rendered_object>(std::to_string(i), "A", "{}");
+    };
+
+    render_pipeline pipeline(count, render, 8, 16);
+
+    for (size_t i = 0; i < count; ++i) {
+        auto result = pipeline.next();
+        if (i % 10 == 3) {
+            REQUIRE(result.object == nullptr);
+            REQUIRE(result.failure != nullptr);
+            REQUIRE_THROWS_WITH(std::rethrow_exception(result.failure), "failed " + std::to_string(i));
+            REQUIRE(result.error);
+            REQUIRE(*result.error == "render: object " + std::to_string(i));
+        }
+        else {
+            REQUIRE(result.object->get_id() == std::to_string(i));
+            REQUIRE(result.failure == nullptr);
+            REQUIRE(!result.error);
+        }
+    }
+}
+
+TEST_CASE("Render pipeline doesn't render too far ahead") {
+    std::atomic<size_t> rendered(0);
+    auto render = [&](size_t i) {
+        ++rendered;
+        return std::make_shared<rendered_object>(std::to_string(i), "A", "{}");
+    };
+
+    {
+        render_pipeline pipeline(100, render, 4, 10);
+
+        // Once the first one is there, the threads can't get more
+        // than 'window' ahead of us
+        pipeline.next();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE(rendered <= 11);
+
+        for (int i = 0; i < 20; ++i) {
+            pipeline.next();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE(rendered <= 31);
+    }
+
+    // We stopped before taking everything, nothing more is rendered
+    REQUIRE(rendered <= 31);
+}
+
+TEST_CASE("Render pipeline with nothing to render") {
+    render_pipeline pipeline(0, [](size_t) { return std::shared_ptr<rendered_object>(); }, 4, 10);
+}
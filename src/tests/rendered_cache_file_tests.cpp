@@ -1,13 +1,16 @@
 #include "catch.hpp"
 #include "rendered_cache_file.hpp"
 
+#include <filesystem>
+#include <fstream>
+
 TEST_CASE("Estimate file size") {
-    auto a = std::make_shared<rendered_object>("1", "A", "{}"); // only in cache file (size 28)
+    auto a = std::make_shared<rendered_object>("1", "A", "{}"); // only in cache file (size 44)
     auto b_old = std::make_shared<rendered_object>("2", "B", "{ \"name\": \"foo\"}");
-    auto b_new = std::make_shared<rendered_object>("2", "B", "{ \"name\": \"foobar\"}"); // newer is bigger (size 45)
+    auto b_new = std::make_shared<rendered_object>("2", "B", "{ \"name\": \"foobar\"}"); // newer is bigger (size 61)
     auto c_old = std::make_shared<rendered_object>("3", "B", "{ \"name\": \"gurka\"}");
     auto c_new = std::make_shared<rendered_object>("3", "B", "{ \"name\": \"\"}"); // newer is smaller
-    auto d = std::make_shared<rendered_object>("4", "C", "{ \"size\": 7 }"); // only in current (size 39)
+    auto d = std::make_shared<rendered_object>("4", "C", "{ \"size\": 7 }"); // only in current (size 55)
 
     rendered_object_list current;
     current.add_object(b_new);
@@ -20,7 +23,167 @@ TEST_CASE("Estimate file size") {
     cached.add_object(c_old);
 
     auto estimate = rendered_cache_file::size_estimate(current, cached);
-    // totalsize = 9 (header) + 8 (number of objects) + 28 (a) + 45 (b_new) + 44 (c_old) + 39 (d) = 173
+    // totalsize = 9 (header) + 8 (number of objects) + 44 (a) + 61 (b_new) + 60 (c_old) + 55 (d) = 237
+
+    REQUIRE(estimate == 237);
+}
+
+TEST_CASE("Estimate file size as we go") {
+    auto a = std::make_shared<rendered_object>("1", "A", "{}");
+    auto b_old = std::make_shared<rendered_object>("2", "B", "{ \"name\": \"foo\"}");
+    auto b_new = std::make_shared<rendered_object>("2", "B", "{ \"name\": \"foobar\"}");
+    auto c_old = std::make_shared<rendered_object>("3", "B", "{ \"name\": \"gurka\"}");
+    auto c_new = std::make_shared<rendered_object>("3", "B", "{ \"name\": \"\"}");
+    auto d = std::make_shared<rendered_object>("4", "C", "{ \"size\": 7 }");
+
+    rendered_object_list cached;
+    cached.add_object(a);
+    cached.add_object(b_old);
+    cached.add_object(c_old);
+
+    // 9 (header) + 8 (number of objects) + 44 (a) + 58 (b_old) + 60 (c_old)
+    auto estimate = rendered_cache_file::size_estimate(cached);
+    REQUIRE(estimate == 179);
+
+    REQUIRE(rendered_cache_file::size_increase(b_new, b_old) == 3);
+    REQUIRE(rendered_cache_file::size_increase(c_new, c_old) == 0);
+    REQUIRE(rendered_cache_file::size_increase(d, nullptr) == 55);
+
+    // Same as size_estimate(current, cached) when we've seen all current objects
+    estimate += rendered_cache_file::size_increase(b_new, b_old);
+    estimate += rendered_cache_file::size_increase(c_new, c_old);
+    estimate += rendered_cache_file::size_increase(d, nullptr);
+    REQUIRE(estimate == 237);
+}
+
+TEST_CASE("Grow the pre-allocated cache file") {
+    auto path = (std::filesystem::temp_directory_path() / "egilscim_rendered_cache_grow_test").string();
+    auto tmp = path + ".tmp";
+
+    std::ofstream ofs;
+    rendered_cache_file::begin_rendered_cache_file(path, 1000, ofs);
+    ofs.flush();
+    REQUIRE(std::filesystem::file_size(tmp) >= 1000);
+
+    rendered_cache_file::pre_allocate(ofs, 5000);
+    ofs.flush();
+    auto size = std::filesystem::file_size(tmp);
+    REQUIRE(size >= 5000);
+
+    // Never shrinks
+    rendered_cache_file::pre_allocate(ofs, 10);
+    ofs.flush();
+    REQUIRE(std::filesystem::file_size(tmp) == size);
+
+    auto objects = std::make_shared<rendered_object_list>();
+    objects->add_object(std::make_shared<rendered_object>("1", "A", "{}"));
+    rendered_cache_file::save(ofs, objects);
+    rendered_cache_file::finalize_rendered_cache_file(ofs, path);
+
+    auto contents = rendered_cache_file::get_contents(path);
+    REQUIRE(contents->size() == 1);
+    REQUIRE(std::filesystem::file_size(path) == rendered_cache_file::size_estimate(*objects));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Content hashes are kept in the cache file") {
+    auto path = (std::filesystem::temp_directory_path() / "egilscim_rendered_cache_test").string();
+
+    auto objects = std::make_shared<rendered_object_list>();
+    objects->add_object(std::make_shared<rendered_object>("1", "A", "{ \"name\": \"foo\"}"));
+
+    std::ofstream ofs;
+    rendered_cache_file::begin_rendered_cache_file(path, 1024, ofs);
+    rendered_cache_file::save(ofs, objects);
+    rendered_cache_file::finalize_rendered_cache_file(ofs, path);
+
+    auto read = rendered_cache_file::get_contents(path);
+    auto object = read->get_object("1");
+    REQUIRE(object != nullptr);
+    REQUIRE(object->get_json() == "{ \"name\": \"foo\"}");
+    REQUIRE(object->get_hash() == objects->get_object("1")->get_hash());
+    REQUIRE(*object == *objects->get_object("1"));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Objects read from the cache file") {
+    auto path = (std::filesystem::temp_directory_path() / "egilscim_rendered_cache_read_test").string();
+
+    auto objects = std::make_shared<rendered_object_list>();
+    objects->add_object(std::make_shared<rendered_object>("1", "A", "{ \"name\": \"foo\"}"));
+    objects->add_object(std::make_shared<rendered_object>("2", "B", std::string(10000, 'x')));
+    objects->add_object(std::make_shared<rendered_object>("3", "B", ""));
+
+    auto save = [&](std::shared_ptr<rendered_object_list> list) {
+        std::ofstream ofs;
+        rendered_cache_file::begin_rendered_cache_file(path, 1024, ofs);
+        rendered_cache_file::save(ofs, list);
+        rendered_cache_file::finalize_rendered_cache_file(ofs, path);
+    };
+    save(objects);
+
+    auto read = rendered_cache_file::get_contents(path);
+    REQUIRE(read->size() == 3);
+    REQUIRE(read->count("B") == 2);
+    REQUIRE(read->get_object("2")->get_json_size() == 10000);
+    REQUIRE(rendered_cache_file::size_estimate(*read) == rendered_cache_file::size_estimate(*objects));
+
+    // The objects (and copies of them) are still fine when the file they were read
+    // from has been replaced with a new cache file
+    auto copy = std::make_shared<rendered_object>(*read->get_object("1"));
+    save(read);
+    auto again = rendered_cache_file::get_contents(path);
+    std::filesystem::remove(path);
+
+    for (const auto& list : { read, again }) {
+        for (const auto& obj : *objects) {
+            auto other = list->get_object(obj.first);
+            REQUIRE(other != nullptr);
+            REQUIRE(other->get_type() == obj.second->get_type());
+            REQUIRE(other->get_json() == obj.second->get_json());
+            REQUIRE(*other == *obj.second);
+        }
+    }
+    REQUIRE(copy->get_json_view() == "{ \"name\": \"foo\"}");
+}
+
+TEST_CASE("Bad cache files") {
+    auto path = (std::filesystem::temp_directory_path() / "egilscim_rendered_cache_bad_test").string();
+
+    auto objects = std::make_shared<rendered_object_list>();
+    objects->add_object(std::make_shared<rendered_object>("1", "A", "{ \"name\": \"foo\"}"));
+
+    std::ofstream ofs;
+    rendered_cache_file::begin_rendered_cache_file(path, 1024, ofs);
+    rendered_cache_file::save(ofs, objects);
+    rendered_cache_file::finalize_rendered_cache_file(ofs, path);
+
+    // Truncated in the middle of the JSON
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    REQUIRE_THROWS_AS(rendered_cache_file::get_contents(path), std::runtime_error);
+
+    std::filesystem::resize_file(path, 0);
+    REQUIRE_THROWS_AS(rendered_cache_file::get_contents(path), std::runtime_error);
+
+    {
+        std::ofstream garbage(path, std::ios_base::binary | std::ios_base::trunc);
+        garbage << "not a cache file";
+    }
+    REQUIRE_THROWS_AS(rendered_cache_file::get_contents(path), rendered_cache_file::bad_format);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Content hash") {
+    rendered_object a("1", "A", "{}");
+
+    REQUIRE(a == rendered_object("1", "A", "{}"));
+    REQUIRE(!(a == rendered_object("1", "A", "{ }")));
+    REQUIRE(!(a == rendered_object("1", "B", "{}")));
+    REQUIRE(!(a == rendered_object("2", "A", "{}")));
 
-    REQUIRE(estimate == 173);
+    // Where one string ends and the next begins matters
+    REQUIRE(!(rendered_object("1", "AB", "{}") == rendered_object("1A", "B", "{}")));
 }
\ No newline at end of file
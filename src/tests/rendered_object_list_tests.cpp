@@ -0,0 +1,41 @@
+#include "catch.hpp"
+#include "model/rendered_object_list.hpp"
+
+TEST_CASE("Rendered objects per type") {
+    rendered_object_list list;
+    list.add_object(std::make_shared<rendered_object>("b", "Student", "{}"));
+    list.add_object(std::make_shared<rendered_object>("a", "Student", "{}"));
+    list.add_object(std::make_shared<rendered_object>("c", "StudentGroup", "{}"));
+
+    REQUIRE(list.size() == 3);
+    REQUIRE(list.count("Student") == 2);
+    REQUIRE(list.count("StudentGroup") == 1);
+    REQUIRE(list.count("Teacher") == 0);
+    REQUIRE(list.of_type("Teacher").empty());
+    REQUIRE(list.types() == std::vector<std::string>{ "Student", "StudentGroup" });
+
+    std::vector<std::string> ids;
+    for (const auto& itr : list.of_type("Student")) {
+        ids.push_back(itr.second->get_id());
+    }
+    REQUIRE(ids == std::vector<std::string>{ "a", "b" });
+
+    list.remove_object("c");
+    REQUIRE(list.count("StudentGroup") == 0);
+    REQUIRE(list.types() == std::vector<std::string>{ "Student" });
+
+    list.remove_object("nonexistent");
+    REQUIRE(list.size() == 2);
+}
+
+TEST_CASE("Replace rendered object with another type") {
+    rendered_object_list list;
+    list.add_object(std::make_shared<rendered_object>("a", "Student", "{}"));
+    list.add_object(std::make_shared<rendered_object>("a", "Teacher", "{\"x\":1}"));
+
+    REQUIRE(list.size() == 1);
+    REQUIRE(list.count("Student") == 0);
+    REQUIRE(list.count("Teacher") == 1);
+    REQUIRE(list.get_object("a")->get_json() == "{\"x\":1}");
+    REQUIRE(list.of_type("Teacher").at("a") == list.get_object("a"));
+}
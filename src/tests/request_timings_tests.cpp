@@ -0,0 +1,110 @@
+#include "catch.hpp"
+
+#include "request_timings.hpp"
+
+#include <sstream>
+
+namespace {
+
+request_timings::sample make_sample(const std::string& method, uint64_t total, const std::string& id = "") {
+    request_timings::sample s;
+    s.endpoint = "https://example.com/scim/Users";
+    s.method = method;
+    s.url = s.endpoint + (id.empty() ? "" : "/" + id);
+    s.resource_id = id;
+    s.response_code = 200;
+    s.first_byte = total / 2;
+    s.total = total;
+    s.request_bytes = 100;
+    s.response_bytes = 10;
+    return s;
+}
+
+}
+
+TEST_CASE("Latency histogram percentiles") {
+    latency_histogram h;
+    REQUIRE(h.count() == 0);
+    REQUIRE(h.percentile(0.5) == 0);
+
+    for (uint64_t i = 1; i <= 100; ++i) {
+        h.add(i * 1000);
+    }
+    REQUIRE(h.count() == 100);
+    REQUIRE(h.max() == 100000);
+
+    // Within a bucket (about 6%) of the exact value, never below it
+    for (double p : { 0.5, 0.9, 0.99 }) {
+        auto exact = static_cast<uint64_t>(p * 100) * 1000;
+        auto value = h.percentile(p);
+        REQUIRE(value >= exact);
+        REQUIRE(value <= exact + exact / 16);
+    }
+
+    REQUIRE(h.percentile(1.0) == 100000);
+}
+
+TEST_CASE("Latency histogram small and large values") {
+    latency_histogram h;
+    h.add(0);
+    h.add(3);
+    REQUIRE(h.percentile(0.5) == 0);
+    REQUIRE(h.percentile(1.0) == 3);
+
+    // Values are never rounded up past the largest value we've seen
+    latency_histogram large;
+    large.add(UINT64_MAX);
+    REQUIRE(large.percentile(0.5) == UINT64_MAX);
+}
+
+TEST_CASE("Slowest requests") {
+    request_timings timings(3);
+    REQUIRE(timings.empty());
+
+    timings.add(make_sample("PUT", 5000, "a"));
+    timings.add(make_sample("PUT", 1000, "b"));
+    timings.add(make_sample("DELETE", 9000, "c"));
+    timings.add(make_sample("PUT", 7000, "d"));
+    timings.add(make_sample("POST", 2000));
+    REQUIRE(!timings.empty());
+
+    std::ostringstream os;
+    timings.write_slowest(os, "");
+    auto json = os.str();
+
+    auto c = json.find("\"id\": \"c\"");
+    auto d = json.find("\"id\": \"d\"");
+    auto a = json.find("\"id\": \"a\"");
+    REQUIRE(c != std::string::npos);
+    REQUIRE(d != std::string::npos);
+    REQUIRE(a != std::string::npos);
+    REQUIRE(c < d);
+    REQUIRE(d < a);
+    REQUIRE(json.find("\"id\": \"b\"") == std::string::npos);
+    REQUIRE(json.find("\"total\": 9.0") != std::string::npos);
+}
+
+TEST_CASE("Request timings per endpoint and method") {
+    request_timings timings;
+
+    std::ostringstream empty;
+    timings.write_histograms(empty, "");
+    REQUIRE(empty.str() == "{}");
+
+    timings.add(make_sample("PUT", 5000, "a"));
+    timings.add(make_sample("PUT", 1000, "b"));
+    timings.add(make_sample("POST", 2000));
+
+    std::ostringstream os;
+    timings.write_histograms(os, "  ");
+    auto json = os.str();
+
+    REQUIRE(json.find("\"https://example.com/scim/Users\": {") != std::string::npos);
+    REQUIRE(json.find("\"POST\": {") != std::string::npos);
+    REQUIRE(json.find("\"PUT\": {") != std::string::npos);
+    REQUIRE(json.find("\"requests\": 2,") != std::string::npos);
+    REQUIRE(json.find("\"requestBytes\": 200,") != std::string::npos);
+    REQUIRE(json.find("\"total\": {\"p50\": 1.0, \"p90\": 5.0, \"p99\": 5.0, \"max\": 5.0}") != std::string::npos);
+    REQUIRE(json.front() == '{');
+    REQUIRE(json.back() == '}');
+}
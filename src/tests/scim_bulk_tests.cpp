@@ -0,0 +1,95 @@
+#include "catch.hpp"
+
+#include "scim_bulk.hpp"
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace pt = boost::property_tree;
+
+TEST_CASE("Bulk settings from ServiceProviderConfig") {
+    auto settings = scim_bulk::parse_service_provider_config(R"(
+        {
+          "schemas": ["urn:ietf:params:scim:schemas:core:2.0:ServiceProviderConfig"],
+          "patch": { "supported": true },
+          "bulk": { "supported": true, "maxOperations": 1000, "maxPayloadSize": 1048576 }
+        })");
+    REQUIRE(settings.supported);
+    REQUIRE(settings.max_operations == 1000);
+    REQUIRE(settings.max_payload_size == 1048576);
+
+    settings = scim_bulk::parse_service_provider_config(R"({"bulk": { "supported": false, "maxOperations": 0, "maxPayloadSize": 0 }})");
+    REQUIRE(!settings.supported);
+
+    settings = scim_bulk::parse_service_provider_config(R"({"patch": { "supported": true }})");
+    REQUIRE(!settings.supported);
+
+    // Supported but without limits isn't usable
+    settings = scim_bulk::parse_service_provider_config(R"({"bulk": { "supported": true }})");
+    REQUIRE(!settings.supported);
+
+    REQUIRE_THROWS_AS(scim_bulk::parse_service_provider_config("not json"), std::runtime_error);
+}
+
+TEST_CASE("Bulk request") {
+    std::vector<std::string> operations;
+    operations.push_back(scim_bulk::operation_json("POST", "/Users", R"({"userName":"bjensen"})", "0"));
+    operations.push_back(scim_bulk::operation_json("DELETE", "/Users/b7c14771-226c-4d05-8860-134711653041", "", "1"));
+
+    std::istringstream iss(scim_bulk::request_json(operations));
+    pt::ptree root;
+    REQUIRE_NOTHROW(pt::read_json(iss, root));
+
+    REQUIRE(root.get_child("schemas").front().second.data() == "urn:ietf:params:scim:api:messages:2.0:BulkRequest");
+
+    auto ops = root.get_child("Operations");
+    REQUIRE(ops.size() == 2);
+    auto itr = ops.begin();
+    REQUIRE(itr->second.get<std::string>("method") == "POST");
+    REQUIRE(itr->second.get<std::string>("bulkId") == "0");
+    REQUIRE(itr->second.get<std::string>("path") == "/Users");
+    REQUIRE(itr->second.get<std::string>("data.userName") == "bjensen");
+    ++itr;
+    REQUIRE(itr->second.get<std::string>("method") == "DELETE");
+    REQUIRE(itr->second.get<std::string>("bulkId") == "1");
+    REQUIRE(itr->second.get<std::string>("path") == "/Users/b7c14771-226c-4d05-8860-134711653041");
+    REQUIRE(!itr->second.get_child_optional("data"));
+}
+
+TEST_CASE("Bulk response") {
+    auto results = scim_bulk::parse_response(R"(
+        {
+          "schemas": ["urn:ietf:params:scim:api:messages:2.0:BulkResponse"],
+          "Operations": [
+            { "method": "PUT", "bulkId": "1", "location": "https://example.com/v2/Users/1", "status": "200" },
+            { "method": "POST", "bulkId": "0", "location": "https://example.com/v2/Users/2", "status": "201" },
+            { "method": "POST", "bulkId": "2", "status": "409",
+              "response": { "schemas": ["urn:ietf:params:scim:api:messages:2.0:Error"], "status": "409", "detail": "Already exists" } }
+          ]
+        })", 4);
+
+    REQUIRE(results.size() == 4);
+    REQUIRE(results[0]->status == 201);
+    REQUIRE(results[1]->status == 200);
+    REQUIRE(results[2]->status == 409);
+    REQUIRE(results[2]->detail == "Already exists");
+    REQUIRE(!results[3]);
+}
+
+TEST_CASE("Bulk response without bulkIds") {
+    // Numeric status, the SCIM 1.1 status object and no bulkIds at all
+    auto results = scim_bulk::parse_response(R"(
+        {
+          "Operations": [
+            { "method": "DELETE", "status": 204 },
+            { "method": "PUT", "status": { "code": "404" } }
+          ]
+        })", 2);
+
+    REQUIRE(results.size() == 2);
+    REQUIRE(results[0]->status == 204);
+    REQUIRE(results[1]->status == 404);
+
+    REQUIRE_THROWS_AS(scim_bulk::parse_response(R"({"totalResults": 0})", 1), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_bulk::parse_response("", 1), std::runtime_error);
+}
@@ -2,10 +2,12 @@
 
 #include <vector>
 #include <string>
+#include <thread>
 
 #include "scim_json_parse.hpp"
 #include "model/base_object.hpp"
 #include "config_file.hpp"
+#include "utility/simplescim_error_string.hpp"
 
 using namespace std;
 
@@ -78,6 +80,42 @@ TEST_CASE("Parse multiple JSON templates") {
 std::string json_string_escape(const std::string&);
 void remove_trailing_commas(std::string&);
 
+TEST_CASE("Parse JSON templates in several threads") {
+    const int N_THREADS = 8;
+    std::vector<std::string> results(N_THREADS);
+    std::vector<std::string> errors(N_THREADS);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < N_THREADS; ++i) {
+        threads.emplace_back([i, &results, &errors]() {
+            base_object obj("Student");
+            obj.add_attribute("n", { std::to_string(i) });
+            for (int j = 0; j < 100; ++j) {
+                // A new regex for each thread, and one they share
+                auto pattern = "/" + std::to_string(i) + "/";
+                results[i] = scim_json_parse(R"("a": "${switch n case )" + pattern + R"(: "mine" default: "other"}", "b": "${switch n case /.*/: "all" default: "none"}")",
+                                             obj, false);
+
+                // Errors are reported per thread
+                scim_json_parse(std::string(i, ' ') + R"("a": "${switch n case /[/: "x" default: "y"}")", obj, false);
+                errors[i] = simplescim_error_string_get();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < N_THREADS; ++i) {
+        REQUIRE(results[i] == R"("a": "mine", "b": "all")");
+        // The same error as when there's only one thread
+        base_object obj("Student");
+        obj.add_attribute("n", { std::to_string(i) });
+        scim_json_parse(std::string(i, ' ') + R"("a": "${switch n case /[/: "x" default: "y"}")", obj, false);
+        REQUIRE(errors[i] == simplescim_error_string_get());
+    }
+}
+
 TEST_CASE("json_string_escape escapes required characters and preserves UTF-8") {
     // Build input containing characters that must be escaped:
     // - double quote
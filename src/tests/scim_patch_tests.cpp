@@ -0,0 +1,153 @@
+#include "catch.hpp"
+
+#include "scim_patch.hpp"
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace pt = boost::property_tree;
+
+namespace {
+
+struct operation {
+    std::string op;
+    std::string path;
+    pt::ptree value;
+};
+
+std::vector<operation> operations(const std::string& patch) {
+    std::istringstream iss(patch);
+    pt::ptree root;
+    pt::read_json(iss, root);
+    REQUIRE(root.get_child("schemas").front().second.data() == "urn:ietf:params:scim:api:messages:2.0:PatchOp");
+
+    std::vector<operation> result;
+    for (const auto& cur : root.get_child("Operations")) {
+        operation op;
+        op.op = cur.second.get<std::string>("op");
+        op.path = cur.second.get<std::string>("path");
+        auto value = cur.second.get_child_optional("value");
+        if (value) {
+            op.value = *value;
+        }
+        result.push_back(op);
+    }
+    return result;
+}
+
+// A large group so the patch is smaller than the whole resource
+std::string group(const std::vector<std::string>& members, const std::string& display_name = "Class 1A") {
+    std::string json = R"({"schemas":["urn:scim:schemas:extension:sis:school:1.0:StudentGroup"],)"
+        R"("externalId":"18d0ee1a-a8c6-4d5d-a5ec-9e8dd3bb0c1d","displayName":")" + display_name + R"(","members":[)";
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (i != 0) {
+            json += ",";
+        }
+        json += R"({"value":")" + members[i] + R"(","$ref":"https://example.com/Users/)" + members[i] + R"("})";
+    }
+    json += "]}";
+    return json;
+}
+
+std::vector<std::string> some_members(int n) {
+    std::vector<std::string> members;
+    for (int i = 0; i < n; ++i) {
+        members.push_back("member-" + std::to_string(i));
+    }
+    return members;
+}
+
+}
+
+TEST_CASE("PATCH support in ServiceProviderConfig") {
+    REQUIRE(scim_patch::supported(R"({"patch": {"supported": true}, "bulk": {"supported": false}})"));
+    REQUIRE(!scim_patch::supported(R"({"patch": {"supported": false}})"));
+    REQUIRE(!scim_patch::supported(R"({"bulk": {"supported": true}})"));
+    REQUIRE_THROWS_AS(scim_patch::supported("{"), std::runtime_error);
+}
+
+TEST_CASE("PATCH group members") {
+    auto members = some_members(20);
+    auto previous = group(members);
+
+    members.erase(members.begin() + 3);
+    members.push_back("new-member");
+    auto current = group(members);
+
+    auto patch = scim_patch::make_patch(previous, current);
+    REQUIRE(patch);
+
+    auto ops = operations(*patch);
+    REQUIRE(ops.size() == 2);
+    REQUIRE(ops[0].op == "remove");
+    REQUIRE(ops[0].path == R"(members[value eq "member-3"])");
+    REQUIRE(ops[1].op == "add");
+    REQUIRE(ops[1].path == "members");
+    REQUIRE(ops[1].value.size() == 1);
+    REQUIRE(ops[1].value.front().second.get<std::string>("value") == "new-member");
+}
+
+TEST_CASE("PATCH simple and complex attributes") {
+    auto members = some_members(20);
+    auto previous = group(members);
+    auto current = group(members, "Class 1B");
+
+    auto patch = scim_patch::make_patch(previous, current);
+    REQUIRE(patch);
+    auto ops = operations(*patch);
+    REQUIRE(ops.size() == 1);
+    REQUIRE(ops[0].op == "replace");
+    REQUIRE(ops[0].path == "displayName");
+    REQUIRE(ops[0].value.data() == "Class 1B");
+
+    // Sub-attributes, extension schemas and removed attributes
+    std::string filler(500, 'x');
+    previous = R"({"schemas":["urn:ietf:params:scim:schemas:core:2.0:User","urn:ietf:params:scim:schemas:extension:enterprise:2.0:User"],)"
+        R"("userName":"bjensen","nickName":"Babs","name":{"givenName":"Barbara","familyName":"Jensen"},)"
+        R"("urn:ietf:params:scim:schemas:extension:enterprise:2.0:User":{"employeeNumber":"701984","department":"A"},)"
+        R"("title":")" + filler + R"("})";
+    current = R"({"schemas":["urn:ietf:params:scim:schemas:core:2.0:User","urn:ietf:params:scim:schemas:extension:enterprise:2.0:User"],)"
+        R"("userName":"bjensen","name":{"givenName":"Barbara","familyName":"Johnson"},)"
+        R"("urn:ietf:params:scim:schemas:extension:enterprise:2.0:User":{"employeeNumber":"701984","department":"B"},)"
+        R"("title":")" + filler + R"(","active":true})";
+
+    patch = scim_patch::make_patch(previous, current);
+    REQUIRE(patch);
+    ops = operations(*patch);
+    REQUIRE(ops.size() == 4);
+    REQUIRE(ops[0].op == "replace");
+    REQUIRE(ops[0].path == "name.familyName");
+    REQUIRE(ops[1].op == "replace");
+    REQUIRE(ops[1].path == "urn:ietf:params:scim:schemas:extension:enterprise:2.0:User:department");
+    REQUIRE(ops[2].op == "add");
+    REQUIRE(ops[2].path == "active");
+    REQUIRE(ops[2].value.data() == "true");
+    REQUIRE(ops[3].op == "remove");
+    REQUIRE(ops[3].path == "nickName");
+}
+
+TEST_CASE("PUT instead of PATCH") {
+    auto members = some_members(20);
+    auto previous = group(members);
+
+    // All members replaced, the patch would be larger than the resource
+    std::vector<std::string> other_members;
+    for (const auto& member : members) {
+        other_members.push_back("other-" + member);
+    }
+    REQUIRE(!scim_patch::make_patch(group(other_members), previous));
+
+    // Changed schemas
+    std::string other_schema = previous;
+    other_schema.replace(other_schema.find("StudentGroup"), 12, "ActivityGroup");
+    REQUIRE(!scim_patch::make_patch(previous, other_schema));
+
+    // A dummy object in the cache after a failure
+    REQUIRE(!scim_patch::make_patch(R"({"externalId":"18d0ee1a-a8c6-4d5d-a5ec-9e8dd3bb0c1d","dbg":"failed update"})", previous));
+
+    // Not JSON
+    REQUIRE(!scim_patch::make_patch("{", previous));
+
+    // No difference
+    REQUIRE(!scim_patch::make_patch(previous, previous));
+}
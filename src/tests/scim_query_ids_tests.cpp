@@ -0,0 +1,68 @@
+#include "catch.hpp"
+
+#include "scim_query.hpp"
+
+TEST_CASE("Page URLs") {
+    REQUIRE(scim_query::page_url("https://example.com/Users", 1, 1000, true) ==
+            "https://example.com/Users?attributes=id&startIndex=1&count=1000");
+    REQUIRE(scim_query::page_url("https://example.com/Users", 1001, 500, false) ==
+            "https://example.com/Users?startIndex=1001&count=500");
+    REQUIRE(scim_query::page_url("https://example.com/Users?filter=x", 1, 10, true) ==
+            "https://example.com/Users?filter=x&attributes=id&startIndex=1&count=10");
+}
+
+TEST_CASE("Extract ids from a ListResponse") {
+    auto page = scim_query::parse_ids(R"(
+   {
+     "schemas":["urn:ietf:params:scim:api:messages:2.0:ListResponse"],
+     "totalResults":2500,
+     "itemsPerPage":2,
+     "startIndex":1,
+     "Resources":[
+       {
+         "meta":{"resourceType":"User","location":"https://example.com/Users/x"},
+         "id":"2819c223-7f76-453a-919d-413861904646",
+         "userName":"bjensen",
+         "emails":[{"value":"b@example.com","primary":true}],
+         "active":true,
+         "nothing":null
+       },
+       {
+         "id":"c75ad752-64ae-4823-840d-ffa80929976c",
+         "name":{"givenName":"J\"Så😀"}
+       }
+     ]
+   })");
+
+    REQUIRE(page.total_results == 2500);
+    REQUIRE(page.ids == std::vector<std::string>{
+            "2819c223-7f76-453a-919d-413861904646",
+            "c75ad752-64ae-4823-840d-ffa80929976c" });
+
+    auto empty = scim_query::parse_ids(R"({"totalResults":0})");
+    REQUIRE(empty.total_results == 0);
+    REQUIRE(empty.ids.empty());
+
+    REQUIRE(scim_query::parse_ids(R"({"totalResults":1,"Resources":[{"id":"å"}]})").ids[0] == "\xc3\xa5");
+}
+
+TEST_CASE("Invalid ListResponses") {
+    REQUIRE_THROWS_AS(scim_query::parse_ids(""), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids("{"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"Resources":[]})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":3})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1,"Resources":[{"userName":"x"}]})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1,"Resources":[{"id":"x}]})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1} x)"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1,"Resources":["x"]})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1,"Resources":[{"id":"\udc00"}]})"), std::runtime_error);
+    REQUIRE_THROWS_AS(scim_query::parse_ids(R"({"totalResults":1,"x":)" + std::string(1000, '[')), std::runtime_error);
+}
+
+TEST_CASE("Remaining pages") {
+    REQUIRE(scim_query::remaining_pages(0, 1000).empty());
+    REQUIRE(scim_query::remaining_pages(1000, 1000).empty());
+    REQUIRE(scim_query::remaining_pages(1001, 1000) == std::vector<long long>{ 1001 });
+    REQUIRE(scim_query::remaining_pages(15, 5) == std::vector<long long>{ 6, 11 });
+    REQUIRE(scim_query::remaining_pages(10, 0).empty());
+}
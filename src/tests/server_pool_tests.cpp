@@ -0,0 +1,61 @@
+#include "catch.hpp"
+
+#include "server_pool.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+server_pool make_pool() {
+    return server_pool({ { "https://a.example.com/scim", "sha256//a" },
+                         { "https://b.example.com/scim", "sha256//b" } },
+                       30s);
+}
+
+}
+
+TEST_CASE("Server pool spreads requests by latency") {
+    auto pool = make_pool();
+    auto now = server_pool::clock::now();
+
+    REQUIRE(pool.size() == 2);
+    REQUIRE(pool.get(1).pinned_public_keys == "sha256//b");
+
+    // Before we know anything the requests are spread evenly
+    REQUIRE(pool.pick(now) == 0u);
+    pool.request_started(0);
+    REQUIRE(pool.pick(now) == 1u);
+    pool.request_started(1);
+
+    // a is three times as fast as b
+    pool.request_completed(0, 10ms);
+    pool.request_completed(1, 30ms);
+    REQUIRE(pool.get_requests(0) == 1);
+    REQUIRE(pool.get_latency(1).value() == Approx(0.03));
+
+    int to_a = 0;
+    for (int i = 0; i < 4; ++i) {
+        auto picked = pool.pick(now).value();
+        pool.request_started(picked);
+        to_a += picked == 0;
+    }
+    REQUIRE(to_a == 3);
+}
+
+TEST_CASE("Server pool avoids unreachable servers for a while") {
+    auto pool = make_pool();
+    auto now = server_pool::clock::now();
+
+    pool.request_started(0);
+    pool.unreachable(0, now);
+    REQUIRE(pool.get_unreachable(0) == 1);
+    REQUIRE(pool.pick(now) == 1u);
+    REQUIRE(pool.pick(now + 29s) == 1u);
+
+    pool.request_started(1);
+    pool.unreachable(1, now);
+    REQUIRE(!pool.pick(now));
+
+    // Try again after a while
+    REQUIRE(pool.pick(now + 30s) == 0u);
+}
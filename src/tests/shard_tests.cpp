@@ -0,0 +1,70 @@
+#include "catch.hpp"
+
+#include "shard.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("Parse shards") {
+    auto part = shard::parse("2/4");
+    REQUIRE(part.get_index() == 2);
+    REQUIRE(part.get_count() == 4);
+    REQUIRE(!part.all());
+    REQUIRE(part.file_suffix() == ".shard-2-of-4");
+
+    REQUIRE(shard::parse("1/1").all());
+    REQUIRE(shard::parse("1/1").file_suffix().empty());
+    REQUIRE(shard().all());
+
+    for (auto bad : { "", "2", "0/4", "5/4", "1/0", "-1/4", "a/4", "2/", "/4", "1/4/2", "1/99999999" }) {
+        REQUIRE_THROWS_AS(shard::parse(bad), std::runtime_error);
+    }
+}
+
+TEST_CASE("Objects are in exactly one shard") {
+    const int count = 4;
+    std::vector<shard> shards;
+    for (int i = 1; i <= count; ++i) {
+        shards.emplace_back(i, count);
+    }
+
+    std::vector<int> sizes(count);
+    int not_in_one = 0;
+    for (int n = 0; n < 4000; ++n) {
+        auto uuid = "0b3f" + std::to_string(n) + "-5d2e-4a6b-9c1f-7e8d9a0b1c2d";
+        int in = 0;
+        for (int i = 0; i < count; ++i) {
+            if (shards[i].contains(uuid)) {
+                ++in;
+                ++sizes[i];
+            }
+        }
+        if (in != 1 || !shard().contains(uuid)) {
+            ++not_in_one;
+        }
+    }
+    REQUIRE(not_in_one == 0);
+
+    // Roughly the same size
+    for (auto size : sizes) {
+        REQUIRE(size > 800);
+        REQUIRE(size < 1200);
+    }
+}
+
+TEST_CASE("Shard hash") {
+    // The hash must be the same everywhere, since processes on different
+    // machines (or versions) must agree on which shard an object is in
+    REQUIRE(shard::hash("") == 0xcbf29ce484222325);
+    REQUIRE(shard::hash("a") == 0xaf63dc4c8601ec8c);
+
+    // UUIDs are case insensitive
+    REQUIRE(shard::hash("0B3F-ABC") == shard::hash("0b3f-abc"));
+}
+
+TEST_CASE("Share of a limit") {
+    REQUIRE(shard(1, 4).share(100) == 25);
+    REQUIRE(shard(3, 4).share(10) == 3);
+    REQUIRE(shard(1, 4).share(0) == 0);
+    REQUIRE(shard().share(7) == 7);
+}
@@ -46,4 +46,21 @@ TEST_CASE("Count cache objects") {
     REQUIRE(count_objects_of_type(list, "Student") == 2);
     REQUIRE(count_objects_of_type(list, "StudentGroup") == 1);
     REQUIRE(count_objects_of_type(list, "Teacher") == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Count objects in shard") {
+    auto objects = std::make_shared<object_list>();
+    for (int i = 0; i < 10; ++i) {
+        auto uid = std::to_string(i);
+        objects->add_object(uid, std::make_shared<base_object>(attrib_map{ { "uid", { uid } } }));
+    }
+
+    REQUIRE(count_objects_in_shard(nullptr, shard()) == 0);
+    REQUIRE(count_objects_in_shard(objects, shard()) == 10);
+
+    int total = 0;
+    for (int i = 1; i <= 3; ++i) {
+        total += count_objects_in_shard(objects, shard(i, 3));
+    }
+    REQUIRE(total == 10);
+}
@@ -18,6 +18,7 @@
  */
 
 #include "thresholds.hpp"
+#include <algorithm>
 #include <sstream>
 #include "config_file.hpp"
 
@@ -96,25 +97,38 @@ int count_objects_of_type(std::shared_ptr<rendered_object_list> cache, const std
     if (cache == nullptr) {
         return 0;
     }
-    int c = 0;
-    for (const auto& itr : *cache) {
-        if (itr.second->get_type() == type) {
-            ++c;
-        }
+    return static_cast<int>(cache->count(type));
+}
+
+int count_objects_in_shard(std::shared_ptr<object_list> objects, const shard& part) {
+    if (objects == nullptr) {
+        return 0;
     }
-    return c;
+    if (part.all()) {
+        return static_cast<int>(objects->size());
+    }
+    return static_cast<int>(std::count_if(objects->begin(), objects->end(),
+                                          [&](const auto& p) { return part.contains(p.first); }));
 }
 
-void verify_thresholds(std::shared_ptr<rendered_object_list> cache, const data_server& server) {
+void verify_thresholds(std::shared_ptr<rendered_object_list> cache,
+                       const data_server& server,
+                       const shard& part) {
     auto types_to_verify = config_file::instance().get_vector("scim-type-send-order");
 
     for (auto& type : types_to_verify) {
         std::optional<int> absolute_threshold(get_absolute_threshold(type));
         std::optional<int> relative_threshold(get_relative_threshold(type));
 
+        // The cache only has this shard's objects, and each shard gets its share
+        // of an absolute threshold, so the shards together allow as much as one
+        // process without sharding would
+        if (absolute_threshold.has_value()) {
+            absolute_threshold = part.share(*absolute_threshold);
+        }
+
         int old_count = count_objects_of_type(cache, type);
-        auto current = server.get_by_type(type);
-        int new_count = current == nullptr ? 0 : current->size();
+        int new_count = count_objects_in_shard(server.get_by_type(type), part);
 
         verify_thresholds_for_type(old_count, new_count, absolute_threshold, relative_threshold);
     }
@@ -23,6 +23,7 @@
 #include <memory>
 #include "model/rendered_object_list.hpp"
 #include "data_server.hpp"
+#include "shard.hpp"
 
 /// threshold_error is thrown when a threshold is validated.
 class threshold_error : public std::runtime_error {
@@ -40,10 +41,17 @@ void verify_thresholds_for_type(int old_count,
                                 std::optional<int> absolute_threshold,
                                 std::optional<int> relative_threshold);
 
-/** Verifies the thresholds for all types in scim-type-send-order. */
-void verify_thresholds(std::shared_ptr<rendered_object_list> cache, const data_server& server);
+/** Verifies the thresholds for all types in scim-type-send-order,
+ *  for the objects in 'part' (see --shard).
+ */
+void verify_thresholds(std::shared_ptr<rendered_object_list> cache,
+                       const data_server& server,
+                       const shard& part = shard());
 
 /** Counts number of objects of a given type in the cache. */
 int count_objects_of_type(std::shared_ptr<rendered_object_list> cache, const std::string& type);
 
+/** Counts number of objects (from the data source) which are in a shard. */
+int count_objects_in_shard(std::shared_ptr<object_list> objects, const shard& part);
+
 #endif // EGILSCIM_THRESHOLDS_HPP
\ No newline at end of file
@@ -0,0 +1,241 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tls_session_cache.hpp"
+#include "utility/temporary_umask.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+std::string to_hex(const unsigned char* data, size_t len) {
+    static const char* digits = "0123456789abcdef";
+    std::string result;
+    result.reserve(len * 2);
+    for (size_t i = 0; i < len; ++i) {
+        result += digits[data[i] >> 4];
+        result += digits[data[i] & 0xf];
+    }
+    return result;
+}
+
+// Saving and loading sessions needs curl_easy_ssls_export/import
+#if LIBCURL_VERSION_NUM >= 0x080c00
+const char* FILE_HEADER = "EgilSCIM TLS sessions 1";
+
+std::string to_hex(const std::string& str) {
+    return to_hex(reinterpret_cast<const unsigned char*>(str.data()), str.size());
+}
+
+bool from_hex(const std::string& hex, std::vector<unsigned char>& result) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    result.clear();
+    result.reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = nibble(hex[i]);
+        int low = nibble(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        result.push_back(static_cast<unsigned char>(high << 4 | low));
+    }
+    return true;
+}
+
+CURLcode export_session(CURL *, void *userptr, const char *,
+                        const unsigned char *shmac, size_t shmac_len,
+                        const unsigned char *sdata, size_t sdata_len,
+                        curl_off_t valid_until, int, const char *, size_t) {
+    auto out = static_cast<std::ostream*>(userptr);
+    // The session key is only saved as a salted hash (which doesn't reveal
+    // which host the session is for), but the session data holds the secrets
+    // needed to resume the session, which is why the file is only readable
+    // by us (see save)
+    *out << static_cast<long long>(valid_until) << " "
+         << to_hex(shmac, shmac_len) << " "
+         << to_hex(sdata, sdata_len) << "\n";
+    return CURLE_OK;
+}
+#endif
+
+} // anonymous namespace
+
+tls_session_cache::tls_session_cache() {
+    share = curl_share_init();
+    if (share != nullptr) {
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+}
+
+tls_session_cache::~tls_session_cache() {
+    if (share != nullptr) {
+        curl_share_cleanup(share);
+    }
+}
+
+void tls_session_cache::attach(CURL *curl) {
+    if (share != nullptr) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+}
+
+void tls_session_cache::register_handshake(bool resumed) {
+    handshakes[resumed ? "resumed" : "full"]++;
+}
+
+void tls_session_cache::load(const std::string& path, const std::string& identity) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    if (share == nullptr) {
+        return;
+    }
+
+    std::ifstream in(path);
+    std::string header, saved_identity;
+    if (!std::getline(in, header) || header != FILE_HEADER ||
+        !std::getline(in, saved_identity) || saved_identity != to_hex(identity)) {
+        return;
+    }
+
+    CURL *curl = curl_easy_init();
+    if (curl == nullptr) {
+        return;
+    }
+    attach(curl);
+
+    auto now = static_cast<long long>(std::time(nullptr));
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream is(line);
+        long long valid_until;
+        std::string shmac_hex, sdata_hex;
+        std::vector<unsigned char> shmac, sdata;
+        if (!(is >> valid_until >> shmac_hex >> sdata_hex) ||
+            !from_hex(shmac_hex, shmac) ||
+            !from_hex(sdata_hex, sdata)) {
+            break;
+        }
+        if (valid_until > 0 && valid_until <= now) {
+            continue;
+        }
+        if (curl_easy_ssls_import(curl, nullptr,
+                                  shmac.data(), shmac.size(),
+                                  sdata.data(), sdata.size()) != CURLE_OK) {
+            // Typically because libcurl was built without support for it
+            break;
+        }
+    }
+
+    curl_easy_cleanup(curl);
+#else
+    (void)path;
+    (void)identity;
+#endif
+}
+
+bool tls_session_cache::save(const std::string& path, const std::string& identity) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    if (share == nullptr) {
+        return true;
+    }
+
+    CURL *curl = curl_easy_init();
+    if (curl == nullptr) {
+        return false;
+    }
+    attach(curl);
+
+    std::ostringstream sessions;
+    CURLcode errnum = curl_easy_ssls_export(curl, export_session, &sessions);
+    curl_easy_cleanup(curl);
+
+    if (errnum == CURLE_NOT_BUILT_IN) {
+        return true;
+    }
+    if (errnum != CURLE_OK) {
+        return false;
+    }
+
+    // The sessions are secrets, don't let anyone else read them
+    temporary_umask umask(0077);
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios_base::out | std::ios_base::trunc);
+        out << FILE_HEADER << "\n" << to_hex(identity) << "\n" << sessions.str();
+        if (!out) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
+#else
+    (void)path;
+    (void)identity;
+    return true;
+#endif
+}
+
+std::optional<bool> tls_session_cache::handshake_resumed(CURL *curl) {
+    const curl_tlssessioninfo *info = nullptr;
+
+    if (curl_easy_getinfo(curl, CURLINFO_TLS_SSL_PTR, &info) != CURLE_OK ||
+        info == nullptr ||
+        info->internals == nullptr ||
+        info->backend != CURLSSLBACKEND_OPENSSL) {
+        return std::nullopt;
+    }
+
+    return SSL_session_reused(static_cast<SSL*>(info->internals)) == 1;
+}
+
+std::string tls_session_cache::make_identity(const std::string& url,
+                                             const std::string& pinned_public_keys,
+                                             const std::string& cert_path) {
+    // A session was authenticated with a specific client certificate,
+    // so if the certificate is replaced we shouldn't resume old sessions
+    std::ifstream cert(cert_path, std::ios_base::binary);
+    std::string cert_contents((std::istreambuf_iterator<char>(cert)),
+                              std::istreambuf_iterator<char>());
+
+    // A SHA-256 digest (rather than std::hash) so the identity stays the same
+    // between builds
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (EVP_Digest(cert_contents.data(), cert_contents.size(),
+                   digest, &digest_length, EVP_sha256(), nullptr) != 1) {
+        digest_length = 0;
+    }
+
+    return url + "\n" + pinned_public_keys + "\n" + to_hex(digest, digest_length);
+}
@@ -0,0 +1,106 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_TLS_SESSION_CACHE_HPP
+#define EGILSCIM_TLS_SESSION_CACHE_HPP
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#endif
+#include <curl/curl.h>
+#include <string>
+#include <map>
+#include <optional>
+
+/**
+ * Keeps the TLS sessions negotiated with the SCIM server so that new
+ * connections can resume a session instead of doing a full handshake
+ * (which with mutual TLS is a significant part of a short request).
+ *
+ * Within a run the sessions are shared between all curl handles through
+ * a curl share handle. If a file is given the sessions are also saved
+ * when we're done and loaded in the next run. Saving and loading requires
+ * a libcurl with support for exporting SSL sessions (8.12 or later), with
+ * an older libcurl the sessions are only shared within the run.
+ */
+class tls_session_cache {
+public:
+    tls_session_cache();
+    ~tls_session_cache();
+
+    tls_session_cache(const tls_session_cache&) = delete;
+    tls_session_cache& operator=(const tls_session_cache&) = delete;
+
+    /**
+     * Loads previously saved sessions. The identity describes what the
+     * sessions are valid for (server, pinned keys and client certificate),
+     * if the file was saved with a different identity it is ignored.
+     *
+     * A missing or unreadable file is not an error, we'll simply do
+     * full handshakes.
+     */
+    void load(const std::string& path, const std::string& identity);
+
+    /**
+     * Saves the current sessions so they can be loaded in the next run.
+     * Returns false if the file couldn't be written.
+     */
+    bool save(const std::string& path, const std::string& identity);
+
+    /** Makes an easy handle use (and contribute to) the shared sessions. */
+    void attach(CURL *curl);
+
+    /**
+     * Registers the outcome of the handshake for a new connection.
+     * See handshake_resumed().
+     */
+    void register_handshake(bool resumed);
+
+    /**
+     * Number of handshakes for new connections, "resumed" for those
+     * which resumed a session and "full" for the others.
+     */
+    const std::map<std::string, int>& get_handshakes() const {
+        return handshakes;
+    }
+
+    /**
+     * Returns whether the TLS connection used by curl resumed a session.
+     * Must be called while the connection is in use (for instance from
+     * CURLOPT_PREREQFUNCTION). Returns nothing if the connection isn't
+     * TLS or the TLS backend doesn't let us tell.
+     */
+    static std::optional<bool> handshake_resumed(CURL *curl);
+
+    /**
+     * Builds the identity for load() and save() from the server's URL,
+     * its pinned public keys and the client certificate file.
+     */
+    static std::string make_identity(const std::string& url,
+                                     const std::string& pinned_public_keys,
+                                     const std::string& cert_path);
+
+private:
+    CURLSH *share;
+    std::map<std::string, int> handshakes;
+};
+
+#endif // EGILSCIM_TLS_SESSION_CACHE_HPP
@@ -0,0 +1,288 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "async_log.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// How much we collect in a stream before handing it over to the writer
+const size_t SUBMIT_SIZE = 64 * 1024;
+
+// If the writer falls this far behind, the logging threads wait for it
+const size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+
+// How long we wait for the logs to be written if the program is terminated abnormally
+const auto ABNORMAL_EXIT_TIMEOUT = std::chrono::seconds(5);
+
+void flush_on_terminate();
+extern "C" void flush_on_signal(int sig);
+
+/*
+ * The thread which writes to the log files. The logging threads only
+ * move their text into the queue, the writer takes the whole queue at
+ * once and writes it before flushing the files.
+ *
+ * The writer is never destroyed, it must outlive all logs, also those
+ * in static objects. Whatever is left in the queue is written when
+ * the program exits.
+ *
+ * If the program is terminated abnormally (std::terminate or a fatal
+ * signal) we also try to write what the open logs have collected, so
+ * that the logs aren't missing what happened right before a crash.
+ */
+class log_writer {
+public:
+    static log_writer& instance() {
+        static log_writer* writer = new log_writer;
+        return *writer;
+    }
+
+    void write(const std::shared_ptr<std::ofstream>& file, std::string&& text) {
+        std::unique_lock<std::mutex> lock(mutex);
+        written.wait(lock, [this] { return queued_bytes < MAX_QUEUED_BYTES; });
+        queued_bytes += text.size();
+        queue.push_back(entry{ file, std::move(text) });
+        ++queued_count;
+        queued.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto target = queued_count;
+        written.wait(lock, [this, target] { return written_count >= target; });
+    }
+
+    void add(std::streambuf* buf) {
+        std::lock_guard<std::mutex> lock(bufs_mutex);
+        bufs.insert(buf);
+    }
+
+    void remove(std::streambuf* buf) {
+        std::lock_guard<std::mutex> lock(bufs_mutex);
+        bufs.erase(buf);
+    }
+
+    /**
+     * Hands over what all open logs have collected, and waits (for a
+     * while) until it's written. Used when we're terminated abnormally,
+     * so it's only a best effort (for instance, it isn't async-signal-safe
+     * and other threads may be writing to the logs at the same time).
+     */
+    void flush_all() {
+        {
+            std::unique_lock<std::mutex> lock(bufs_mutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                for (auto buf : bufs) {
+                    buf->pubsync();
+                }
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        auto target = queued_count;
+        written.wait_for(lock, ABNORMAL_EXIT_TIMEOUT, [this, target] { return written_count >= target; });
+    }
+
+    std::terminate_handler previous_terminate = nullptr;
+
+private:
+    struct entry {
+        std::shared_ptr<std::ofstream> file;
+        std::string text;
+    };
+
+    log_writer() {
+        thread = std::thread([this] { run(); });
+        thread.detach();
+        std::atexit([] { log_writer::instance().wait(); });
+
+        previous_terminate = std::set_terminate(flush_on_terminate);
+        for (int sig : { SIGABRT, SIGSEGV, SIGFPE, SIGILL, SIGTERM, SIGINT }) {
+            auto previous = std::signal(sig, flush_on_signal);
+            if (previous != SIG_DFL && previous != SIG_ERR) {
+                // The program handles the signal itself (e.g. SIGTERM in daemon mode)
+                std::signal(sig, previous);
+            }
+        }
+    }
+
+    void run() {
+        std::vector<entry> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [this] { return !queue.empty(); });
+                batch.swap(queue);
+            }
+
+            std::set<std::ofstream*> files;
+            for (const auto& e : batch) {
+                e.file->write(e.text.data(), e.text.size());
+                files.insert(e.file.get());
+            }
+            for (auto file : files) {
+                file->flush();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto& e : batch) {
+                    queued_bytes -= e.text.size();
+                }
+                written_count += batch.size();
+            }
+            written.notify_all();
+            batch.clear();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable written;
+    std::vector<entry> queue;
+    size_t queued_bytes = 0;
+    uint64_t queued_count = 0;
+    uint64_t written_count = 0;
+    std::thread thread;
+
+    std::mutex bufs_mutex;
+    std::set<std::streambuf*> bufs;
+};
+
+// Set once we've started flushing because of an abnormal termination
+std::atomic<bool> terminating(false);
+
+void flush_on_terminate() {
+    if (!terminating.exchange(true)) {
+        log_writer::instance().flush_all();
+    }
+    auto previous = log_writer::instance().previous_terminate;
+    if (previous != nullptr) {
+        previous();
+    }
+    std::abort();
+}
+
+extern "C" void flush_on_signal(int sig) {
+    if (!terminating.exchange(true)) {
+        log_writer::instance().flush_all();
+    }
+    // Terminate the way we would have without the handler
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+
+} // anonymous namespace
+
+bool async_log_buf::open(const std::string& path, std::ios_base::openmode mode) {
+    close();
+    auto f = std::make_shared<std::ofstream>(path, mode | std::ios_base::out);
+    if (!f->is_open()) {
+        return false;
+    }
+    file = f;
+    // Start the writer now, so it's there when the program exits
+    log_writer::instance().add(this);
+    return true;
+}
+
+void async_log_buf::close() {
+    if (file == nullptr) {
+        return;
+    }
+    log_writer::instance().remove(this);
+    submit();
+    log_writer::instance().wait();
+    file->close();
+    file = nullptr;
+}
+
+int async_log_buf::overflow(int c) {
+    if (file == nullptr) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        pending.push_back(traits_type::to_char_type(c));
+        if (pending.size() >= SUBMIT_SIZE) {
+            submit();
+        }
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize async_log_buf::xsputn(const char* s, std::streamsize n) {
+    if (file == nullptr) {
+        return 0;
+    }
+    pending.append(s, static_cast<size_t>(n));
+    if (pending.size() >= SUBMIT_SIZE) {
+        submit();
+    }
+    return n;
+}
+
+int async_log_buf::sync() {
+    submit();
+    return 0;
+}
+
+void async_log_buf::submit() {
+    if (file == nullptr || pending.empty()) {
+        return;
+    }
+    std::string text;
+    text.reserve(SUBMIT_SIZE);
+    text.swap(pending);
+    log_writer::instance().write(file, std::move(text));
+}
+
+async_ofstream::async_ofstream()
+    : std::ostream(&buf) {
+    setstate(std::ios_base::badbit);
+}
+
+async_ofstream::~async_ofstream() {
+    close();
+}
+
+void async_ofstream::open(const std::string& path, std::ios_base::openmode mode) {
+    if (buf.open(path, mode)) {
+        clear();
+    }
+    else {
+        setstate(std::ios_base::failbit);
+    }
+}
+
+void async_ofstream::close() {
+    buf.close();
+    setstate(std::ios_base::badbit);
+}
@@ -0,0 +1,95 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_ASYNC_LOG_HPP
+#define EGILSCIM_ASYNC_LOG_HPP
+
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+/**
+ * The stream buffer of an async_ofstream. Collects what's written and
+ * hands it over to the log writer thread in large chunks.
+ */
+class async_log_buf : public std::streambuf {
+public:
+    bool open(const std::string& path, std::ios_base::openmode mode);
+    bool is_open() const {
+        return file != nullptr;
+    }
+    void close();
+
+protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    void submit();
+
+    std::shared_ptr<std::ofstream> file;
+    std::string pending;
+};
+
+/**
+ * An output file stream for logs (such as the HTTP log and the audit log)
+ * where the actual writing to the file is done by a background thread,
+ * so that logging doesn't slow down the thread doing the work.
+ *
+ * What's written is handed over to the log writer thread when the stream
+ * is flushed (for instance with std::endl) or when enough has been
+ * written, and the thread writes it in large batches. All logs share
+ * the same thread.
+ *
+ * Everything written is in the file when the stream is closed, and
+ * anything still queued is written when the program exits. If the
+ * program is terminated abnormally (std::terminate, or a signal like
+ * SIGABRT, SIGSEGV or SIGTERM which the program doesn't handle itself)
+ * an attempt is made to write what all open logs have collected.
+ *
+ * Unlike std::ofstream the stream is in a failed state while it isn't
+ * open, so writing to a log which isn't configured does nothing.
+ */
+class async_ofstream : public std::ostream {
+public:
+    async_ofstream();
+    ~async_ofstream();
+
+    async_ofstream(const async_ofstream&) = delete;
+    async_ofstream& operator=(const async_ofstream&) = delete;
+
+    /** Opens the file, sets failbit if it couldn't be opened. */
+    void open(const std::string& path,
+              std::ios_base::openmode mode = std::ios_base::out | std::ios_base::trunc);
+
+    bool is_open() const {
+        return buf.is_open();
+    }
+
+    /** Waits until everything written so far is in the file and closes it. */
+    void close();
+
+private:
+    async_log_buf buf;
+};
+
+#endif // EGILSCIM_ASYNC_LOG_HPP
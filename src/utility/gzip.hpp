@@ -0,0 +1,32 @@
+/**
+ *  This file is part of the EGIL SCIM client.
+ *
+ *  Copyright (C) 2017-2026 Föreningen Sambruk
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGILSCIM_GZIP_HPP
+#define EGILSCIM_GZIP_HPP
+
+#include <string>
+
+/**
+ * Compresses data in the gzip format (as used for Content-Encoding: gzip).
+ *
+ * Throws std::runtime_error if zlib fails.
+ */
+std::string gzip_compress(const std::string& data);
+
+#endif // EGILSCIM_GZIP_HPP
@@ -20,7 +20,8 @@
 #ifndef EGILSCIM_INDENTED_LOGGER_HPP
 #define EGILSCIM_INDENTED_LOGGER_HPP
 
-#include <fstream>
+#include <string>
+#include "async_log.hpp"
 
 /*
  * An idented logger writes messages to a file with
@@ -54,7 +55,7 @@ public:
     };
     
 private:
-    std::ofstream of;
+    async_ofstream of;
     int indentation = 0;
 
     const int INDENT = 2;
@@ -29,13 +29,14 @@
 #pragma warning( disable : 4996 )
 #endif
 
-static int prefix_present = 0;
-static char prefix_buffer[1024];
+/* Per thread, so objects can be rendered in several threads */
+static thread_local int prefix_present = 0;
+static thread_local char prefix_buffer[1024];
 
-static int message_present = 0;
-static char message_buffer[1024];
+static thread_local int message_present = 0;
+static thread_local char message_buffer[1024];
 
-static char error_string_buffer[2051];
+static thread_local char error_string_buffer[2051];
 
 static const char *no_error = "No error";
 
@@ -20,6 +20,11 @@
 #ifndef SIMPLESCIM_ERROR_STRING_H
 #define SIMPLESCIM_ERROR_STRING_H
 
+/*
+ * The error string is kept per thread, an error set in
+ * one thread isn't seen by other threads.
+ */
+
 bool has_errors_to_print();
 
 /**